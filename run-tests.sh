@@ -7,6 +7,7 @@ usage()
 	echo "Usage: $1 [options] test-case"
 	echo "Options:"
 	echo "  --disable-vsync         Disable synchronization to VBLANK."
+	echo "  --frames-in-flight NUM  Allow NUM frames in flight (0: driver default)."
 	echo "  --hdmi                  Run tests on HDMI output."
 	echo "  --lvds                  Run tests on LVDS output."
 	echo "  --performance           Run CPUs at maximum frequency."
@@ -25,6 +26,7 @@ summarize()
 
 xserver_args=
 disable_vsync=no
+frames_in_flight=
 performance=no
 regenerate=no
 subdivs=
@@ -51,6 +53,11 @@ while test $# -gt 0; do
 			shift
 			;;
 
+		--frames-in-flight)
+			prev=frames_in_flight
+			shift
+			;;
+
 		--hdmi)
 			hdmi=yes
 			shift
@@ -141,6 +148,11 @@ if test "$regenerate" = "yes"; then
 	test_args="$test_args --regenerate"
 fi
 
+if test -n "$frames_in_flight"; then
+	echo " Frames in flight: $frames_in_flight"
+	test_args="$test_args --frames-in-flight $frames_in_flight"
+fi
+
 if test -n "$subdivs"; then
 	test_args="$test_args --subdivisions $subdivs"
 fi
@@ -188,6 +200,186 @@ echo "=============================================="
 echo " Test 4: GL Color Clearing (no shaders)"
 ./src/gles-standalone $test_args clear | summarize
 
+# frames per second are fields per second for the field rate modes, the
+# references regenerate the linear deinterlacer for every frame as well
+echo "=============================================="
+echo " Test 5: Bob Deinterlace (reference: linear)"
+./src/gles-standalone $test_args -r fill deinterlace | summarize
+
+echo "=============================================="
+echo " Test 5: Bob Deinterlace (field rate)"
+./src/gles-standalone $test_args -r fill deinterlace,mode=bob | summarize
+
+echo "=============================================="
+echo " Test 6: Field Deinterlace (reference: linear, copy)"
+./src/gles-standalone $test_args -r fill deinterlace copy | summarize
+
+echo "=============================================="
+echo " Test 6: Field Deinterlace (field rate, half height)"
+./src/gles-standalone $test_args -r fill deinterlace,mode=field copy | summarize
+
+echo "=============================================="
+echo " Test 7: ALU Color Correction"
+./src/gles-standalone $test_args fill cc,add=0.1,factor=0.9 | summarize
+
+for size in 17 33; do
+	for precision in mediump highp; do
+		echo "=============================================="
+		echo " Test 8: ${size}^3 3D LUT ($precision)"
+		./src/gles-standalone $test_args fill lut,size=$size,precision=$precision | summarize
+	done
+done
+
+for layers in 1 3; do
+	for coverage in 0.25 1.0; do
+		for skip in 0 1; do
+			echo "=============================================="
+			echo " Test 9: $layers OSD Layer(s), Coverage $coverage, Skip Transparent Tiles: $skip"
+			./src/gles-standalone $test_args fill overlay,layers=$layers,coverage=$coverage,skip=$skip | summarize
+		done
+	done
+done
+
+for mask in 0 1; do
+	echo "=============================================="
+	echo " Test 10: Projector Edge Blending (mask: $mask)"
+	./src/gles-standalone $test_args fill edgeblend,left=0.15,right=0.15,black=0.02,mask=$mask | summarize
+done
+
+echo "=============================================="
+# regenerate without optimizing, so that every run renders both passes
+echo " Test 11: Orientation (reference: copy)"
+./src/gles-standalone $test_args -r -n fill copy copy | summarize
+
+for mode in 90 180 hflip transpose; do
+	for tiled in 0 1; do
+		echo "=============================================="
+		echo " Test 11: Orientation (mode: $mode, tiled: $tiled)"
+		./src/gles-standalone $test_args -r -n fill orient,mode=$mode,tiled=$tiled copy | summarize
+	done
+done
+
+for size in 480x270 960x540 1920x1080; do
+	width=${size%x*}
+	height=${size#*x}
+
+	for stage in average histogram; do
+		for readback in 0 1; do
+			echo "=============================================="
+			echo " Test 12: Reduction (stage: $stage, size: $size, readback: $readback)"
+			./src/gles-standalone $test_args fill scale,width=$width,height=$height $stage,readback=$readback copy | summarize
+		done
+	done
+done
+
+echo "=============================================="
+echo " Test 13: Frame Rate Conversion (reference: copy)"
+./src/gles-standalone $test_args ticker copy | summarize
+
+for mode in nearest blend; do
+	echo "=============================================="
+	echo " Test 13: Frame Rate Conversion (50 to 60 Hz, mode: $mode)"
+	./src/gles-standalone $test_args ticker frc,in=50,out=60,mode=$mode | summarize
+done
+
+for format in rgb565 rgba4444 rgb8 rgba8 rgb10a2 rgba16f; do
+	for dither in no yes; do
+		pipeline="ticker cc,add=0.1,factor=0.9 gauss copy"
+
+		if test "$dither" = "yes"; then
+			pipeline="ticker cc,add=0.1,factor=0.9 gauss dither"
+		fi
+
+		echo "=============================================="
+		echo " Test 14: Intermediate Format (format: $format, dither: $dither)"
+		./src/gles-standalone $test_args --intermediate-format $format $pipeline | summarize
+	done
+done
+
+for resolution in 1 0.5 0.25; do
+	echo "=============================================="
+	echo " Test 15: Reduced Resolution (resolution: $resolution)"
+	./src/gles-standalone $test_args ticker gauss,resolution=$resolution cc,add=0.1,factor=0.9 scale,filter=bicubic | summarize
+
+	echo "=============================================="
+	echo " Test 15: Reduced Resolution Quality (resolution: $resolution)"
+	./src/gles-standalone $test_args a=ticker full=gauss:a reduced=gauss,resolution=$resolution:a up=scale,filter=bicubic,resolution=1:reduced psnr:full,up copy:up | summarize
+done
+
+# tiles are never cached, so the reference regenerates every stage as well
+echo "=============================================="
+echo " Test 16: Tiled Execution (reference: full frame)"
+./src/gles-standalone $test_args -r checkerboard deinterlace gauss cc,add=0.1,factor=0.9 copy | summarize
+
+for tile in 32 64 128 256; do
+	echo "=============================================="
+	echo " Test 16: Tiled Execution (tile size: $tile)"
+	./src/gles-standalone $test_args -r -T $tile checkerboard deinterlace gauss cc,add=0.1,factor=0.9 copy | summarize
+done
+
+for pattern in checkerboard noise zoneplate gradient motion; do
+	echo "=============================================="
+	echo " Test 17: Dynamic Patterns (pattern: $pattern, regenerate)"
+	./src/gles-standalone $test_args -r $pattern,seed=1 deinterlace copy | summarize
+done
+
+for mode in image subimage; do
+	for ring in 1 2 3; do
+		echo "=============================================="
+		echo " Test 18: Texture Upload (mode: $mode, ring: $ring)"
+		./src/gles-standalone $test_args upload,mode=$mode,ring=$ring copy | summarize
+	done
+done
+
+video=/tmp/gles-testbench-video.rgba
+head -c $((640 * 360 * 4 * 60)) /dev/urandom > $video
+
+# the file has just been written, so drop it from the page cache for the
+# frames to be read from disk
+for prefetch in 0 8; do
+	sync
+	echo 3 | sudo tee /proc/sys/vm/drop_caches > /dev/null
+
+	echo "=============================================="
+	echo " Test 19: Video File Source (640x360 RGBA, prefetch: $prefetch)"
+	./src/gles-standalone $test_args upload,file=$video,width=640,height=360,ring=3,prefetch=$prefetch copy | summarize
+done
+
+rm -f $video
+
+capture=/tmp/gles-testbench-capture.y4m
+
+echo "=============================================="
+echo " Test 20: Frame Capture (reference: no capture)"
+./src/gles-standalone $test_args checkerboard deinterlace copy | summarize
+
+for interval in 1 2 4 8; do
+	echo "=============================================="
+	echo " Test 20: Frame Capture (every $interval frames, delay: 2)"
+	./src/gles-standalone $test_args checkerboard deinterlace capture,file=$capture,interval=$interval copy | summarize
+done
+
+rm -f $capture
+
+echo "=============================================="
+echo " Test 21: Zero-Copy Import (reference: upload, ring: 3)"
+./src/gles-standalone $test_args upload,ring=3 copy | summarize
+
+for reimport in 0 1; do
+	echo "=============================================="
+	echo " Test 21: Zero-Copy Import (dma-buf, reimport: $reimport)"
+	./src/gles-standalone $test_args dmabuf,ring=3,reimport=$reimport copy | summarize
+done
+
+# the fill is copied to the display after the output consumed it
+for output in nv12out i420out; do
+	for readback in 0 1; do
+		echo "=============================================="
+		echo " Test 22: YUV Output (stage: $output, readback: $readback)"
+		./src/gles-standalone $test_args -r fill $output,readback=$readback | summarize
+	done
+done
+
 echo "=============================================="
 
 echo -n " Stopping X server..."
@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2013 Avionic Design GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pipeline.h"
+#include "geometry.h"
+#include "gles.h"
+
+struct blend {
+	struct pipeline_stage base;
+
+	struct geometry *geometry;
+
+	struct glsl_shader *vertex, *fragment;
+	struct glsl_program *program;
+
+	/* attribute locations */
+	GLint pos, tex;
+
+	/* uniform locations */
+	GLint first, second, alpha;
+
+	GLfloat valpha;
+};
+
+static const GLchar *blend_vs[] = {
+	"attribute vec3 position;\n",
+	"attribute vec2 tex;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"   gl_Position = vec4(position, 1.0);\n",
+	"   vtex = tex;\n",
+	"}"
+};
+
+static const GLchar *blend_fs[] = {
+	"precision mediump float;\n",
+	"uniform sampler2D first;\n",
+	"uniform sampler2D second;\n",
+	"uniform float alpha;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"    gl_FragColor = mix(texture2D(first, vtex),\n",
+	"                       texture2D(second, vtex), alpha);\n",
+	"}"
+};
+
+static inline struct blend *to_blend(struct pipeline_stage *stage)
+{
+	return (struct blend *)stage;
+}
+
+static void blend_release(struct pipeline_stage *stage)
+{
+	struct blend *blend = to_blend(stage);
+
+	glsl_program_free(blend->program);
+	free(blend);
+}
+
+static void blend_render(struct pipeline_stage *stage)
+{
+	struct blend *blend = to_blend(stage);
+	struct geometry *geometry = blend->geometry;
+
+	glUseProgram(blend->program->id);
+
+	glVertexAttribPointer(blend->pos, 3, GL_FLOAT, GL_FALSE,
+			      3 * sizeof(GLfloat), geometry->vertices);
+	glEnableVertexAttribArray(blend->pos);
+
+	glVertexAttribPointer(blend->tex, 2, GL_FLOAT, GL_FALSE,
+			      2 * sizeof(GLfloat), geometry->uv);
+	glEnableVertexAttribArray(blend->tex);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, stage->sources[0]->texture->id);
+	glUniform1i(blend->first, 0);
+
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, stage->sources[1]->texture->id);
+	glUniform1i(blend->second, 1);
+
+	glUniform1f(blend->alpha, blend->valpha);
+
+	glDrawElements(GL_TRIANGLES, geometry->num_indices, GL_UNSIGNED_SHORT,
+		       geometry->indices);
+
+	glActiveTexture(GL_TEXTURE0);
+}
+
+static int blend_identity(struct pipeline_stage *stage)
+{
+	struct blend *blend = to_blend(stage);
+
+	if (!geometry_is_identity(blend->geometry))
+		return -1;
+
+	if (blend->valpha == 0.0f)
+		return 0;
+
+	if (blend->valpha == 1.0f)
+		return 1;
+
+	return -1;
+}
+
+static void blend_footprint(struct pipeline_stage *stage,
+			    struct region *region)
+{
+	struct blend *blend = to_blend(stage);
+
+	geometry_map_region(blend->geometry, region, region);
+}
+
+static void blend_reach(struct pipeline_stage *stage,
+			struct region *region)
+{
+	struct blend *blend = to_blend(stage);
+
+	geometry_unmap_region(blend->geometry, region, region);
+}
+
+struct pipeline_stage *blend_new(struct gles *gles, struct geometry *geometry,
+				 GLfloat alpha)
+{
+	struct blend *stage;
+
+	stage = calloc(1, sizeof(*stage));
+	if (!stage)
+		return NULL;
+
+	stage->base.name = "two-input blend operation";
+	stage->base.release = blend_release;
+	stage->base.render = blend_render;
+	stage->base.identity = blend_identity;
+	stage->base.footprint = blend_footprint;
+	stage->base.reach = blend_reach;
+
+	stage->geometry = geometry;
+	stage->base.num_inputs = 2;
+	stage->valpha = alpha;
+
+	stage->vertex = glsl_shader_new(GL_VERTEX_SHADER, blend_vs,
+					ARRAY_SIZE(blend_vs));
+	if (!stage->vertex) {
+		fprintf(stderr, "failed to create vertex shader\n");
+		return NULL;
+	}
+
+	stage->fragment = glsl_shader_new(GL_FRAGMENT_SHADER, blend_fs,
+					  ARRAY_SIZE(blend_fs));
+	if (!stage->fragment) {
+		fprintf(stderr, "failed to create fragment shader\n");
+		return NULL;
+	}
+
+	stage->program = glsl_program_new(stage->vertex, stage->fragment);
+	if (!stage->program) {
+		fprintf(stderr, "failed to create GLSL program\n");
+		return NULL;
+	}
+
+	if (glsl_program_link(stage->program) < 0) {
+		fprintf(stderr, "failed to link GLSL program\n");
+		return NULL;
+	}
+
+	stage->pos = glGetAttribLocation(stage->program->id, "position");
+	stage->tex = glGetAttribLocation(stage->program->id, "tex");
+	stage->first = glGetUniformLocation(stage->program->id, "first");
+	stage->second = glGetUniformLocation(stage->program->id, "second");
+	stage->alpha = glGetUniformLocation(stage->program->id, "alpha");
+
+	return &stage->base;
+}
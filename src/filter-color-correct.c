@@ -27,9 +27,6 @@
 struct color_correct {
 	struct pipeline_stage base;
 
-	struct framebuffer *source;
-	struct framebuffer *target;
-
 	struct glsl_shader *vertex, *fragment;
 	struct glsl_program *program;
 	struct geometry *geometry;
@@ -80,7 +77,6 @@ static void color_correct_release(struct pipeline_stage *stage)
 	struct color_correct *cc = to_color_correct(stage);
 
 	glsl_program_free(cc->program);
-	geometry_free(cc->geometry);
 	free(cc);
 }
 
@@ -92,7 +88,6 @@ static void color_correct_render(struct pipeline_stage *stage)
 	const GLushort *indices = cc->geometry->indices;
 	const GLsizei num_indices = cc->geometry->num_indices;
 
-	glBindFramebuffer(GL_FRAMEBUFFER, cc->target->id);
 	glUseProgram(cc->program->id);
 
 	glVertexAttribPointer(cc->pos, 3, GL_FLOAT, GL_FALSE,
@@ -104,7 +99,7 @@ static void color_correct_render(struct pipeline_stage *stage)
 	glEnableVertexAttribArray(cc->tex);
 
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, cc->source->texture->id);
+	glBindTexture(GL_TEXTURE_2D, stage->sources[0]->texture->id);
 	glUniform1i(cc->input, 0);
 
 	glUniform3fv(cc->factor, 1, cc->vfactor);
@@ -113,10 +108,37 @@ static void color_correct_render(struct pipeline_stage *stage)
 	glDrawElements(GL_TRIANGLES, num_indices, GL_UNSIGNED_SHORT, indices);
 }
 
+static int color_correct_identity(struct pipeline_stage *stage)
+{
+	struct color_correct *cc = to_color_correct(stage);
+	unsigned int i;
+
+	for (i = 0; i < 3; i++)
+		if (cc->vfactor[i] != 1.0f || cc->vadd[i] != 0.0f)
+			return -1;
+
+	return geometry_is_identity(cc->geometry) ? 0 : -1;
+}
+
+static void color_correct_footprint(struct pipeline_stage *stage,
+				    struct region *region)
+{
+	struct color_correct *cc = to_color_correct(stage);
+
+	geometry_map_region(cc->geometry, region, region);
+}
+
+static void color_correct_reach(struct pipeline_stage *stage,
+				struct region *region)
+{
+	struct color_correct *cc = to_color_correct(stage);
+
+	geometry_unmap_region(cc->geometry, region, region);
+}
+
 struct pipeline_stage *color_correct_new(struct gles *gles,
 					 struct geometry *geometry,
-					 struct framebuffer *source,
-					 struct framebuffer *target)
+					 GLfloat add, GLfloat factor)
 {
 	struct color_correct *stage;
 
@@ -127,10 +149,12 @@ struct pipeline_stage *color_correct_new(struct gles *gles,
 	stage->base.name = "color correction operation";
 	stage->base.release = color_correct_release;
 	stage->base.render = color_correct_render;
+	stage->base.identity = color_correct_identity;
+	stage->base.footprint = color_correct_footprint;
+	stage->base.reach = color_correct_reach;
 
 	stage->geometry = geometry;
-	stage->source = source;
-	stage->target = target;
+	stage->base.num_inputs = 1;
 
 	stage->vertex = glsl_shader_new(GL_VERTEX_SHADER, color_correct_vs,
 					ARRAY_SIZE(color_correct_vs));
@@ -163,13 +187,13 @@ struct pipeline_stage *color_correct_new(struct gles *gles,
 	stage->factor = glGetUniformLocation(stage->program->id, "factor");
 	stage->add = glGetUniformLocation(stage->program->id, "add");
 
-	stage->vfactor[0] = 1.0f;
-	stage->vfactor[1] = 1.0f;
-	stage->vfactor[2] = 1.0f;
+	stage->vfactor[0] = factor;
+	stage->vfactor[1] = factor;
+	stage->vfactor[2] = factor;
 
-	stage->vadd[0] = 0.0f;
-	stage->vadd[1] = 0.0f;
-	stage->vadd[2] = 0.0f;
+	stage->vadd[0] = add;
+	stage->vadd[1] = add;
+	stage->vadd[2] = add;
 
 	return &stage->base;
 }
@@ -0,0 +1,425 @@
+/*
+ * Copyright (C) 2013 Avionic Design GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pipeline.h"
+#include "geometry.h"
+#include "gles.h"
+
+#define CONVOLVE_MAX_RADIUS 32
+#define CONVOLVE_MAX_TAPS (CONVOLVE_MAX_RADIUS / 2 + 1)
+
+struct convolve_pass {
+	struct glsl_shader *vertex, *fragment;
+	struct glsl_program *program;
+
+	/* attribute locations */
+	GLint pos, tex;
+
+	/* uniform locations */
+	GLint input, original, texel, amount;
+};
+
+struct convolve {
+	struct pipeline_stage base;
+
+	struct geometry *geometry;
+	struct geometry *plane;
+
+	/* result of the horizontal pass */
+	struct framebuffer *intermediate;
+
+	struct convolve_pass horizontal;
+	struct convolve_pass vertical;
+
+	enum convolve_kernel kernel;
+	unsigned int radius;
+	GLfloat amount;
+
+	/* offsets (in texels) and weights of the bilinear taps */
+	GLfloat offsets[CONVOLVE_MAX_TAPS];
+	GLfloat weights[CONVOLVE_MAX_TAPS];
+	unsigned int num_taps;
+};
+
+static const GLchar *convolve_vs[] = {
+	"attribute vec3 position;\n",
+	"attribute vec2 tex;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"   gl_Position = vec4(position, 1.0);\n",
+	"   vtex = tex;\n",
+	"}"
+};
+
+static inline struct convolve *to_convolve(struct pipeline_stage *stage)
+{
+	return (struct convolve *)stage;
+}
+
+/*
+ * Compute the kernel weights and fold pairs of neighbouring taps into a
+ * single bilinear fetch placed between the two texels according to their
+ * weights. This halves the number of texture fetches per pass.
+ */
+static void convolve_compute_taps(struct convolve *convolve, GLfloat sigma)
+{
+	GLfloat weights[CONVOLVE_MAX_RADIUS + 1], sum = 0.0f;
+	unsigned int radius = convolve->radius, i;
+
+	for (i = 0; i <= radius; i++) {
+		if (convolve->kernel == CONVOLVE_BOX)
+			weights[i] = 1.0f;
+		else
+			weights[i] = expf(-(GLfloat)(i * i) /
+					  (2.0f * sigma * sigma));
+
+		sum += i > 0 ? 2.0f * weights[i] : weights[i];
+	}
+
+	for (i = 0; i <= radius; i++)
+		weights[i] /= sum;
+
+	convolve->offsets[0] = 0.0f;
+	convolve->weights[0] = weights[0];
+	convolve->num_taps = 1;
+
+	for (i = 1; i <= radius; i += 2) {
+		GLfloat w1 = weights[i];
+		GLfloat w2 = i < radius ? weights[i + 1] : 0.0f;
+		unsigned int tap = convolve->num_taps++;
+
+		convolve->weights[tap] = w1 + w2;
+		convolve->offsets[tap] = (i * w1 + (i + 1) * w2) / (w1 + w2);
+	}
+}
+
+struct shader_source {
+	char buffer[8192];
+	size_t length;
+};
+
+static void shader_source_printf(struct shader_source *source,
+				 const char *format, ...)
+{
+	size_t size = sizeof(source->buffer) - source->length;
+	va_list ap;
+	int err;
+
+	va_start(ap, format);
+	err = vsnprintf(source->buffer + source->length, size, format, ap);
+	va_end(ap);
+
+	if (err > 0)
+		source->length += (size_t)err < size ? (size_t)err : size - 1;
+}
+
+/*
+ * Generate a fragment shader with all taps unrolled and the offsets and
+ * weights built in as constants. The unsharp mask variant additionally
+ * samples the original image in the second pass.
+ */
+static struct glsl_shader *convolve_shader_new(struct convolve *convolve,
+					       bool final)
+{
+	bool unsharp = final && convolve->kernel == CONVOLVE_UNSHARP;
+	struct shader_source *source;
+	struct glsl_shader *shader;
+	const GLchar *lines[1];
+	unsigned int i;
+
+	source = calloc(1, sizeof(*source));
+	if (!source)
+		return NULL;
+
+	shader_source_printf(source, "precision mediump float;\n");
+	shader_source_printf(source, "uniform sampler2D source;\n");
+
+	if (unsharp) {
+		shader_source_printf(source, "uniform sampler2D original;\n");
+		shader_source_printf(source, "uniform float amount;\n");
+	}
+
+	shader_source_printf(source, "uniform vec2 texel;\n");
+	shader_source_printf(source, "varying vec2 vtex;\n");
+	shader_source_printf(source, "\n");
+	shader_source_printf(source, "void main()\n");
+	shader_source_printf(source, "{\n");
+	shader_source_printf(source, "    vec4 sum = texture2D(source, vtex) * %f;\n",
+			     convolve->weights[0]);
+
+	for (i = 1; i < convolve->num_taps; i++) {
+		shader_source_printf(source, "    sum += texture2D(source, vtex + texel * %f) * %f;\n",
+				     convolve->offsets[i], convolve->weights[i]);
+		shader_source_printf(source, "    sum += texture2D(source, vtex - texel * %f) * %f;\n",
+				     convolve->offsets[i], convolve->weights[i]);
+	}
+
+	if (unsharp) {
+		shader_source_printf(source, "    vec4 color = texture2D(original, vtex);\n");
+		shader_source_printf(source, "    gl_FragColor = color + (color - sum) * amount;\n");
+	} else {
+		shader_source_printf(source, "    gl_FragColor = sum;\n");
+	}
+
+	shader_source_printf(source, "}\n");
+
+	lines[0] = source->buffer;
+	shader = glsl_shader_new(GL_FRAGMENT_SHADER, lines, 1);
+	free(source);
+
+	return shader;
+}
+
+static int convolve_pass_init(struct convolve *convolve,
+			      struct convolve_pass *pass, bool final)
+{
+	pass->vertex = glsl_shader_new(GL_VERTEX_SHADER, convolve_vs,
+				       ARRAY_SIZE(convolve_vs));
+	if (!pass->vertex) {
+		fprintf(stderr, "failed to create vertex shader\n");
+		return -1;
+	}
+
+	pass->fragment = convolve_shader_new(convolve, final);
+	if (!pass->fragment) {
+		fprintf(stderr, "failed to create fragment shader\n");
+		return -1;
+	}
+
+	pass->program = glsl_program_new(pass->vertex, pass->fragment);
+	if (!pass->program) {
+		fprintf(stderr, "failed to create GLSL program\n");
+		return -1;
+	}
+
+	if (glsl_program_link(pass->program) < 0) {
+		fprintf(stderr, "failed to link GLSL program\n");
+		return -1;
+	}
+
+	pass->pos = glGetAttribLocation(pass->program->id, "position");
+	pass->tex = glGetAttribLocation(pass->program->id, "tex");
+	pass->input = glGetUniformLocation(pass->program->id, "source");
+	pass->original = glGetUniformLocation(pass->program->id, "original");
+	pass->texel = glGetUniformLocation(pass->program->id, "texel");
+	pass->amount = glGetUniformLocation(pass->program->id, "amount");
+
+	return 0;
+}
+
+static void convolve_pass_render(struct convolve *convolve,
+				 struct convolve_pass *pass,
+				 struct geometry *geometry,
+				 struct framebuffer *source,
+				 GLfloat dx, GLfloat dy)
+{
+	glUseProgram(pass->program->id);
+
+	glVertexAttribPointer(pass->pos, 3, GL_FLOAT, GL_FALSE,
+			      3 * sizeof(GLfloat), geometry->vertices);
+	glEnableVertexAttribArray(pass->pos);
+
+	glVertexAttribPointer(pass->tex, 2, GL_FLOAT, GL_FALSE,
+			      2 * sizeof(GLfloat), geometry->uv);
+	glEnableVertexAttribArray(pass->tex);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, source->texture->id);
+	glUniform1i(pass->input, 0);
+
+	glUniform2f(pass->texel, dx, dy);
+
+	if (pass->original >= 0) {
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D,
+			      convolve->base.sources[0]->texture->id);
+		glUniform1i(pass->original, 1);
+		glUniform1f(pass->amount, convolve->amount);
+	}
+
+	glDrawElements(GL_TRIANGLES, geometry->num_indices, GL_UNSIGNED_SHORT,
+		       geometry->indices);
+
+	glActiveTexture(GL_TEXTURE0);
+}
+
+static void convolve_release(struct pipeline_stage *stage)
+{
+	struct convolve *convolve = to_convolve(stage);
+
+	if (convolve->intermediate)
+		framebuffer_free(convolve->intermediate);
+
+	glsl_program_free(convolve->vertical.program);
+	glsl_program_free(convolve->horizontal.program);
+	geometry_free(convolve->plane);
+	free(convolve);
+}
+
+static void convolve_render(struct pipeline_stage *stage)
+{
+	struct convolve *convolve = to_convolve(stage);
+	struct framebuffer *source = stage->sources[0];
+	struct pipeline *pipeline = stage->pipeline;
+	struct framebuffer *target = stage->target;
+	struct framebuffer *intermediate;
+	struct region region;
+	GLint scissor[4], x0, y0, x1, y1;
+	bool clipped;
+
+	/* the horizontal pass already reduces to the output width */
+	if (!convolve->intermediate) {
+		convolve->intermediate =
+			pipeline_stage_framebuffer_new(stage, stage->width,
+						       source->height);
+		if (!convolve->intermediate)
+			return;
+	}
+
+	intermediate = convolve->intermediate;
+
+	/*
+	 * When only part of the output is rendered, the vertical pass needs
+	 * the part of the horizontal pass that the geometry maps to it, and
+	 * the lines above and below that.
+	 */
+	clipped = glIsEnabled(GL_SCISSOR_TEST);
+	if (clipped) {
+		glGetIntegerv(GL_SCISSOR_BOX, scissor);
+
+		region.x0 = (GLfloat)scissor[0] / target->width;
+		region.y0 = (GLfloat)scissor[1] / target->height;
+		region.x1 = (GLfloat)(scissor[0] + scissor[2]) / target->width;
+		region.y1 = (GLfloat)(scissor[1] + scissor[3]) / target->height;
+
+		geometry_unmap_region(convolve->geometry, &region, &region);
+
+		/* one more texel on each side for bilinear filtering */
+		x0 = floorf(region.x0 * intermediate->width) - 1;
+		y0 = floorf(region.y0 * intermediate->height) -
+		     convolve->radius - 1;
+		x1 = ceilf(region.x1 * intermediate->width) + 1;
+		y1 = ceilf(region.y1 * intermediate->height) +
+		     convolve->radius + 1;
+
+		glScissor(x0, y0, x1 - x0, y1 - y0);
+	}
+
+	pipeline_bind_framebuffer(pipeline, intermediate);
+	convolve_pass_render(convolve, &convolve->horizontal, convolve->plane,
+			     source, 1.0f / source->width, 0.0f);
+
+	if (clipped)
+		glScissor(scissor[0], scissor[1], scissor[2], scissor[3]);
+
+	pipeline_bind_framebuffer(pipeline, target);
+	convolve_pass_render(convolve, &convolve->vertical, convolve->geometry,
+			     intermediate, 0.0f,
+			     1.0f / source->height);
+}
+
+static void convolve_footprint(struct pipeline_stage *stage,
+			       struct region *region)
+{
+	struct convolve *convolve = to_convolve(stage);
+	struct framebuffer *source = stage->sources[0];
+
+	region_grow(region, (GLfloat)convolve->radius / source->width,
+		    (GLfloat)convolve->radius / source->height);
+	geometry_map_region(convolve->geometry, region, region);
+}
+
+static void convolve_reach(struct pipeline_stage *stage,
+			   struct region *region)
+{
+	struct convolve *convolve = to_convolve(stage);
+	struct framebuffer *source = stage->sources[0];
+
+	geometry_unmap_region(convolve->geometry, region, region);
+	region_grow(region, (GLfloat)convolve->radius / source->width,
+		    (GLfloat)convolve->radius / source->height);
+}
+
+struct pipeline_stage *convolve_new(struct gles *gles,
+				    struct geometry *geometry,
+				    enum convolve_kernel kernel,
+				    unsigned int radius, GLfloat sigma,
+				    GLfloat amount)
+{
+	struct convolve *stage;
+
+	if (radius < 1 || radius > CONVOLVE_MAX_RADIUS) {
+		fprintf(stderr, "radius must be between 1 and %u\n",
+			CONVOLVE_MAX_RADIUS);
+		return NULL;
+	}
+
+	stage = calloc(1, sizeof(*stage));
+	if (!stage)
+		return NULL;
+
+	switch (kernel) {
+	case CONVOLVE_GAUSSIAN:
+		stage->base.name = "separable gaussian blur operation";
+		break;
+
+	case CONVOLVE_BOX:
+		stage->base.name = "separable box blur operation";
+		break;
+
+	case CONVOLVE_UNSHARP:
+		stage->base.name = "separable unsharp mask operation";
+		break;
+	}
+
+	stage->base.release = convolve_release;
+	stage->base.render = convolve_render;
+	stage->base.footprint = convolve_footprint;
+	stage->base.reach = convolve_reach;
+	stage->base.num_inputs = 1;
+
+	stage->geometry = geometry;
+	stage->kernel = kernel;
+	stage->radius = radius;
+	stage->amount = amount;
+
+	if (sigma <= 0.0f)
+		sigma = radius / 2.0f;
+
+	convolve_compute_taps(stage, sigma);
+
+	stage->plane = grid_new(0);
+	if (!stage->plane)
+		return NULL;
+
+	if (convolve_pass_init(stage, &stage->horizontal, false) < 0)
+		return NULL;
+
+	if (convolve_pass_init(stage, &stage->vertical, true) < 0)
+		return NULL;
+
+	return &stage->base;
+}
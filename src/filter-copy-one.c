@@ -28,8 +28,6 @@ struct copy_one {
 	struct pipeline_stage base;
 
 	struct geometry *geometry;
-	struct framebuffer *source;
-	struct framebuffer *target;
 
 	struct glsl_shader *vertex, *fragment;
 	struct glsl_program *program;
@@ -82,7 +80,6 @@ static void copy_one_render(struct pipeline_stage *stage)
 	struct copy_one *copy = to_copy_one(stage);
 	struct geometry *geometry = copy->geometry;
 
-	glBindFramebuffer(GL_FRAMEBUFFER, copy->target->id);
 	glUseProgram(copy->program->id);
 
 	glVertexAttribPointer(copy->pos, 3, GL_FLOAT, GL_FALSE,
@@ -94,7 +91,7 @@ static void copy_one_render(struct pipeline_stage *stage)
 	glEnableVertexAttribArray(copy->tex);
 
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, copy->source->texture->id);
+	glBindTexture(GL_TEXTURE_2D, stage->sources[0]->texture->id);
 	glUniform1i(copy->input, 0);
 
 	glDrawElements(GL_TRIANGLES, geometry->num_indices, GL_UNSIGNED_SHORT,
@@ -102,9 +99,7 @@ static void copy_one_render(struct pipeline_stage *stage)
 }
 
 struct pipeline_stage *copy_one_new(struct gles *gles,
-				    struct geometry *geometry,
-				    struct framebuffer *source,
-				    struct framebuffer *target)
+				    struct geometry *geometry)
 {
 	struct copy_one *stage;
 
@@ -117,8 +112,7 @@ struct pipeline_stage *copy_one_new(struct gles *gles,
 	stage->base.render = copy_one_render;
 
 	stage->geometry = geometry;
-	stage->source = source;
-	stage->target = target;
+	stage->base.num_inputs = 1;
 
 	stage->vertex = glsl_shader_new(GL_VERTEX_SHADER, copy_one_vs,
 					ARRAY_SIZE(copy_one_vs));
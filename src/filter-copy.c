@@ -28,8 +28,6 @@ struct simple_copy {
 	struct pipeline_stage base;
 
 	struct geometry *geometry;
-	struct framebuffer *source;
-	struct framebuffer *target;
 
 	struct glsl_shader *vertex, *fragment;
 	struct glsl_program *program;
@@ -82,7 +80,6 @@ static void simple_copy_render(struct pipeline_stage *stage)
 	struct simple_copy *copy = to_simple_copy(stage);
 	struct geometry *geometry = copy->geometry;
 
-	glBindFramebuffer(GL_FRAMEBUFFER, copy->target->id);
 	glUseProgram(copy->program->id);
 
 	glVertexAttribPointer(copy->pos, 3, GL_FLOAT, GL_FALSE,
@@ -94,17 +91,38 @@ static void simple_copy_render(struct pipeline_stage *stage)
 	glEnableVertexAttribArray(copy->tex);
 
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, copy->source->texture->id);
+	glBindTexture(GL_TEXTURE_2D, stage->sources[0]->texture->id);
 	glUniform1i(copy->input, 0);
 
 	glDrawElements(GL_TRIANGLES, geometry->num_indices, GL_UNSIGNED_SHORT,
 		       geometry->indices);
 }
 
+static int simple_copy_identity(struct pipeline_stage *stage)
+{
+	struct simple_copy *copy = to_simple_copy(stage);
+
+	return geometry_is_identity(copy->geometry) ? 0 : -1;
+}
+
+static void simple_copy_footprint(struct pipeline_stage *stage,
+				  struct region *region)
+{
+	struct simple_copy *copy = to_simple_copy(stage);
+
+	geometry_map_region(copy->geometry, region, region);
+}
+
+static void simple_copy_reach(struct pipeline_stage *stage,
+			      struct region *region)
+{
+	struct simple_copy *copy = to_simple_copy(stage);
+
+	geometry_unmap_region(copy->geometry, region, region);
+}
+
 struct pipeline_stage *simple_copy_new(struct gles *gles,
-				       struct geometry *geometry,
-				       struct framebuffer *source,
-				       struct framebuffer *target)
+				       struct geometry *geometry)
 {
 	struct simple_copy *stage;
 
@@ -115,10 +133,12 @@ struct pipeline_stage *simple_copy_new(struct gles *gles,
 	stage->base.name = "simple texture copy operation";
 	stage->base.release = simple_copy_release;
 	stage->base.render = simple_copy_render;
+	stage->base.identity = simple_copy_identity;
+	stage->base.footprint = simple_copy_footprint;
+	stage->base.reach = simple_copy_reach;
 
 	stage->geometry = geometry;
-	stage->source = source;
-	stage->target = target;
+	stage->base.num_inputs = 1;
 
 	stage->vertex = glsl_shader_new(GL_VERTEX_SHADER, simple_copy_vs,
 					ARRAY_SIZE(simple_copy_vs));
@@ -0,0 +1,429 @@
+/*
+ * Copyright (C) 2013 Avionic Design GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pipeline.h"
+#include "geometry.h"
+#include "gles.h"
+
+/* current frame plus up to two previous ones */
+#define MOTION_DEINTERLACE_MAX_FRAMES 3
+
+struct field_pair {
+	struct framebuffer *top;
+	struct framebuffer *bottom;
+};
+
+struct motion_deinterlace {
+	struct pipeline_stage base;
+
+	struct geometry *geometry;
+	struct geometry *plane;
+
+	/*
+	 * Ring of half height field textures. The fields of the current
+	 * frame are extracted into the pair at head, overwriting the
+	 * oldest ones, so the history rotates without copying textures.
+	 */
+	struct field_pair frames[MOTION_DEINTERLACE_MAX_FRAMES];
+	unsigned int num_frames;
+	unsigned int head;
+	bool allocated;
+	bool failed;
+
+	GLfloat vthreshold;
+
+	/* field extraction */
+	struct glsl_shader *extract_vertex, *extract_fragment;
+	struct glsl_program *extract;
+	GLint extract_pos, extract_tex, extract_input, extract_offset;
+
+	struct glsl_shader *vertex, *fragment;
+	struct glsl_program *program;
+
+	/* attribute locations */
+	GLint pos, tex;
+
+	/* uniform locations */
+	GLint top[MOTION_DEINTERLACE_MAX_FRAMES];
+	GLint bottom[MOTION_DEINTERLACE_MAX_FRAMES];
+	GLint height, threshold;
+};
+
+static const GLchar *motion_deinterlace_vs[] = {
+	"attribute vec3 position;\n",
+	"attribute vec2 tex;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"   gl_Position = vec4(position, 1.0);\n",
+	"   vtex = tex;\n",
+	"}"
+};
+
+static const GLchar *motion_deinterlace_extract_fs[] = {
+	GLSL_PRECISION_HIGH,
+	"uniform sampler2D source;\n",
+	"uniform float offset;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"    gl_FragColor = texture2D(source, vec2(vtex.x, vtex.y + offset));\n",
+	"}"
+};
+
+/*
+ * Lines of the top field are passed through. Lines of the bottom field
+ * are woven in where the picture is static and interpolated from the top
+ * field where it moves. Motion is the largest luma difference between
+ * the current fields and the previous ones of the same parity, and with
+ * a longer history also between the previous two bottom fields so that
+ * the interpolation doesn't switch off the moment motion stops.
+ */
+static const GLchar *motion_deinterlace_fs[] = {
+	GLSL_PRECISION_HIGH,
+	"uniform sampler2D top0, bottom0, top1, bottom1;\n",
+	"#ifdef LONG_HISTORY\n",
+	"uniform sampler2D bottom2;\n",
+	"#endif\n",
+	"uniform float height;\n",
+	"uniform float threshold;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"const vec3 luma = vec3(0.299, 0.587, 0.114);\n",
+	"\n",
+	"float difference(vec3 a, vec3 b)\n",
+	"{\n",
+	"    return abs(dot(luma, a - b));\n",
+	"}\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"    float line = floor(vtex.y * height);\n",
+	"    float row = floor(line * 0.5);\n",
+	"    vec2 above = vec2(vtex.x, (2.0 * row + 1.0) / height);\n",
+	"    vec2 below = vec2(vtex.x, (2.0 * row + 3.0) / height);\n",
+	"    vec3 t0 = texture2D(top0, above).rgb;\n",
+	"    vec3 b0, b1, t0b;\n",
+	"    float motion, amount;\n",
+	"\n",
+	"    if (line - 2.0 * row < 0.5) {\n",
+	"        gl_FragColor = vec4(t0, 1.0);\n",
+	"        return;\n",
+	"    }\n",
+	"\n",
+	"    b0 = texture2D(bottom0, above).rgb;\n",
+	"    b1 = texture2D(bottom1, above).rgb;\n",
+	"    t0b = texture2D(top0, below).rgb;\n",
+	"\n",
+	"    motion = max(difference(b0, b1),\n",
+	"                 max(difference(t0, texture2D(top1, above).rgb),\n",
+	"                     difference(t0b, texture2D(top1, below).rgb)));\n",
+	"#ifdef LONG_HISTORY\n",
+	"    motion = max(motion, difference(b1, texture2D(bottom2, above).rgb));\n",
+	"#endif\n",
+	"\n",
+	"    amount = smoothstep(threshold, 2.0 * threshold, motion);\n",
+	"    gl_FragColor = vec4(mix(b0, (t0 + t0b) * 0.5, amount), 1.0);\n",
+	"}"
+};
+
+static inline struct motion_deinterlace *
+to_motion_deinterlace(struct pipeline_stage *stage)
+{
+	return (struct motion_deinterlace *)stage;
+}
+
+static int motion_deinterlace_allocate(struct motion_deinterlace *deinterlace,
+				       struct framebuffer *source)
+{
+	struct pipeline_stage *stage = &deinterlace->base;
+	unsigned int height = source->height / 2, i;
+
+	for (i = 0; i < deinterlace->num_frames; i++) {
+		struct field_pair *frame = &deinterlace->frames[i];
+
+		frame->top = pipeline_stage_framebuffer_new(stage,
+							    source->width,
+							    height);
+		if (!frame->top)
+			return -1;
+
+		frame->bottom = pipeline_stage_framebuffer_new(stage,
+							       source->width,
+							       height);
+		if (!frame->bottom)
+			return -1;
+	}
+
+	return 0;
+}
+
+static void motion_deinterlace_extract(struct motion_deinterlace *deinterlace,
+				       struct framebuffer *source,
+				       struct framebuffer *field,
+				       GLfloat offset)
+{
+	struct pipeline *pipeline = deinterlace->base.pipeline;
+	struct geometry *geometry = deinterlace->plane;
+
+	pipeline_bind_framebuffer(pipeline, field);
+
+	glUseProgram(deinterlace->extract->id);
+
+	glVertexAttribPointer(deinterlace->extract_pos, 3, GL_FLOAT, GL_FALSE,
+			      3 * sizeof(GLfloat), geometry->vertices);
+	glEnableVertexAttribArray(deinterlace->extract_pos);
+
+	glVertexAttribPointer(deinterlace->extract_tex, 2, GL_FLOAT, GL_FALSE,
+			      2 * sizeof(GLfloat), geometry->uv);
+	glEnableVertexAttribArray(deinterlace->extract_tex);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, source->texture->id);
+	glUniform1i(deinterlace->extract_input, 0);
+	glUniform1f(deinterlace->extract_offset, offset);
+
+	glDrawElements(GL_TRIANGLES, geometry->num_indices, GL_UNSIGNED_SHORT,
+		       geometry->indices);
+}
+
+static void motion_deinterlace_release(struct pipeline_stage *stage)
+{
+	struct motion_deinterlace *deinterlace = to_motion_deinterlace(stage);
+	unsigned int i;
+
+	for (i = 0; i < deinterlace->num_frames; i++) {
+		if (deinterlace->frames[i].top)
+			framebuffer_free(deinterlace->frames[i].top);
+
+		if (deinterlace->frames[i].bottom)
+			framebuffer_free(deinterlace->frames[i].bottom);
+	}
+
+	glsl_program_free(deinterlace->program);
+	glsl_program_free(deinterlace->extract);
+	geometry_free(deinterlace->plane);
+	free(deinterlace);
+}
+
+static void motion_deinterlace_render(struct pipeline_stage *stage)
+{
+	struct motion_deinterlace *deinterlace = to_motion_deinterlace(stage);
+	struct geometry *geometry = deinterlace->geometry;
+	struct framebuffer *source = stage->sources[0];
+	struct pipeline *pipeline = stage->pipeline;
+	unsigned int num_frames = deinterlace->num_frames, i, count;
+	GLfloat offset = 0.5f / source->height;
+
+	if (deinterlace->failed)
+		return;
+
+	/* fill the whole history with the first frame */
+	if (!deinterlace->allocated) {
+		if (motion_deinterlace_allocate(deinterlace, source) < 0) {
+			fprintf(stderr, "failed to allocate field history\n");
+			deinterlace->failed = true;
+			return;
+		}
+
+		deinterlace->allocated = true;
+		count = num_frames;
+	} else {
+		count = 1;
+	}
+
+	for (i = 0; i < count; i++) {
+		struct field_pair *frame;
+
+		deinterlace->head = (deinterlace->head + 1) % num_frames;
+		frame = &deinterlace->frames[deinterlace->head];
+
+		motion_deinterlace_extract(deinterlace, source, frame->top,
+					   -offset);
+		motion_deinterlace_extract(deinterlace, source, frame->bottom,
+					   offset);
+	}
+
+	pipeline_bind_framebuffer(pipeline, stage->target);
+
+	glUseProgram(deinterlace->program->id);
+
+	glVertexAttribPointer(deinterlace->pos, 3, GL_FLOAT, GL_FALSE,
+			      3 * sizeof(GLfloat), geometry->vertices);
+	glEnableVertexAttribArray(deinterlace->pos);
+
+	glVertexAttribPointer(deinterlace->tex, 2, GL_FLOAT, GL_FALSE,
+			      2 * sizeof(GLfloat), geometry->uv);
+	glEnableVertexAttribArray(deinterlace->tex);
+
+	/* newest frame first */
+	for (i = 0; i < num_frames; i++) {
+		unsigned int index = (deinterlace->head + num_frames - i) %
+				     num_frames;
+		struct field_pair *frame = &deinterlace->frames[index];
+
+		if (deinterlace->top[i] >= 0) {
+			glActiveTexture(GL_TEXTURE0 + 2 * i);
+			glBindTexture(GL_TEXTURE_2D, frame->top->texture->id);
+			glUniform1i(deinterlace->top[i], 2 * i);
+		}
+
+		if (deinterlace->bottom[i] >= 0) {
+			glActiveTexture(GL_TEXTURE0 + 2 * i + 1);
+			glBindTexture(GL_TEXTURE_2D,
+				      frame->bottom->texture->id);
+			glUniform1i(deinterlace->bottom[i], 2 * i + 1);
+		}
+	}
+
+	glUniform1f(deinterlace->height, source->height);
+	glUniform1f(deinterlace->threshold, deinterlace->vthreshold);
+
+	glDrawElements(GL_TRIANGLES, geometry->num_indices, GL_UNSIGNED_SHORT,
+		       geometry->indices);
+
+	glActiveTexture(GL_TEXTURE0);
+}
+
+struct pipeline_stage *motion_deinterlace_new(struct gles *gles,
+					      struct geometry *geometry,
+					      unsigned int fields,
+					      GLfloat threshold)
+{
+	static const char *const tops[MOTION_DEINTERLACE_MAX_FRAMES] = {
+		"top0", "top1", "top2"
+	};
+	static const char *const bottoms[MOTION_DEINTERLACE_MAX_FRAMES] = {
+		"bottom0", "bottom1", "bottom2"
+	};
+	const GLchar *fs[ARRAY_SIZE(motion_deinterlace_fs) + 1];
+	struct motion_deinterlace *stage;
+	unsigned int i;
+
+	if (fields != 2 && fields != 4) {
+		fprintf(stderr, "field history must be 2 or 4 fields\n");
+		return NULL;
+	}
+
+	stage = calloc(1, sizeof(*stage));
+	if (!stage)
+		return NULL;
+
+	stage->base.name = "motion-adaptive deinterlace operation";
+	stage->base.release = motion_deinterlace_release;
+	stage->base.render = motion_deinterlace_render;
+	stage->base.num_inputs = 1;
+	stage->base.stateful = true;
+
+	stage->geometry = geometry;
+	stage->num_frames = fields / 2 + 1;
+	stage->vthreshold = threshold;
+
+	stage->plane = grid_new(0);
+	if (!stage->plane)
+		return NULL;
+
+	stage->extract_vertex = glsl_shader_new(GL_VERTEX_SHADER,
+						motion_deinterlace_vs,
+						ARRAY_SIZE(motion_deinterlace_vs));
+	if (!stage->extract_vertex) {
+		fprintf(stderr, "failed to create vertex shader\n");
+		return NULL;
+	}
+
+	stage->extract_fragment =
+		glsl_shader_new(GL_FRAGMENT_SHADER,
+				motion_deinterlace_extract_fs,
+				ARRAY_SIZE(motion_deinterlace_extract_fs));
+	if (!stage->extract_fragment) {
+		fprintf(stderr, "failed to create fragment shader\n");
+		return NULL;
+	}
+
+	stage->extract = glsl_program_new(stage->extract_vertex,
+					  stage->extract_fragment);
+	if (!stage->extract) {
+		fprintf(stderr, "failed to create GLSL program\n");
+		return NULL;
+	}
+
+	if (glsl_program_link(stage->extract) < 0) {
+		fprintf(stderr, "failed to link GLSL program\n");
+		return NULL;
+	}
+
+	stage->extract_pos = glGetAttribLocation(stage->extract->id,
+						 "position");
+	stage->extract_tex = glGetAttribLocation(stage->extract->id, "tex");
+	stage->extract_input = glGetUniformLocation(stage->extract->id,
+						    "source");
+	stage->extract_offset = glGetUniformLocation(stage->extract->id,
+						     "offset");
+
+	fs[0] = fields > 2 ? "#define LONG_HISTORY\n" : "\n";
+
+	for (i = 0; i < ARRAY_SIZE(motion_deinterlace_fs); i++)
+		fs[i + 1] = motion_deinterlace_fs[i];
+
+	stage->vertex = glsl_shader_new(GL_VERTEX_SHADER,
+					motion_deinterlace_vs,
+					ARRAY_SIZE(motion_deinterlace_vs));
+	if (!stage->vertex) {
+		fprintf(stderr, "failed to create vertex shader\n");
+		return NULL;
+	}
+
+	stage->fragment = glsl_shader_new(GL_FRAGMENT_SHADER, fs,
+					  ARRAY_SIZE(fs));
+	if (!stage->fragment) {
+		fprintf(stderr, "failed to create fragment shader\n");
+		return NULL;
+	}
+
+	stage->program = glsl_program_new(stage->vertex, stage->fragment);
+	if (!stage->program) {
+		fprintf(stderr, "failed to create GLSL program\n");
+		return NULL;
+	}
+
+	if (glsl_program_link(stage->program) < 0) {
+		fprintf(stderr, "failed to link GLSL program\n");
+		return NULL;
+	}
+
+	stage->pos = glGetAttribLocation(stage->program->id, "position");
+	stage->tex = glGetAttribLocation(stage->program->id, "tex");
+	stage->height = glGetUniformLocation(stage->program->id, "height");
+	stage->threshold = glGetUniformLocation(stage->program->id,
+						"threshold");
+
+	for (i = 0; i < MOTION_DEINTERLACE_MAX_FRAMES; i++) {
+		stage->top[i] = glGetUniformLocation(stage->program->id,
+						     tops[i]);
+		stage->bottom[i] = glGetUniformLocation(stage->program->id,
+							bottoms[i]);
+	}
+
+	return &stage->base;
+}
@@ -24,13 +24,7 @@
 #include "geometry.h"
 #include "gles.h"
 
-struct deinterlace {
-	struct pipeline_stage base;
-
-	struct geometry *geometry;
-	struct framebuffer *source;
-	struct framebuffer *target;
-
+struct deinterlace_pass {
 	struct glsl_shader *vertex, *fragment;
 	struct glsl_program *program;
 
@@ -38,7 +32,23 @@ struct deinterlace {
 	GLint pos, tex;
 
 	/* uniform locations */
-	GLint input, offset;
+	GLint input, offset, height, parity;
+};
+
+struct deinterlace {
+	struct pipeline_stage base;
+
+	struct geometry *geometry;
+	struct geometry *plane;
+
+	struct deinterlace_pass output;
+
+	/* bob extracts the current field at half height first */
+	struct deinterlace_pass extract;
+	struct framebuffer *field;
+
+	/* field shown by the field rate modes, 0: top, 1: bottom */
+	unsigned int field_index;
 };
 
 static const GLchar *deinterlace_vs[] = {
@@ -75,94 +85,255 @@ static const GLchar *deinterlace_fs[] = {
 	"}"
 };
 
+/*
+ * Picks the lines of the current field, which is rendered at half height
+ * when the stage isn't the final one.
+ */
+static const GLchar *deinterlace_field_fs[] = {
+	GLSL_PRECISION_HIGH,
+	"uniform sampler2D source;\n",
+	"uniform float height;\n",
+	"uniform float parity;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"    float row = floor(vtex.y * height * 0.5);\n",
+	"    float y = (2.0 * row + parity + 0.5) / height;\n",
+	"\n",
+	"    gl_FragColor = texture2D(source, vec2(vtex.x, y));\n",
+	"}"
+};
+
+/*
+ * Line doubling from the half height field. Its lines are shifted by the
+ * parity of the field to where they were in the frame, and the missing
+ * lines in between are interpolated by bilinear filtering.
+ */
+static const GLchar *deinterlace_bob_fs[] = {
+	GLSL_PRECISION_HIGH,
+	"uniform sampler2D source;\n",
+	"uniform float offset;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"    gl_FragColor = texture2D(source, vec2(vtex.x, vtex.y + offset));\n",
+	"}"
+};
+
 static inline struct deinterlace *to_deinterlace(struct pipeline_stage *stage)
 {
 	return (struct deinterlace *)stage;
 }
 
+static int deinterlace_pass_init(struct deinterlace_pass *pass,
+				 const GLchar **fs, GLint count)
+{
+	pass->vertex = glsl_shader_new(GL_VERTEX_SHADER, deinterlace_vs,
+				       ARRAY_SIZE(deinterlace_vs));
+	if (!pass->vertex) {
+		fprintf(stderr, "failed to create vertex shader\n");
+		return -1;
+	}
+
+	pass->fragment = glsl_shader_new(GL_FRAGMENT_SHADER, fs, count);
+	if (!pass->fragment) {
+		fprintf(stderr, "failed to create fragment shader\n");
+		return -1;
+	}
+
+	pass->program = glsl_program_new(pass->vertex, pass->fragment);
+	if (!pass->program) {
+		fprintf(stderr, "failed to create GLSL program\n");
+		return -1;
+	}
+
+	if (glsl_program_link(pass->program) < 0) {
+		fprintf(stderr, "failed to link GLSL program\n");
+		return -1;
+	}
+
+	pass->pos = glGetAttribLocation(pass->program->id, "position");
+	pass->tex = glGetAttribLocation(pass->program->id, "tex");
+	pass->input = glGetUniformLocation(pass->program->id, "source");
+	pass->offset = glGetUniformLocation(pass->program->id, "offset");
+	pass->height = glGetUniformLocation(pass->program->id, "height");
+	pass->parity = glGetUniformLocation(pass->program->id, "parity");
+
+	return 0;
+}
+
+static void deinterlace_pass_render(struct deinterlace *deinterlace,
+				    struct deinterlace_pass *pass,
+				    struct geometry *geometry,
+				    struct framebuffer *source,
+				    GLfloat offset)
+{
+	glUseProgram(pass->program->id);
+
+	glVertexAttribPointer(pass->pos, 3, GL_FLOAT, GL_FALSE,
+			      3 * sizeof(GLfloat), geometry->vertices);
+	glEnableVertexAttribArray(pass->pos);
+
+	glVertexAttribPointer(pass->tex, 2, GL_FLOAT, GL_FALSE,
+			      2 * sizeof(GLfloat), geometry->uv);
+	glEnableVertexAttribArray(pass->tex);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, source->texture->id);
+	glUniform1i(pass->input, 0);
+
+	glUniform1f(pass->offset, offset);
+	glUniform1f(pass->height, source->height);
+	glUniform1f(pass->parity, deinterlace->field_index);
+
+	glDrawElements(GL_TRIANGLES, geometry->num_indices, GL_UNSIGNED_SHORT,
+		       geometry->indices);
+}
+
 static void deinterlace_release(struct pipeline_stage *stage)
 {
 	struct deinterlace *deinterlace = to_deinterlace(stage);
 
-	glsl_program_free(deinterlace->program);
+	if (deinterlace->field)
+		framebuffer_free(deinterlace->field);
+
+	if (deinterlace->extract.program)
+		glsl_program_free(deinterlace->extract.program);
+
+	glsl_program_free(deinterlace->output.program);
+
+	if (deinterlace->plane)
+		geometry_free(deinterlace->plane);
+
 	free(deinterlace);
 }
 
 static void deinterlace_render(struct pipeline_stage *stage)
 {
 	struct deinterlace *deinterlace = to_deinterlace(stage);
-	struct geometry *geometry = deinterlace->geometry;
-	struct gles *gles = stage->pipeline->gles;
+	struct framebuffer *source = stage->sources[0];
+	struct pipeline *pipeline = stage->pipeline;
+	GLfloat offset;
 
-	glBindFramebuffer(GL_FRAMEBUFFER, deinterlace->target->id);
-	glUseProgram(deinterlace->program->id);
+	/* the field rate modes show the fields alternately */
+	deinterlace->field_index ^= 1;
 
-	glVertexAttribPointer(deinterlace->pos, 3, GL_FLOAT, GL_FALSE,
-			      3 * sizeof(GLfloat), geometry->vertices);
-	glEnableVertexAttribArray(deinterlace->pos);
+	if (!deinterlace->plane) {
+		/* the neighbouring lines are one texel apart vertically */
+		deinterlace_pass_render(deinterlace, &deinterlace->output,
+					deinterlace->geometry, source,
+					1.0f / source->height);
+		return;
+	}
 
-	glVertexAttribPointer(deinterlace->tex, 2, GL_FLOAT, GL_FALSE,
-			      2 * sizeof(GLfloat), geometry->uv);
-	glEnableVertexAttribArray(deinterlace->tex);
+	if (!deinterlace->field) {
+		deinterlace->field =
+			pipeline_stage_framebuffer_new(stage, source->width,
+						       source->height / 2);
+		if (!deinterlace->field)
+			return;
+	}
 
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, deinterlace->source->texture->id);
-	glUniform1i(deinterlace->input, 0);
+	pipeline_bind_framebuffer(pipeline, deinterlace->field);
+	deinterlace_pass_render(deinterlace, &deinterlace->extract,
+				deinterlace->plane, source, 0.0f);
 
-	glUniform1f(deinterlace->offset, 1.0f / gles->width);
+	/* line N of the field was line 2 * N + parity of the frame */
+	offset = (0.5f - deinterlace->field_index) /
+		 (2 * deinterlace->field->height);
 
-	glDrawElements(GL_TRIANGLES, geometry->num_indices, GL_UNSIGNED_SHORT,
-		       geometry->indices);
+	pipeline_bind_framebuffer(pipeline, stage->target);
+	deinterlace_pass_render(deinterlace, &deinterlace->output,
+				deinterlace->geometry, deinterlace->field,
+				offset);
+}
+
+static void deinterlace_footprint(struct pipeline_stage *stage,
+				  struct region *region)
+{
+	struct deinterlace *deinterlace = to_deinterlace(stage);
+	struct framebuffer *source = stage->sources[0];
+
+	/* each output line depends on the lines above and below */
+	region_grow(region, 0.0f, 1.0f / source->height);
+	geometry_map_region(deinterlace->geometry, region, region);
+}
+
+static void deinterlace_reach(struct pipeline_stage *stage,
+			      struct region *region)
+{
+	struct deinterlace *deinterlace = to_deinterlace(stage);
+	struct framebuffer *source = stage->sources[0];
+
+	geometry_unmap_region(deinterlace->geometry, region, region);
+	region_grow(region, 0.0f, 1.0f / source->height);
+}
+
+static void deinterlace_output_size(struct pipeline_stage *stage,
+				    unsigned int *width, unsigned int *height)
+{
+	*height /= 2;
 }
 
 struct pipeline_stage *deinterlace_new(struct gles *gles,
 				       struct geometry *geometry,
-				       struct framebuffer *source,
-				       struct framebuffer *target)
+				       enum deinterlace_mode mode)
 {
+	const GLchar **fs = deinterlace_fs;
 	struct deinterlace *stage;
+	GLint count = ARRAY_SIZE(deinterlace_fs);
 
 	stage = calloc(1, sizeof(*stage));
 	if (!stage)
 		return NULL;
 
-	stage->base.name = "linear deinterlace operation";
 	stage->base.release = deinterlace_release;
 	stage->base.render = deinterlace_render;
 
-	stage->geometry = geometry;
-	stage->source = source;
-	stage->target = target;
+	switch (mode) {
+	case DEINTERLACE_LINEAR:
+		stage->base.name = "linear deinterlace operation";
+		stage->base.footprint = deinterlace_footprint;
+		stage->base.reach = deinterlace_reach;
+		break;
 
-	stage->vertex = glsl_shader_new(GL_VERTEX_SHADER, deinterlace_vs,
-					ARRAY_SIZE(deinterlace_vs));
-	if (!stage->vertex) {
-		fprintf(stderr, "failed to create vertex shader\n");
-		return NULL;
-	}
+	/*
+	 * The field rate modes show a different field every time they are
+	 * rendered, so they are stateful.
+	 */
+	case DEINTERLACE_BOB:
+		stage->base.name = "bob deinterlace operation";
+		stage->base.stateful = true;
+		fs = deinterlace_bob_fs;
+		count = ARRAY_SIZE(deinterlace_bob_fs);
+		break;
 
-	stage->fragment = glsl_shader_new(GL_FRAGMENT_SHADER, deinterlace_fs,
-					  ARRAY_SIZE(deinterlace_fs));
-	if (!stage->fragment) {
-		fprintf(stderr, "failed to create fragment shader\n");
-		return NULL;
+	case DEINTERLACE_FIELD:
+		stage->base.name = "field deinterlace operation";
+		stage->base.output_size = deinterlace_output_size;
+		stage->base.stateful = true;
+		fs = deinterlace_field_fs;
+		count = ARRAY_SIZE(deinterlace_field_fs);
+		break;
 	}
 
-	stage->program = glsl_program_new(stage->vertex, stage->fragment);
-	if (!stage->program) {
-		fprintf(stderr, "failed to create GLSL program\n");
-		return NULL;
-	}
+	stage->geometry = geometry;
+	stage->base.num_inputs = 1;
 
-	if (glsl_program_link(stage->program) < 0) {
-		fprintf(stderr, "failed to link GLSL program\n");
-		return NULL;
+	if (mode == DEINTERLACE_BOB) {
+		stage->plane = grid_new(0);
+		if (!stage->plane)
+			return NULL;
+
+		if (deinterlace_pass_init(&stage->extract, deinterlace_field_fs,
+					  ARRAY_SIZE(deinterlace_field_fs)) < 0)
+			return NULL;
 	}
 
-	stage->pos = glGetAttribLocation(stage->program->id, "position");
-	stage->tex = glGetAttribLocation(stage->program->id, "tex");
-	stage->input = glGetUniformLocation(stage->program->id, "source");
-	stage->offset = glGetUniformLocation(stage->program->id, "offset");
+	if (deinterlace_pass_init(&stage->output, fs, count) < 0)
+		return NULL;
 
 	return &stage->base;
 }
@@ -0,0 +1,245 @@
+/*
+ * Copyright (C) 2013 Avionic Design GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pipeline.h"
+#include "geometry.h"
+#include "gles.h"
+
+/*
+ * Ordered dither to the bit depth of the output. Every channel is rounded
+ * down or up to one of the output levels depending on a 4x4 Bayer matrix
+ * threshold, so that the output format represents the result exactly and
+ * banding turns into a fine pattern.
+ */
+struct dither {
+	struct pipeline_stage base;
+
+	struct geometry *geometry;
+
+	struct glsl_shader *vertex, *fragment;
+	struct glsl_program *program;
+
+	/* attribute locations */
+	GLint pos, tex;
+
+	/* uniform locations */
+	GLint input, levels;
+
+	struct texture *pattern;
+	GLfloat vlevels[3];
+};
+
+static const GLchar *dither_vs[] = {
+	"attribute vec3 position;\n",
+	"attribute vec2 tex;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"   gl_Position = vec4(position, 1.0);\n",
+	"   vtex = tex;\n",
+	"}"
+};
+
+/*
+ * The scaled colors reach the number of levels, where mediump could no
+ * longer tell the thresholds of the pattern apart.
+ */
+static const GLchar *dither_fs[] = {
+	GLSL_PRECISION_HIGH,
+	"uniform sampler2D source;\n",
+	"uniform sampler2D pattern;\n",
+	"uniform vec3 levels;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"    vec4 color = texture2D(source, vtex);\n",
+	"    float threshold = texture2D(pattern, gl_FragCoord.xy / 4.0).r;\n",
+	"\n",
+	"    color.rgb = floor(color.rgb * levels + threshold) / levels;\n",
+	"    gl_FragColor = color;\n",
+	"}"
+};
+
+static const uint8_t dither_bayer[16] = {
+	 0,  8,  2, 10,
+	12,  4, 14,  6,
+	 3, 11,  1,  9,
+	15,  7, 13,  5,
+};
+
+static inline struct dither *to_dither(struct pipeline_stage *stage)
+{
+	return (struct dither *)stage;
+}
+
+static struct texture *dither_pattern_new(void)
+{
+	struct texture *pattern;
+	uint8_t data[16];
+	unsigned int i;
+
+	for (i = 0; i < 16; i++)
+		data[i] = (dither_bayer[i] + 0.5f) * 255.0f / 16.0f + 0.5f;
+
+	pattern = texture_new(GL_NEAREST);
+	if (!pattern)
+		return NULL;
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, 4, 4, 0, GL_LUMINANCE,
+		     GL_UNSIGNED_BYTE, data);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	return pattern;
+}
+
+static void dither_release(struct pipeline_stage *stage)
+{
+	struct dither *dither = to_dither(stage);
+
+	if (dither->pattern)
+		texture_free(dither->pattern);
+
+	glsl_program_free(dither->program);
+	free(dither);
+}
+
+static void dither_render(struct pipeline_stage *stage)
+{
+	struct dither *dither = to_dither(stage);
+	struct geometry *geometry = dither->geometry;
+
+	glUseProgram(dither->program->id);
+
+	glVertexAttribPointer(dither->pos, 3, GL_FLOAT, GL_FALSE,
+			      3 * sizeof(GLfloat), geometry->vertices);
+	glEnableVertexAttribArray(dither->pos);
+
+	glVertexAttribPointer(dither->tex, 2, GL_FLOAT, GL_FALSE,
+			      2 * sizeof(GLfloat), geometry->uv);
+	glEnableVertexAttribArray(dither->tex);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, stage->sources[0]->texture->id);
+	glUniform1i(dither->input, 0);
+
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, dither->pattern->id);
+	glUniform1i(dither->pattern->loc, 1);
+
+	glUniform3fv(dither->levels, 1, dither->vlevels);
+
+	glDrawElements(GL_TRIANGLES, geometry->num_indices, GL_UNSIGNED_SHORT,
+		       geometry->indices);
+
+	glActiveTexture(GL_TEXTURE0);
+}
+
+static void dither_footprint(struct pipeline_stage *stage,
+			     struct region *region)
+{
+	struct dither *dither = to_dither(stage);
+
+	geometry_map_region(dither->geometry, region, region);
+}
+
+static void dither_reach(struct pipeline_stage *stage,
+			 struct region *region)
+{
+	struct dither *dither = to_dither(stage);
+
+	geometry_unmap_region(dither->geometry, region, region);
+}
+
+struct pipeline_stage *dither_new(struct gles *gles, struct geometry *geometry,
+				  const unsigned int bits[3])
+{
+	struct dither *stage;
+	unsigned int i;
+
+	for (i = 0; i < 3; i++) {
+		if (bits[i] < 1 || bits[i] > 10) {
+			fprintf(stderr, "bits must be within [1, 10]\n");
+			return NULL;
+		}
+	}
+
+	stage = calloc(1, sizeof(*stage));
+	if (!stage)
+		return NULL;
+
+	stage->base.name = "dither operation";
+	stage->base.release = dither_release;
+	stage->base.render = dither_render;
+	stage->base.footprint = dither_footprint;
+	stage->base.reach = dither_reach;
+
+	stage->geometry = geometry;
+	stage->base.num_inputs = 1;
+
+	for (i = 0; i < 3; i++)
+		stage->vlevels[i] = (1 << bits[i]) - 1;
+
+	stage->pattern = dither_pattern_new();
+	if (!stage->pattern)
+		return NULL;
+
+	stage->vertex = glsl_shader_new(GL_VERTEX_SHADER, dither_vs,
+					ARRAY_SIZE(dither_vs));
+	if (!stage->vertex) {
+		fprintf(stderr, "failed to create vertex shader\n");
+		return NULL;
+	}
+
+	stage->fragment = glsl_shader_new(GL_FRAGMENT_SHADER, dither_fs,
+					  ARRAY_SIZE(dither_fs));
+	if (!stage->fragment) {
+		fprintf(stderr, "failed to create fragment shader\n");
+		return NULL;
+	}
+
+	stage->program = glsl_program_new(stage->vertex, stage->fragment);
+	if (!stage->program) {
+		fprintf(stderr, "failed to create GLSL program\n");
+		return NULL;
+	}
+
+	if (glsl_program_link(stage->program) < 0) {
+		fprintf(stderr, "failed to link GLSL program\n");
+		return NULL;
+	}
+
+	stage->pos = glGetAttribLocation(stage->program->id, "position");
+	stage->tex = glGetAttribLocation(stage->program->id, "tex");
+	stage->input = glGetUniformLocation(stage->program->id, "source");
+	stage->levels = glGetUniformLocation(stage->program->id, "levels");
+	stage->pattern->loc = glGetUniformLocation(stage->program->id,
+						   "pattern");
+
+	return &stage->base;
+}
@@ -0,0 +1,378 @@
+/*
+ * Copyright (C) 2013 Avionic Design GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pipeline.h"
+#include "geometry.h"
+#include "gles.h"
+
+/* exponent of the S-shaped ramp, before gamma correction */
+#define EDGE_BLEND_CURVE 2.0f
+
+struct edge_blend {
+	struct pipeline_stage base;
+
+	struct geometry *geometry;
+
+	struct glsl_shader *vertex, *fragment;
+	struct glsl_program *program;
+
+	/* attribute locations */
+	GLint pos, tex;
+
+	/* uniform locations */
+	GLint input, ramps, gamma, black;
+
+	/* ramp widths: left, right, bottom, top */
+	GLfloat vramps[4];
+	GLfloat vgamma;
+	GLfloat vblack;
+
+	/* precomputed blend factor (luminance) and black lift (alpha) */
+	struct texture *mask;
+	bool use_mask;
+};
+
+/* ramps are defined in output space, after geometric adaption */
+static const GLchar *edge_blend_vs[] = {
+	"attribute vec3 position;\n",
+	"attribute vec2 tex;\n",
+	"varying vec2 vtex;\n",
+	"varying vec2 vpos;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"   gl_Position = vec4(position, 1.0);\n",
+	"   vpos = position.xy * 0.5 + 0.5;\n",
+	"   vtex = tex;\n",
+	"}"
+};
+
+static const GLchar *edge_blend_alu_fs[] = {
+	"precision mediump float;\n",
+	"uniform sampler2D source;\n",
+	"uniform vec4 ramps;\n",
+	"uniform float gamma;\n",
+	"uniform float black;\n",
+	"varying vec2 vtex;\n",
+	"varying vec2 vpos;\n",
+	"\n",
+	"float ramp(float x, float width)\n",
+	"{\n",
+	"    float t, f;\n",
+	"\n",
+	"    if (width <= 0.0)\n",
+	"        return 1.0;\n",
+	"\n",
+	"    t = clamp(x / width, 0.0, 1.0);\n",
+	"\n",
+	"    if (t < 0.5)\n",
+	"        f = 0.5 * pow(2.0 * t, 2.0);\n",
+	"    else\n",
+	"        f = 1.0 - 0.5 * pow(2.0 * (1.0 - t), 2.0);\n",
+	"\n",
+	"    return pow(f, 1.0 / gamma);\n",
+	"}\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"    vec4 color = texture2D(source, vtex);\n",
+	"    vec4 edges = vec4(vpos.x, 1.0 - vpos.x, vpos.y, 1.0 - vpos.y);\n",
+	"    vec4 inside = step(ramps, edges);\n",
+	"    float factor, lift;\n",
+	"\n",
+	"    factor = ramp(edges.x, ramps.x) * ramp(edges.y, ramps.y) *\n",
+	"             ramp(edges.z, ramps.z) * ramp(edges.w, ramps.w);\n",
+	"    lift = black * inside.x * inside.y * inside.z * inside.w;\n",
+	"\n",
+	"    gl_FragColor = lift + (1.0 - lift) * color * factor;\n",
+	"}"
+};
+
+static const GLchar *edge_blend_mask_fs[] = {
+	"precision mediump float;\n",
+	"uniform sampler2D source;\n",
+	"uniform sampler2D mask;\n",
+	"varying vec2 vtex;\n",
+	"varying vec2 vpos;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"    vec4 color = texture2D(source, vtex);\n",
+	"    vec4 m = texture2D(mask, vpos);\n",
+	"\n",
+	"    gl_FragColor = m.a + (1.0 - m.a) * color * m.r;\n",
+	"}"
+};
+
+static inline struct edge_blend *to_edge_blend(struct pipeline_stage *stage)
+{
+	return (struct edge_blend *)stage;
+}
+
+/* same as ramp() in the ALU shader */
+static GLfloat edge_blend_ramp(struct edge_blend *blend, GLfloat x,
+			       GLfloat width)
+{
+	GLfloat t, f;
+
+	if (width <= 0.0f)
+		return 1.0f;
+
+	t = x / width;
+	if (t > 1.0f)
+		t = 1.0f;
+
+	if (t < 0.5f)
+		f = 0.5f * powf(2.0f * t, EDGE_BLEND_CURVE);
+	else
+		f = 1.0f - 0.5f * powf(2.0f * (1.0f - t), EDGE_BLEND_CURVE);
+
+	return powf(f, 1.0f / blend->vgamma);
+}
+
+/* the mask is computed at output resolution once the size is known */
+static int edge_blend_create_mask(struct edge_blend *blend)
+{
+	unsigned int width = blend->base.width, height = blend->base.height;
+	unsigned int x, y, i;
+	uint8_t *data;
+
+	data = malloc(width * height * 2);
+	if (!data)
+		return -1;
+
+	for (y = 0; y < height; y++) {
+		for (x = 0; x < width; x++) {
+			GLfloat edges[4], factor = 1.0f, lift = blend->vblack;
+			uint8_t *texel = data + (y * width + x) * 2;
+
+			edges[0] = (x + 0.5f) / width;
+			edges[1] = 1.0f - edges[0];
+			edges[2] = (y + 0.5f) / height;
+			edges[3] = 1.0f - edges[2];
+
+			for (i = 0; i < 4; i++) {
+				factor *= edge_blend_ramp(blend, edges[i],
+							  blend->vramps[i]);
+
+				if (edges[i] < blend->vramps[i])
+					lift = 0.0f;
+			}
+
+			texel[0] = factor * 255.0f + 0.5f;
+			texel[1] = lift * 255.0f + 0.5f;
+		}
+	}
+
+	blend->mask = texture_new(GL_LINEAR);
+	if (!blend->mask) {
+		free(data);
+		return -1;
+	}
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE_ALPHA, width, height, 0,
+		     GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE, data);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	free(data);
+	return 0;
+}
+
+static void edge_blend_release(struct pipeline_stage *stage)
+{
+	struct edge_blend *blend = to_edge_blend(stage);
+
+	if (blend->mask)
+		texture_free(blend->mask);
+
+	glsl_program_free(blend->program);
+	free(blend);
+}
+
+static void edge_blend_render(struct pipeline_stage *stage)
+{
+	struct edge_blend *blend = to_edge_blend(stage);
+	struct geometry *geometry = blend->geometry;
+
+	if (blend->use_mask && !blend->mask) {
+		if (edge_blend_create_mask(blend) < 0) {
+			fprintf(stderr, "failed to create blend mask\n");
+			return;
+		}
+
+		blend->mask->loc = glGetUniformLocation(blend->program->id,
+							"mask");
+	}
+
+	glUseProgram(blend->program->id);
+
+	glVertexAttribPointer(blend->pos, 3, GL_FLOAT, GL_FALSE,
+			      3 * sizeof(GLfloat), geometry->vertices);
+	glEnableVertexAttribArray(blend->pos);
+
+	glVertexAttribPointer(blend->tex, 2, GL_FLOAT, GL_FALSE,
+			      2 * sizeof(GLfloat), geometry->uv);
+	glEnableVertexAttribArray(blend->tex);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, stage->sources[0]->texture->id);
+	glUniform1i(blend->input, 0);
+
+	if (blend->mask) {
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, blend->mask->id);
+		glUniform1i(blend->mask->loc, 1);
+	} else {
+		glUniform4fv(blend->ramps, 1, blend->vramps);
+		glUniform1f(blend->gamma, blend->vgamma);
+		glUniform1f(blend->black, blend->vblack);
+	}
+
+	glDrawElements(GL_TRIANGLES, geometry->num_indices, GL_UNSIGNED_SHORT,
+		       geometry->indices);
+
+	glActiveTexture(GL_TEXTURE0);
+}
+
+static int edge_blend_identity(struct pipeline_stage *stage)
+{
+	struct edge_blend *blend = to_edge_blend(stage);
+	unsigned int i;
+
+	for (i = 0; i < 4; i++)
+		if (blend->vramps[i] > 0.0f)
+			return -1;
+
+	if (blend->vblack > 0.0f)
+		return -1;
+
+	return geometry_is_identity(blend->geometry) ? 0 : -1;
+}
+
+static void edge_blend_footprint(struct pipeline_stage *stage,
+				 struct region *region)
+{
+	struct edge_blend *blend = to_edge_blend(stage);
+
+	geometry_map_region(blend->geometry, region, region);
+}
+
+static void edge_blend_reach(struct pipeline_stage *stage,
+			     struct region *region)
+{
+	struct edge_blend *blend = to_edge_blend(stage);
+
+	geometry_unmap_region(blend->geometry, region, region);
+}
+
+struct pipeline_stage *edge_blend_new(struct gles *gles,
+				      struct geometry *geometry,
+				      const GLfloat ramps[4], GLfloat gamma,
+				      GLfloat black, bool mask)
+{
+	struct edge_blend *stage;
+	unsigned int i;
+
+	if (gamma <= 0.0f) {
+		fprintf(stderr, "gamma must be positive\n");
+		return NULL;
+	}
+
+	if (black < 0.0f || black > 1.0f) {
+		fprintf(stderr, "black level must be within [0, 1]\n");
+		return NULL;
+	}
+
+	for (i = 0; i < 4; i++) {
+		if (ramps[i] < 0.0f || ramps[i] > 0.5f) {
+			fprintf(stderr, "ramp widths must be within "
+				"[0, 0.5]\n");
+			return NULL;
+		}
+	}
+
+	stage = calloc(1, sizeof(*stage));
+	if (!stage)
+		return NULL;
+
+	stage->base.name = mask ? "edge blend operation (mask)" :
+				  "edge blend operation (ALU)";
+	stage->base.release = edge_blend_release;
+	stage->base.render = edge_blend_render;
+	stage->base.identity = edge_blend_identity;
+	stage->base.footprint = edge_blend_footprint;
+	stage->base.reach = edge_blend_reach;
+
+	stage->geometry = geometry;
+	stage->base.num_inputs = 1;
+
+	for (i = 0; i < 4; i++)
+		stage->vramps[i] = ramps[i];
+
+	stage->vgamma = gamma;
+	stage->vblack = black;
+	stage->use_mask = mask;
+
+	stage->vertex = glsl_shader_new(GL_VERTEX_SHADER, edge_blend_vs,
+					ARRAY_SIZE(edge_blend_vs));
+	if (!stage->vertex) {
+		fprintf(stderr, "failed to create vertex shader\n");
+		return NULL;
+	}
+
+	if (mask)
+		stage->fragment = glsl_shader_new(GL_FRAGMENT_SHADER,
+						  edge_blend_mask_fs,
+						  ARRAY_SIZE(edge_blend_mask_fs));
+	else
+		stage->fragment = glsl_shader_new(GL_FRAGMENT_SHADER,
+						  edge_blend_alu_fs,
+						  ARRAY_SIZE(edge_blend_alu_fs));
+
+	if (!stage->fragment) {
+		fprintf(stderr, "failed to create fragment shader\n");
+		return NULL;
+	}
+
+	stage->program = glsl_program_new(stage->vertex, stage->fragment);
+	if (!stage->program) {
+		fprintf(stderr, "failed to create GLSL program\n");
+		return NULL;
+	}
+
+	if (glsl_program_link(stage->program) < 0) {
+		fprintf(stderr, "failed to link GLSL program\n");
+		return NULL;
+	}
+
+	stage->pos = glGetAttribLocation(stage->program->id, "position");
+	stage->tex = glGetAttribLocation(stage->program->id, "tex");
+	stage->input = glGetUniformLocation(stage->program->id, "source");
+	stage->ramps = glGetUniformLocation(stage->program->id, "ramps");
+	stage->gamma = glGetUniformLocation(stage->program->id, "gamma");
+	stage->black = glGetUniformLocation(stage->program->id, "black");
+
+	return &stage->base;
+}
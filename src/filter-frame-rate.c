@@ -0,0 +1,308 @@
+/*
+ * Copyright (C) 2013 Avionic Design GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pipeline.h"
+#include "geometry.h"
+#include "gles.h"
+
+/*
+ * Converts the input from one frame rate to the rate at which the stage
+ * is rendered. Every output frame is rendered at a point in time between
+ * two source frames, given by the phase. The source frames are captured
+ * whenever a new one is due, each output frame then either blends the two
+ * most recent ones by the phase or shows the one nearest in time. This
+ * delays the output by one source frame.
+ */
+struct frame_rate {
+	struct pipeline_stage base;
+
+	struct geometry *geometry;
+
+	/* the two most recent source frames, head is the newer one */
+	struct framebuffer *frames[2];
+	unsigned int head;
+
+	struct glsl_shader *vertex, *fragment;
+	struct glsl_program *program;
+
+	/* attribute locations */
+	GLint pos, tex;
+
+	/* uniform locations */
+	GLint previous, current, phase;
+
+	unsigned int input_rate;
+	unsigned int output_rate;
+	bool blend;
+
+	/* number of output frames and of source frames captured */
+	unsigned long outputs;
+	unsigned long captures;
+
+	/* refreshes for which the nearest source frame has been shown */
+	unsigned long shown, nearest;
+	unsigned int run, run_min, run_max;
+};
+
+static const GLchar *frame_rate_vs[] = {
+	"attribute vec3 position;\n",
+	"attribute vec2 tex;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"   gl_Position = vec4(position, 1.0);\n",
+	"   vtex = tex;\n",
+	"}"
+};
+
+static const GLchar *frame_rate_fs[] = {
+	"precision mediump float;\n",
+	"uniform sampler2D previous;\n",
+	"uniform sampler2D current;\n",
+	"uniform float phase;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"    vec4 a = texture2D(previous, vtex);\n",
+	"    vec4 b = texture2D(current, vtex);\n",
+	"\n",
+	"    gl_FragColor = mix(a, b, phase);\n",
+	"}"
+};
+
+static inline struct frame_rate *to_frame_rate(struct pipeline_stage *stage)
+{
+	return (struct frame_rate *)stage;
+}
+
+static void frame_rate_capture(struct frame_rate *frc,
+			       struct framebuffer *source)
+{
+	struct pipeline *pipeline = frc->base.pipeline;
+	struct framebuffer *frame;
+
+	frc->head ^= 1;
+	frame = frc->frames[frc->head];
+
+	pipeline_bind_framebuffer(pipeline, source);
+
+	glBindTexture(GL_TEXTURE_2D, frame->texture->id);
+	glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, source->width,
+			    source->height);
+
+	frc->captures++;
+}
+
+/* tracks for how many refreshes in a row each source frame is shown */
+static void frame_rate_pace(struct frame_rate *frc, unsigned long nearest)
+{
+	if (frc->outputs > 0 && nearest == frc->nearest) {
+		frc->run++;
+		return;
+	}
+
+	/* the first and the current run may be truncated */
+	if (frc->shown > 1) {
+		if (frc->run_min == 0 || frc->run < frc->run_min)
+			frc->run_min = frc->run;
+
+		if (frc->run > frc->run_max)
+			frc->run_max = frc->run;
+	}
+
+	frc->nearest = nearest;
+	frc->shown++;
+	frc->run = 1;
+}
+
+static void frame_rate_release(struct pipeline_stage *stage)
+{
+	struct frame_rate *frc = to_frame_rate(stage);
+	unsigned int i;
+
+	if (frc->run_max > 0)
+		printf("Frame pacing: source frames shown for %u to %u "
+		       "refreshes (%.02f to %.02f ms, nominal %.02f ms)\n",
+		       frc->run_min, frc->run_max,
+		       frc->run_min * 1000.0f / frc->output_rate,
+		       frc->run_max * 1000.0f / frc->output_rate,
+		       1000.0f / frc->input_rate);
+
+	for (i = 0; i < 2; i++)
+		if (frc->frames[i])
+			framebuffer_free(frc->frames[i]);
+
+	glsl_program_free(frc->program);
+	free(frc);
+}
+
+static void frame_rate_render(struct pipeline_stage *stage)
+{
+	struct frame_rate *frc = to_frame_rate(stage);
+	struct framebuffer *source = stage->sources[0];
+	struct geometry *geometry = frc->geometry;
+	unsigned long long time;
+	unsigned long frame;
+	GLfloat phase;
+	unsigned int i;
+
+	if (!frc->frames[0]) {
+		/* copies of the source frames need its format */
+		for (i = 0; i < 2; i++) {
+			frc->frames[i] = framebuffer_new_format(source->width,
+								source->height,
+								source->format,
+								source->type);
+			if (!frc->frames[i]) {
+				fprintf(stderr, "failed to allocate frames\n");
+				return;
+			}
+		}
+
+		/* both frames start out as the first source frame */
+		frame_rate_capture(frc, source);
+		frame_rate_capture(frc, source);
+		frc->captures = 1;
+	}
+
+	/* position of this output frame in units of source frames */
+	time = (unsigned long long)frc->outputs * frc->input_rate;
+	frame = time / frc->output_rate;
+	phase = (GLfloat)(time % frc->output_rate) / frc->output_rate;
+
+	/* source frames that would be overwritten right away are skipped */
+	if (frame > frc->captures + 1)
+		frc->captures = frame - 1;
+
+	while (frc->captures <= frame)
+		frame_rate_capture(frc, source);
+
+	frame_rate_pace(frc, phase < 0.5f ? frame : frame + 1);
+
+	if (!frc->blend)
+		phase = phase < 0.5f ? 0.0f : 1.0f;
+
+	frc->outputs++;
+
+	pipeline_bind_framebuffer(stage->pipeline, stage->target);
+
+	glUseProgram(frc->program->id);
+
+	glVertexAttribPointer(frc->pos, 3, GL_FLOAT, GL_FALSE,
+			      3 * sizeof(GLfloat), geometry->vertices);
+	glEnableVertexAttribArray(frc->pos);
+
+	glVertexAttribPointer(frc->tex, 2, GL_FLOAT, GL_FALSE,
+			      2 * sizeof(GLfloat), geometry->uv);
+	glEnableVertexAttribArray(frc->tex);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, frc->frames[frc->head ^ 1]->texture->id);
+	glUniform1i(frc->previous, 0);
+
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, frc->frames[frc->head]->texture->id);
+	glUniform1i(frc->current, 1);
+
+	glUniform1f(frc->phase, phase);
+
+	glDrawElements(GL_TRIANGLES, geometry->num_indices, GL_UNSIGNED_SHORT,
+		       geometry->indices);
+
+	glActiveTexture(GL_TEXTURE0);
+}
+
+static int frame_rate_identity(struct pipeline_stage *stage)
+{
+	struct frame_rate *frc = to_frame_rate(stage);
+
+	if (frc->input_rate != frc->output_rate)
+		return -1;
+
+	return geometry_is_identity(frc->geometry) ? 0 : -1;
+}
+
+struct pipeline_stage *frame_rate_new(struct gles *gles,
+				      struct geometry *geometry,
+				      unsigned int input_rate,
+				      unsigned int output_rate, bool blend)
+{
+	struct frame_rate *stage;
+
+	if (input_rate < 1 || output_rate < 1) {
+		fprintf(stderr, "frame rates must be at least 1\n");
+		return NULL;
+	}
+
+	stage = calloc(1, sizeof(*stage));
+	if (!stage)
+		return NULL;
+
+	stage->base.name = blend ? "frame rate conversion (blend)" :
+				   "frame rate conversion (nearest)";
+	stage->base.release = frame_rate_release;
+	stage->base.render = frame_rate_render;
+	stage->base.identity = frame_rate_identity;
+	stage->base.num_inputs = 1;
+	stage->base.stateful = true;
+
+	stage->geometry = geometry;
+	stage->input_rate = input_rate;
+	stage->output_rate = output_rate;
+	stage->blend = blend;
+
+	stage->vertex = glsl_shader_new(GL_VERTEX_SHADER, frame_rate_vs,
+					ARRAY_SIZE(frame_rate_vs));
+	if (!stage->vertex) {
+		fprintf(stderr, "failed to create vertex shader\n");
+		return NULL;
+	}
+
+	stage->fragment = glsl_shader_new(GL_FRAGMENT_SHADER, frame_rate_fs,
+					  ARRAY_SIZE(frame_rate_fs));
+	if (!stage->fragment) {
+		fprintf(stderr, "failed to create fragment shader\n");
+		return NULL;
+	}
+
+	stage->program = glsl_program_new(stage->vertex, stage->fragment);
+	if (!stage->program) {
+		fprintf(stderr, "failed to create GLSL program\n");
+		return NULL;
+	}
+
+	if (glsl_program_link(stage->program) < 0) {
+		fprintf(stderr, "failed to link GLSL program\n");
+		return NULL;
+	}
+
+	stage->pos = glGetAttribLocation(stage->program->id, "position");
+	stage->tex = glGetAttribLocation(stage->program->id, "tex");
+	stage->previous = glGetUniformLocation(stage->program->id,
+					       "previous");
+	stage->current = glGetUniformLocation(stage->program->id, "current");
+	stage->phase = glGetUniformLocation(stage->program->id, "phase");
+
+	return &stage->base;
+}
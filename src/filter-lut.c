@@ -0,0 +1,498 @@
+/*
+ * Copyright (C) 2013 Avionic Design GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <ctype.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pipeline.h"
+#include "geometry.h"
+#include "gles.h"
+
+#define LUT_MIN_SIZE 2
+#define LUT_MAX_SIZE 65
+
+struct lut_table {
+	unsigned int size;
+	GLfloat *data;
+
+	GLfloat min[3];
+	GLfloat max[3];
+};
+
+struct lut {
+	struct pipeline_stage base;
+
+	struct geometry *geometry;
+
+	struct glsl_shader *vertex, *fragment;
+	struct glsl_program *program;
+
+	/*
+	 * GLES2 has no 3D textures. The slices of constant blue are laid
+	 * out as tiles of a 2D atlas, row by row.
+	 */
+	struct texture *atlas;
+	unsigned int size;
+	unsigned int columns;
+	unsigned int rows;
+
+	/* attribute locations */
+	GLint pos, tex;
+
+	/* uniform locations */
+	GLint input, lut_size, tiles, domain_min, domain_scale;
+
+	GLfloat vdomain_min[3];
+	GLfloat vdomain_scale[3];
+};
+
+static const GLchar *lut_vs[] = {
+	"attribute vec3 position;\n",
+	"attribute vec2 tex;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"   gl_Position = vec4(position, 1.0);\n",
+	"   vtex = tex;\n",
+	"}"
+};
+
+/*
+ * Red and green are interpolated by bilinear filtering within a tile,
+ * blue by mixing the two neighbouring tiles. Texel centers are half a
+ * texel inside the tile edges. The precision is prepended at runtime.
+ */
+static const GLchar *lut_fs[] = {
+	"uniform sampler2D source;\n",
+	"uniform sampler2D lut;\n",
+	"uniform float size;\n",
+	"uniform vec2 tiles;\n",
+	"uniform vec3 domain_min;\n",
+	"uniform vec3 domain_scale;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"vec3 slice(float b, vec2 inner)\n",
+	"{\n",
+	"    float row = floor((b + 0.5) / tiles.x);\n",
+	"    vec2 tile = vec2(b - row * tiles.x, row);\n",
+	"\n",
+	"    return texture2D(lut, (tile + inner) / tiles).rgb;\n",
+	"}\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"    vec3 color = texture2D(source, vtex).rgb;\n",
+	"    vec3 c = clamp((color - domain_min) * domain_scale, 0.0, 1.0);\n",
+	"    vec2 inner = (c.rg * (size - 1.0) + 0.5) / size;\n",
+	"    float b = c.b * (size - 1.0);\n",
+	"    float b0 = floor(b);\n",
+	"    float b1 = min(b0 + 1.0, size - 1.0);\n",
+	"\n",
+	"    gl_FragColor = vec4(mix(slice(b0, inner), slice(b1, inner),\n",
+	"                            b - b0), 1.0);\n",
+	"}"
+};
+
+static inline struct lut *to_lut(struct pipeline_stage *stage)
+{
+	return (struct lut *)stage;
+}
+
+static int lut_table_alloc(struct lut_table *table, unsigned int size)
+{
+	unsigned int i;
+
+	if (size < LUT_MIN_SIZE || size > LUT_MAX_SIZE) {
+		fprintf(stderr, "LUT size must be between %u and %u\n",
+			LUT_MIN_SIZE, LUT_MAX_SIZE);
+		return -1;
+	}
+
+	table->data = malloc(size * size * size * 3 * sizeof(GLfloat));
+	if (!table->data)
+		return -1;
+
+	table->size = size;
+
+	for (i = 0; i < 3; i++) {
+		table->min[i] = 0.0f;
+		table->max[i] = 1.0f;
+	}
+
+	return 0;
+}
+
+/*
+ * Parse a LUT in the .cube format: keywords and a list of output values,
+ * one triplet per line, with red changing fastest. Only 3D LUTs are
+ * supported.
+ */
+static int lut_table_load(struct lut_table *table, const char *filename)
+{
+	unsigned int count = 0, size = 0, line = 0, total = 0;
+	char buffer[256];
+	FILE *fp;
+
+	fp = fopen(filename, "r");
+	if (!fp) {
+		fprintf(stderr, "failed to open %s\n", filename);
+		return -1;
+	}
+
+	while (fgets(buffer, sizeof(buffer), fp)) {
+		GLfloat r, g, b;
+
+		line++;
+
+		if (buffer[0] == '#' || strspn(buffer, " \t\r\n") ==
+		    strlen(buffer))
+			continue;
+
+		if (sscanf(buffer, "LUT_3D_SIZE %u", &size) == 1) {
+			if (table->data) {
+				fprintf(stderr, "%s:%u: duplicate size\n",
+					filename, line);
+				goto error;
+			}
+
+			if (lut_table_alloc(table, size) < 0)
+				goto error;
+
+			total = size * size * size;
+			continue;
+		}
+
+		if (strncmp(buffer, "LUT_1D_SIZE", 11) == 0) {
+			fprintf(stderr, "%s: 1D LUTs are not supported\n",
+				filename);
+			goto error;
+		}
+
+		if (sscanf(buffer, "DOMAIN_MIN %f %f %f", &r, &g, &b) == 3) {
+			table->min[0] = r;
+			table->min[1] = g;
+			table->min[2] = b;
+			continue;
+		}
+
+		if (sscanf(buffer, "DOMAIN_MAX %f %f %f", &r, &g, &b) == 3) {
+			table->max[0] = r;
+			table->max[1] = g;
+			table->max[2] = b;
+			continue;
+		}
+
+		/* TITLE and application specific keywords */
+		if (isalpha((unsigned char)buffer[0]))
+			continue;
+
+		if (sscanf(buffer, "%f %f %f", &r, &g, &b) != 3) {
+			fprintf(stderr, "%s:%u: syntax error\n", filename,
+				line);
+			goto error;
+		}
+
+		if (!table->data || count >= total) {
+			fprintf(stderr, "%s:%u: unexpected entry\n", filename,
+				line);
+			goto error;
+		}
+
+		table->data[count * 3 + 0] = r;
+		table->data[count * 3 + 1] = g;
+		table->data[count * 3 + 2] = b;
+		count++;
+	}
+
+	if (!table->data || count != total) {
+		fprintf(stderr, "%s: expected %u entries, got %u\n", filename,
+			total, count);
+		goto error;
+	}
+
+	fclose(fp);
+	return 0;
+
+error:
+	fclose(fp);
+	return -1;
+}
+
+/*
+ * Without a file, grade with a LUT that no ALU shader would reasonably
+ * do: a contrast S-curve, a warm tint and a saturation boost.
+ */
+static int lut_table_generate(struct lut_table *table, unsigned int size)
+{
+	unsigned int r, g, b, i;
+
+	if (lut_table_alloc(table, size) < 0)
+		return -1;
+
+	for (b = 0; b < size; b++) {
+		for (g = 0; g < size; g++) {
+			for (r = 0; r < size; r++) {
+				GLfloat *out = table->data +
+					((b * size + g) * size + r) * 3;
+				GLfloat c[3], luma;
+
+				c[0] = (GLfloat)r / (size - 1);
+				c[1] = (GLfloat)g / (size - 1);
+				c[2] = (GLfloat)b / (size - 1);
+
+				for (i = 0; i < 3; i++)
+					c[i] = 0.5f * c[i] + 0.5f * c[i] *
+					       c[i] * (3.0f - 2.0f * c[i]);
+
+				c[0] *= 1.05f;
+				c[2] *= 0.92f;
+
+				luma = 0.299f * c[0] + 0.587f * c[1] +
+				       0.114f * c[2];
+
+				for (i = 0; i < 3; i++) {
+					GLfloat v = luma + 1.2f * (c[i] - luma);
+
+					out[i] = v < 0.0f ? 0.0f :
+						 v > 1.0f ? 1.0f : v;
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int lut_upload(struct lut *lut, const struct lut_table *table)
+{
+	unsigned int size = table->size, width, height, r, g, b, i;
+	uint8_t *atlas;
+
+	lut->size = size;
+	lut->columns = ceilf(sqrtf(size));
+	lut->rows = (size + lut->columns - 1) / lut->columns;
+
+	width = lut->columns * size;
+	height = lut->rows * size;
+
+	atlas = calloc(width * height, 3);
+	if (!atlas)
+		return -1;
+
+	for (b = 0; b < size; b++) {
+		unsigned int x0 = (b % lut->columns) * size;
+		unsigned int y0 = (b / lut->columns) * size;
+
+		for (g = 0; g < size; g++) {
+			for (r = 0; r < size; r++) {
+				const GLfloat *in = table->data +
+					((b * size + g) * size + r) * 3;
+				uint8_t *out = atlas +
+					((y0 + g) * width + x0 + r) * 3;
+
+				for (i = 0; i < 3; i++) {
+					GLfloat v = in[i];
+
+					v = v < 0.0f ? 0.0f :
+					    v > 1.0f ? 1.0f : v;
+					out[i] = v * 255.0f + 0.5f;
+				}
+			}
+		}
+	}
+
+	lut->atlas = texture_new(GL_LINEAR);
+	if (!lut->atlas) {
+		free(atlas);
+		return -1;
+	}
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB,
+		     GL_UNSIGNED_BYTE, atlas);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	for (i = 0; i < 3; i++) {
+		GLfloat range = table->max[i] - table->min[i];
+
+		lut->vdomain_min[i] = table->min[i];
+		lut->vdomain_scale[i] = range > 0.0f ? 1.0f / range : 1.0f;
+	}
+
+	free(atlas);
+	return 0;
+}
+
+static void lut_release(struct pipeline_stage *stage)
+{
+	struct lut *lut = to_lut(stage);
+
+	if (lut->atlas)
+		texture_free(lut->atlas);
+
+	glsl_program_free(lut->program);
+	free(lut);
+}
+
+static void lut_render(struct pipeline_stage *stage)
+{
+	struct lut *lut = to_lut(stage);
+	struct geometry *geometry = lut->geometry;
+
+	glUseProgram(lut->program->id);
+
+	glVertexAttribPointer(lut->pos, 3, GL_FLOAT, GL_FALSE,
+			      3 * sizeof(GLfloat), geometry->vertices);
+	glEnableVertexAttribArray(lut->pos);
+
+	glVertexAttribPointer(lut->tex, 2, GL_FLOAT, GL_FALSE,
+			      2 * sizeof(GLfloat), geometry->uv);
+	glEnableVertexAttribArray(lut->tex);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, stage->sources[0]->texture->id);
+	glUniform1i(lut->input, 0);
+
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, lut->atlas->id);
+	glUniform1i(lut->atlas->loc, 1);
+
+	glUniform1f(lut->lut_size, lut->size);
+	glUniform2f(lut->tiles, lut->columns, lut->rows);
+	glUniform3fv(lut->domain_min, 1, lut->vdomain_min);
+	glUniform3fv(lut->domain_scale, 1, lut->vdomain_scale);
+
+	glDrawElements(GL_TRIANGLES, geometry->num_indices, GL_UNSIGNED_SHORT,
+		       geometry->indices);
+
+	glActiveTexture(GL_TEXTURE0);
+}
+
+static void lut_footprint(struct pipeline_stage *stage,
+			  struct region *region)
+{
+	struct lut *lut = to_lut(stage);
+
+	geometry_map_region(lut->geometry, region, region);
+}
+
+static void lut_reach(struct pipeline_stage *stage,
+		      struct region *region)
+{
+	struct lut *lut = to_lut(stage);
+
+	geometry_unmap_region(lut->geometry, region, region);
+}
+
+struct pipeline_stage *lut_new(struct gles *gles, struct geometry *geometry,
+			       const char *filename, unsigned int size,
+			       bool highp)
+{
+	const GLchar *fs[ARRAY_SIZE(lut_fs) + 1];
+	struct lut_table table;
+	struct lut *stage;
+	unsigned int i;
+	int err;
+
+	memset(&table, 0, sizeof(table));
+
+	if (filename)
+		err = lut_table_load(&table, filename);
+	else
+		err = lut_table_generate(&table, size);
+
+	if (err < 0) {
+		free(table.data);
+		return NULL;
+	}
+
+	stage = calloc(1, sizeof(*stage));
+	if (!stage) {
+		free(table.data);
+		return NULL;
+	}
+
+	stage->base.name = "3D LUT operation";
+	stage->base.release = lut_release;
+	stage->base.render = lut_render;
+	stage->base.footprint = lut_footprint;
+	stage->base.reach = lut_reach;
+
+	stage->geometry = geometry;
+	stage->base.num_inputs = 1;
+
+	err = lut_upload(stage, &table);
+	free(table.data);
+
+	if (err < 0) {
+		fprintf(stderr, "failed to upload LUT\n");
+		return NULL;
+	}
+
+	printf("LUT: %u^3 entries in %ux%u atlas\n", stage->size,
+	       stage->columns * stage->size, stage->rows * stage->size);
+
+	fs[0] = highp ? GLSL_PRECISION_HIGH : "precision mediump float;\n";
+
+	for (i = 0; i < ARRAY_SIZE(lut_fs); i++)
+		fs[i + 1] = lut_fs[i];
+
+	stage->vertex = glsl_shader_new(GL_VERTEX_SHADER, lut_vs,
+					ARRAY_SIZE(lut_vs));
+	if (!stage->vertex) {
+		fprintf(stderr, "failed to create vertex shader\n");
+		return NULL;
+	}
+
+	stage->fragment = glsl_shader_new(GL_FRAGMENT_SHADER, fs,
+					  ARRAY_SIZE(fs));
+	if (!stage->fragment) {
+		fprintf(stderr, "failed to create fragment shader\n");
+		return NULL;
+	}
+
+	stage->program = glsl_program_new(stage->vertex, stage->fragment);
+	if (!stage->program) {
+		fprintf(stderr, "failed to create GLSL program\n");
+		return NULL;
+	}
+
+	if (glsl_program_link(stage->program) < 0) {
+		fprintf(stderr, "failed to link GLSL program\n");
+		return NULL;
+	}
+
+	stage->pos = glGetAttribLocation(stage->program->id, "position");
+	stage->tex = glGetAttribLocation(stage->program->id, "tex");
+	stage->input = glGetUniformLocation(stage->program->id, "source");
+	stage->atlas->loc = glGetUniformLocation(stage->program->id, "lut");
+	stage->lut_size = glGetUniformLocation(stage->program->id, "size");
+	stage->tiles = glGetUniformLocation(stage->program->id, "tiles");
+	stage->domain_min = glGetUniformLocation(stage->program->id,
+						 "domain_min");
+	stage->domain_scale = glGetUniformLocation(stage->program->id,
+						   "domain_scale");
+
+	return &stage->base;
+}
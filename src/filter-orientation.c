@@ -0,0 +1,416 @@
+/*
+ * Copyright (C) 2013 Avionic Design GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pipeline.h"
+#include "geometry.h"
+#include "gles.h"
+
+struct orientation {
+	struct pipeline_stage base;
+
+	struct geometry *geometry;
+
+	/* stage geometry or output blocks with reoriented coordinates */
+	struct geometry *oriented;
+
+	struct glsl_shader *vertex, *fragment;
+	struct glsl_program *program;
+
+	/* attribute locations */
+	GLint pos, tex;
+
+	/* uniform locations */
+	GLint input;
+
+	enum orientation_mode mode;
+	bool tiled;
+	unsigned int block;
+};
+
+static const GLchar *orientation_vs[] = {
+	"attribute vec3 position;\n",
+	"attribute vec2 tex;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"   gl_Position = vec4(position, 1.0);\n",
+	"   vtex = tex;\n",
+	"}"
+};
+
+static const GLchar *orientation_fs[] = {
+	"precision mediump float;\n",
+	"uniform sampler2D source;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"    gl_FragColor = texture2D(source, vtex);\n",
+	"}"
+};
+
+static inline struct orientation *to_orientation(struct pipeline_stage *stage)
+{
+	return (struct orientation *)stage;
+}
+
+static bool orientation_swaps_axes(enum orientation_mode mode)
+{
+	return mode == ORIENTATION_ROTATE_90 ||
+	       mode == ORIENTATION_ROTATE_270 ||
+	       mode == ORIENTATION_TRANSPOSE;
+}
+
+/* maps a position in the output to the source position it shows */
+static void orientation_map(enum orientation_mode mode, GLfloat u, GLfloat v,
+			    GLfloat *s, GLfloat *t)
+{
+	switch (mode) {
+	case ORIENTATION_ROTATE_90:
+		*s = 1.0f - v;
+		*t = u;
+		break;
+
+	case ORIENTATION_ROTATE_180:
+		*s = 1.0f - u;
+		*t = 1.0f - v;
+		break;
+
+	case ORIENTATION_ROTATE_270:
+		*s = v;
+		*t = 1.0f - u;
+		break;
+
+	case ORIENTATION_FLIP_HORIZONTAL:
+		*s = 1.0f - u;
+		*t = v;
+		break;
+
+	case ORIENTATION_FLIP_VERTICAL:
+		*s = u;
+		*t = 1.0f - v;
+		break;
+
+	case ORIENTATION_TRANSPOSE:
+		*s = v;
+		*t = u;
+		break;
+	}
+}
+
+static struct geometry *orientation_geometry_alloc(unsigned int num_vertices,
+						   unsigned int num_indices)
+{
+	struct geometry *geometry;
+
+	geometry = calloc(1, sizeof(*geometry));
+	if (!geometry)
+		return NULL;
+
+	geometry->num_vertices = num_vertices;
+	geometry->num_indices = num_indices;
+
+	geometry->vertices = calloc(num_vertices * 3, sizeof(GLfloat));
+	geometry->uv = calloc(num_vertices * 2, sizeof(GLfloat));
+	geometry->indices = calloc(num_indices, sizeof(GLushort));
+
+	if (!geometry->vertices || !geometry->uv || !geometry->indices) {
+		geometry_free(geometry);
+		return NULL;
+	}
+
+	return geometry;
+}
+
+/* a copy of the stage geometry with reoriented texture coordinates */
+static struct geometry *orientation_uv_new(struct orientation *orientation)
+{
+	struct geometry *geometry = orientation->geometry, *oriented;
+	unsigned int i;
+
+	oriented = orientation_geometry_alloc(geometry->num_vertices,
+					      geometry->num_indices);
+	if (!oriented)
+		return NULL;
+
+	oriented->num_cols = geometry->num_cols;
+	oriented->num_rows = geometry->num_rows;
+
+	memcpy(oriented->vertices, geometry->vertices,
+	       geometry->num_vertices * 3 * sizeof(GLfloat));
+	memcpy(oriented->indices, geometry->indices,
+	       geometry->num_indices * sizeof(GLushort));
+
+	for (i = 0; i < geometry->num_vertices; i++)
+		orientation_map(orientation->mode, geometry->uv[i * 2 + 0],
+				geometry->uv[i * 2 + 1],
+				&oriented->uv[i * 2 + 0],
+				&oriented->uv[i * 2 + 1]);
+
+	return oriented;
+}
+
+/*
+ * Split the output into blocks drawn one after the other, each of which
+ * reads a compact block of the source rather than whole columns of it.
+ */
+static struct geometry *orientation_tiles_new(struct orientation *orientation)
+{
+	unsigned int width = orientation->base.width;
+	unsigned int height = orientation->base.height;
+	unsigned int block = orientation->block;
+	unsigned int cols = (width + block - 1) / block;
+	unsigned int rows = (height + block - 1) / block;
+	struct geometry *tiles;
+	unsigned int x, y, i;
+
+	if (cols * rows * 4 > 65536) {
+		fprintf(stderr, "too many blocks, increase the block size\n");
+		return NULL;
+	}
+
+	tiles = orientation_geometry_alloc(cols * rows * 4, cols * rows * 6);
+	if (!tiles)
+		return NULL;
+
+	tiles->num_cols = cols;
+	tiles->num_rows = rows;
+
+	for (y = 0; y < rows; y++) {
+		for (x = 0; x < cols; x++) {
+			unsigned int quad = y * cols + x;
+			GLfloat u[2], v[2];
+
+			u[0] = (GLfloat)(x * block) / width;
+			v[0] = (GLfloat)(y * block) / height;
+			u[1] = x < cols - 1 ? (GLfloat)((x + 1) * block) /
+					      width : 1.0f;
+			v[1] = y < rows - 1 ? (GLfloat)((y + 1) * block) /
+					      height : 1.0f;
+
+			for (i = 0; i < 4; i++) {
+				GLfloat *pos = tiles->vertices +
+					       (quad * 4 + i) * 3;
+				GLfloat *uv = tiles->uv + (quad * 4 + i) * 2;
+
+				pos[0] = u[i & 1] * 2.0f - 1.0f;
+				pos[1] = v[i >> 1] * 2.0f - 1.0f;
+				pos[2] = 0.0f;
+
+				orientation_map(orientation->mode, u[i & 1],
+						v[i >> 1], &uv[0], &uv[1]);
+			}
+
+			tiles->indices[quad * 6 + 0] = quad * 4 + 0;
+			tiles->indices[quad * 6 + 1] = quad * 4 + 1;
+			tiles->indices[quad * 6 + 2] = quad * 4 + 2;
+			tiles->indices[quad * 6 + 3] = quad * 4 + 1;
+			tiles->indices[quad * 6 + 4] = quad * 4 + 3;
+			tiles->indices[quad * 6 + 5] = quad * 4 + 2;
+		}
+	}
+
+	return tiles;
+}
+
+static void orientation_release(struct pipeline_stage *stage)
+{
+	struct orientation *orientation = to_orientation(stage);
+
+	geometry_free(orientation->oriented);
+	glsl_program_free(orientation->program);
+	free(orientation);
+}
+
+static void orientation_render(struct pipeline_stage *stage)
+{
+	struct orientation *orientation = to_orientation(stage);
+	struct geometry *geometry;
+
+	/* the blocks depend on the output size */
+	if (!orientation->oriented) {
+		orientation->oriented = orientation_tiles_new(orientation);
+		if (!orientation->oriented) {
+			fprintf(stderr, "failed to create blocks\n");
+			return;
+		}
+	}
+
+	geometry = orientation->oriented;
+
+	glUseProgram(orientation->program->id);
+
+	glVertexAttribPointer(orientation->pos, 3, GL_FLOAT, GL_FALSE,
+			      3 * sizeof(GLfloat), geometry->vertices);
+	glEnableVertexAttribArray(orientation->pos);
+
+	glVertexAttribPointer(orientation->tex, 2, GL_FLOAT, GL_FALSE,
+			      2 * sizeof(GLfloat), geometry->uv);
+	glEnableVertexAttribArray(orientation->tex);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, stage->sources[0]->texture->id);
+	glUniform1i(orientation->input, 0);
+
+	glDrawElements(GL_TRIANGLES, geometry->num_indices, GL_UNSIGNED_SHORT,
+		       geometry->indices);
+}
+
+static void orientation_footprint(struct pipeline_stage *stage,
+				  struct region *region)
+{
+	struct orientation *orientation = to_orientation(stage);
+	enum orientation_mode mode = orientation->mode;
+	GLfloat x0, y0, x1, y1;
+
+	/* the reoriented geometry maps the source to the output directly */
+	if (!orientation->tiled) {
+		geometry_map_region(orientation->oriented, region, region);
+		return;
+	}
+
+	/* all modes are involutions except for the quarter rotations */
+	if (mode == ORIENTATION_ROTATE_90)
+		mode = ORIENTATION_ROTATE_270;
+	else if (mode == ORIENTATION_ROTATE_270)
+		mode = ORIENTATION_ROTATE_90;
+
+	orientation_map(mode, region->x0, region->y0, &x0, &y0);
+	orientation_map(mode, region->x1, region->y1, &x1, &y1);
+
+	region->x0 = x0 < x1 ? x0 : x1;
+	region->x1 = x0 < x1 ? x1 : x0;
+	region->y0 = y0 < y1 ? y0 : y1;
+	region->y1 = y0 < y1 ? y1 : y0;
+}
+
+static void orientation_reach(struct pipeline_stage *stage,
+			      struct region *region)
+{
+	struct orientation *orientation = to_orientation(stage);
+	GLfloat x0, y0, x1, y1;
+
+	if (!orientation->tiled) {
+		geometry_unmap_region(orientation->oriented, region, region);
+		return;
+	}
+
+	orientation_map(orientation->mode, region->x0, region->y0, &x0, &y0);
+	orientation_map(orientation->mode, region->x1, region->y1, &x1, &y1);
+
+	region->x0 = x0 < x1 ? x0 : x1;
+	region->x1 = x0 < x1 ? x1 : x0;
+	region->y0 = y0 < y1 ? y0 : y1;
+	region->y1 = y0 < y1 ? y1 : y0;
+}
+
+static void orientation_output_size(struct pipeline_stage *stage,
+				    unsigned int *width, unsigned int *height)
+{
+	struct orientation *orientation = to_orientation(stage);
+	unsigned int tmp;
+
+	if (orientation_swaps_axes(orientation->mode)) {
+		tmp = *width;
+		*width = *height;
+		*height = tmp;
+	}
+}
+
+struct pipeline_stage *orientation_new(struct gles *gles,
+				       struct geometry *geometry,
+				       enum orientation_mode mode, bool tiled,
+				       unsigned int block)
+{
+	struct orientation *stage;
+
+	if (tiled && block < 1) {
+		fprintf(stderr, "block size must be at least 1\n");
+		return NULL;
+	}
+
+	/* the blocks are laid out on the output, which can't be warped */
+	if (tiled && !geometry_is_identity(geometry)) {
+		fprintf(stderr, "tiled orientation needs an untransformed "
+			"geometry\n");
+		return NULL;
+	}
+
+	stage = calloc(1, sizeof(*stage));
+	if (!stage)
+		return NULL;
+
+	stage->base.name = tiled ? "blocked orientation operation" :
+				   "orientation operation";
+	stage->base.release = orientation_release;
+	stage->base.render = orientation_render;
+	stage->base.footprint = orientation_footprint;
+	stage->base.reach = orientation_reach;
+	stage->base.output_size = orientation_output_size;
+
+	stage->geometry = geometry;
+	stage->base.num_inputs = 1;
+
+	stage->mode = mode;
+	stage->tiled = tiled;
+	stage->block = block;
+
+	/* the blocked pass renders an undistorted output */
+	if (!tiled) {
+		stage->oriented = orientation_uv_new(stage);
+		if (!stage->oriented)
+			return NULL;
+	}
+
+	stage->vertex = glsl_shader_new(GL_VERTEX_SHADER, orientation_vs,
+					ARRAY_SIZE(orientation_vs));
+	if (!stage->vertex) {
+		fprintf(stderr, "failed to create vertex shader\n");
+		return NULL;
+	}
+
+	stage->fragment = glsl_shader_new(GL_FRAGMENT_SHADER, orientation_fs,
+					  ARRAY_SIZE(orientation_fs));
+	if (!stage->fragment) {
+		fprintf(stderr, "failed to create fragment shader\n");
+		return NULL;
+	}
+
+	stage->program = glsl_program_new(stage->vertex, stage->fragment);
+	if (!stage->program) {
+		fprintf(stderr, "failed to create GLSL program\n");
+		return NULL;
+	}
+
+	if (glsl_program_link(stage->program) < 0) {
+		fprintf(stderr, "failed to link GLSL program\n");
+		return NULL;
+	}
+
+	stage->pos = glGetAttribLocation(stage->program->id, "position");
+	stage->tex = glGetAttribLocation(stage->program->id, "tex");
+	stage->input = glGetUniformLocation(stage->program->id, "source");
+
+	return &stage->base;
+}
@@ -0,0 +1,489 @@
+/*
+ * Copyright (C) 2013 Avionic Design GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pipeline.h"
+#include "geometry.h"
+#include "gles.h"
+
+#define OVERLAY_MAX_LAYERS 16
+#define OVERLAY_TILE_SIZE 32
+
+struct overlay_layer {
+	struct texture *texture;
+	unsigned int width;
+	unsigned int height;
+
+	/* quads covering the layer, or only its non-transparent tiles */
+	GLfloat *vertices;
+	GLfloat *uv;
+	GLushort *indices;
+	unsigned int num_indices;
+};
+
+struct overlay {
+	struct pipeline_stage base;
+
+	struct geometry *geometry;
+
+	struct glsl_shader *vertex, *fragment;
+	struct glsl_program *program;
+
+	/* attribute locations */
+	GLint pos, tex;
+
+	/* uniform locations */
+	GLint input;
+
+	struct overlay_layer layers[OVERLAY_MAX_LAYERS];
+	unsigned int num_layers;
+
+	/* layer size relative to the output and fraction of opaque tiles */
+	GLfloat size;
+	GLfloat coverage;
+
+	bool premultiplied;
+	bool skip;
+	bool prepared;
+	bool failed;
+};
+
+static const GLchar *overlay_vs[] = {
+	"attribute vec3 position;\n",
+	"attribute vec2 tex;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"   gl_Position = vec4(position, 1.0);\n",
+	"   vtex = tex;\n",
+	"}"
+};
+
+static const GLchar *overlay_fs[] = {
+	"precision mediump float;\n",
+	"uniform sampler2D source;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"    gl_FragColor = texture2D(source, vtex);\n",
+	"}"
+};
+
+static inline struct overlay *to_overlay(struct pipeline_stage *stage)
+{
+	return (struct overlay *)stage;
+}
+
+/*
+ * Fill a layer with tiles that are either completely transparent or
+ * covered by a translucent gradient in the color of the layer. The
+ * opaque tiles are chosen pseudo-randomly, but reproducibly, so that
+ * their fraction matches the requested coverage.
+ */
+static void overlay_layer_fill(struct overlay *overlay, unsigned int index,
+			       uint8_t *data, bool *opaque,
+			       unsigned int columns, unsigned int rows)
+{
+	static const uint8_t colors[][3] = {
+		{ 255, 255, 255 }, { 32, 96, 224 }, { 255, 192, 0 },
+		{ 0, 192, 64 }, { 224, 32, 32 },
+	};
+	struct overlay_layer *layer = &overlay->layers[index];
+	const uint8_t *color = colors[index % ARRAY_SIZE(colors)];
+	unsigned int x, y, i, total = columns * rows, count;
+	uint32_t seed = 0x12345678 + index;
+
+	count = overlay->coverage * total + 0.5f;
+
+	for (i = 0; i < total; i++)
+		opaque[i] = i < count;
+
+	/* Fisher-Yates shuffle with a fixed LCG */
+	for (i = total; i > 1; i--) {
+		unsigned int j;
+		bool tmp;
+
+		seed = seed * 1664525 + 1013904223;
+		j = (seed >> 8) % i;
+
+		tmp = opaque[i - 1];
+		opaque[i - 1] = opaque[j];
+		opaque[j] = tmp;
+	}
+
+	for (y = 0; y < layer->height; y++) {
+		for (x = 0; x < layer->width; x++) {
+			unsigned int tile = (y / OVERLAY_TILE_SIZE) * columns +
+					    x / OVERLAY_TILE_SIZE;
+			uint8_t *pixel = data + (y * layer->width + x) * 4;
+			unsigned int alpha = 0;
+
+			if (opaque[tile])
+				alpha = 160 + 80 * x / layer->width;
+
+			for (i = 0; i < 3; i++) {
+				unsigned int value = color[i];
+
+				if (overlay->premultiplied)
+					value = value * alpha / 255;
+
+				pixel[i] = value;
+			}
+
+			pixel[3] = alpha;
+		}
+	}
+}
+
+static void overlay_layer_add_quad(struct overlay_layer *layer,
+				   unsigned int quad, GLfloat x0, GLfloat y0,
+				   GLfloat size, const GLfloat u[2],
+				   const GLfloat v[2])
+{
+	GLfloat *pos = layer->vertices + quad * 4 * 3;
+	GLfloat *uv = layer->uv + quad * 4 * 2;
+	GLushort *indices = layer->indices + quad * 6;
+	unsigned int i;
+
+	for (i = 0; i < 4; i++) {
+		GLfloat s = u[i & 1], t = v[i >> 1];
+
+		uv[i * 2 + 0] = s;
+		uv[i * 2 + 1] = t;
+
+		pos[i * 3 + 0] = (x0 + s * size) * 2.0f - 1.0f;
+		pos[i * 3 + 1] = (y0 + t * size) * 2.0f - 1.0f;
+		pos[i * 3 + 2] = 0.0f;
+	}
+
+	indices[0] = quad * 4 + 0;
+	indices[1] = quad * 4 + 1;
+	indices[2] = quad * 4 + 2;
+	indices[3] = quad * 4 + 2;
+	indices[4] = quad * 4 + 1;
+	indices[5] = quad * 4 + 3;
+}
+
+/*
+ * Build the quads of a layer: a single one, or one per non-transparent
+ * tile if transparent tiles are skipped. Layers are placed along the
+ * diagonal of the output so that they partially overlap each other.
+ */
+static int overlay_layer_build(struct overlay *overlay, unsigned int index,
+			       const bool *opaque, unsigned int columns,
+			       unsigned int rows)
+{
+	struct overlay_layer *layer = &overlay->layers[index];
+	unsigned int num_quads = 1, quad = 0, x, y;
+	GLfloat x0 = 0.0f, y0 = 0.0f, u[2], v[2];
+
+	if (overlay->num_layers > 1) {
+		x0 = (1.0f - overlay->size) * index / (overlay->num_layers - 1);
+		y0 = x0;
+	}
+
+	if (overlay->skip)
+		for (num_quads = 0, x = 0; x < columns * rows; x++)
+			if (opaque[x])
+				num_quads++;
+
+	if (num_quads == 0)
+		return 0;
+
+	layer->vertices = calloc(num_quads * 4 * 3, sizeof(GLfloat));
+	layer->uv = calloc(num_quads * 4 * 2, sizeof(GLfloat));
+	layer->indices = calloc(num_quads * 6, sizeof(GLushort));
+
+	if (!layer->vertices || !layer->uv || !layer->indices)
+		return -1;
+
+	layer->num_indices = num_quads * 6;
+
+	if (!overlay->skip) {
+		u[0] = v[0] = 0.0f;
+		u[1] = v[1] = 1.0f;
+
+		overlay_layer_add_quad(layer, 0, x0, y0, overlay->size, u, v);
+		return 0;
+	}
+
+	for (y = 0; y < rows; y++) {
+		for (x = 0; x < columns; x++) {
+			if (!opaque[y * columns + x])
+				continue;
+
+			u[0] = (GLfloat)(x * OVERLAY_TILE_SIZE) / layer->width;
+			v[0] = (GLfloat)(y * OVERLAY_TILE_SIZE) / layer->height;
+			u[1] = (GLfloat)((x + 1) * OVERLAY_TILE_SIZE) /
+			       layer->width;
+			v[1] = (GLfloat)((y + 1) * OVERLAY_TILE_SIZE) /
+			       layer->height;
+
+			if (u[1] > 1.0f)
+				u[1] = 1.0f;
+
+			if (v[1] > 1.0f)
+				v[1] = 1.0f;
+
+			overlay_layer_add_quad(layer, quad++, x0, y0,
+					       overlay->size, u, v);
+		}
+	}
+
+	return 0;
+}
+
+/* layers are sized relative to the output, which is known only now */
+static int overlay_prepare(struct overlay *overlay)
+{
+	unsigned long long drawn = 0, area = 0;
+	unsigned int i;
+
+	for (i = 0; i < overlay->num_layers; i++) {
+		struct overlay_layer *layer = &overlay->layers[i];
+		unsigned int columns, rows;
+		uint8_t *data;
+		bool *opaque;
+		int err;
+
+		layer->width = overlay->base.width * overlay->size;
+		layer->height = overlay->base.height * overlay->size;
+
+		if (layer->width < 1)
+			layer->width = 1;
+
+		if (layer->height < 1)
+			layer->height = 1;
+
+		columns = (layer->width + OVERLAY_TILE_SIZE - 1) /
+			  OVERLAY_TILE_SIZE;
+		rows = (layer->height + OVERLAY_TILE_SIZE - 1) /
+		       OVERLAY_TILE_SIZE;
+
+		/* four vertices per tile must be addressable */
+		if (overlay->skip && columns * rows * 4 > 65536) {
+			fprintf(stderr, "too many tiles in overlay layer\n");
+			return -1;
+		}
+
+		data = malloc(layer->width * layer->height * 4);
+		opaque = calloc(columns * rows, sizeof(*opaque));
+
+		if (!data || !opaque) {
+			free(opaque);
+			free(data);
+			return -1;
+		}
+
+		overlay_layer_fill(overlay, i, data, opaque, columns, rows);
+		err = overlay_layer_build(overlay, i, opaque, columns, rows);
+
+		layer->texture = texture_new(GL_LINEAR);
+		if (layer->texture)
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, layer->width,
+				     layer->height, 0, GL_RGBA,
+				     GL_UNSIGNED_BYTE, data);
+
+		free(opaque);
+		free(data);
+
+		if (err < 0 || !layer->texture)
+			return -1;
+
+		area += layer->width * layer->height;
+		drawn += layer->num_indices / 6 * OVERLAY_TILE_SIZE *
+			 OVERLAY_TILE_SIZE;
+	}
+
+	if (overlay->skip && area > 0)
+		printf("Overlay: blending %.02f%% of the layer area\n",
+		       drawn > area ? 100.0f : 100.0f * drawn / area);
+
+	return 0;
+}
+
+static void overlay_release(struct pipeline_stage *stage)
+{
+	struct overlay *overlay = to_overlay(stage);
+	unsigned int i;
+
+	for (i = 0; i < overlay->num_layers; i++) {
+		struct overlay_layer *layer = &overlay->layers[i];
+
+		if (layer->texture)
+			texture_free(layer->texture);
+
+		free(layer->indices);
+		free(layer->uv);
+		free(layer->vertices);
+	}
+
+	glsl_program_free(overlay->program);
+	free(overlay);
+}
+
+static void overlay_draw(struct overlay *overlay, GLuint texture,
+			 const GLfloat *vertices, const GLfloat *uv,
+			 const GLushort *indices, GLsizei num_indices)
+{
+	glVertexAttribPointer(overlay->pos, 3, GL_FLOAT, GL_FALSE,
+			      3 * sizeof(GLfloat), vertices);
+	glEnableVertexAttribArray(overlay->pos);
+
+	glVertexAttribPointer(overlay->tex, 2, GL_FLOAT, GL_FALSE,
+			      2 * sizeof(GLfloat), uv);
+	glEnableVertexAttribArray(overlay->tex);
+
+	glBindTexture(GL_TEXTURE_2D, texture);
+
+	glDrawElements(GL_TRIANGLES, num_indices, GL_UNSIGNED_SHORT, indices);
+}
+
+static void overlay_render(struct pipeline_stage *stage)
+{
+	struct overlay *overlay = to_overlay(stage);
+	struct geometry *geometry = overlay->geometry;
+	unsigned int i;
+
+	if (overlay->failed)
+		return;
+
+	if (!overlay->prepared) {
+		if (overlay_prepare(overlay) < 0) {
+			fprintf(stderr, "failed to create overlay layers\n");
+			overlay->failed = true;
+			return;
+		}
+
+		overlay->prepared = true;
+	}
+
+	glUseProgram(overlay->program->id);
+
+	glActiveTexture(GL_TEXTURE0);
+	glUniform1i(overlay->input, 0);
+
+	/* the video underneath */
+	overlay_draw(overlay, stage->sources[0]->texture->id,
+		     geometry->vertices, geometry->uv, geometry->indices,
+		     geometry->num_indices);
+
+	glEnable(GL_BLEND);
+
+	if (overlay->premultiplied)
+		glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+	else
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+	for (i = 0; i < overlay->num_layers; i++) {
+		struct overlay_layer *layer = &overlay->layers[i];
+
+		overlay_draw(overlay, layer->texture->id, layer->vertices,
+			     layer->uv, layer->indices, layer->num_indices);
+	}
+
+	glDisable(GL_BLEND);
+}
+
+static int overlay_identity(struct pipeline_stage *stage)
+{
+	struct overlay *overlay = to_overlay(stage);
+
+	/* fully transparent layers leave the input as it is */
+	if (overlay->num_layers > 0 && overlay->coverage > 0.0f)
+		return -1;
+
+	return geometry_is_identity(overlay->geometry) ? 0 : -1;
+}
+
+struct pipeline_stage *overlay_new(struct gles *gles,
+				   struct geometry *geometry,
+				   unsigned int layers, GLfloat size,
+				   GLfloat coverage, bool premultiplied,
+				   bool skip)
+{
+	struct overlay *stage;
+
+	if (layers > OVERLAY_MAX_LAYERS) {
+		fprintf(stderr, "at most %u overlay layers supported\n",
+			OVERLAY_MAX_LAYERS);
+		return NULL;
+	}
+
+	if (size <= 0.0f || size > 1.0f || coverage < 0.0f ||
+	    coverage > 1.0f) {
+		fprintf(stderr, "layer size and coverage must be within "
+			"[0, 1]\n");
+		return NULL;
+	}
+
+	stage = calloc(1, sizeof(*stage));
+	if (!stage)
+		return NULL;
+
+	stage->base.name = "overlay operation";
+	stage->base.release = overlay_release;
+	stage->base.render = overlay_render;
+	stage->base.identity = overlay_identity;
+
+	stage->geometry = geometry;
+	stage->base.num_inputs = 1;
+
+	stage->num_layers = layers;
+	stage->size = size;
+	stage->coverage = coverage;
+	stage->premultiplied = premultiplied;
+	stage->skip = skip;
+
+	stage->vertex = glsl_shader_new(GL_VERTEX_SHADER, overlay_vs,
+					ARRAY_SIZE(overlay_vs));
+	if (!stage->vertex) {
+		fprintf(stderr, "failed to create vertex shader\n");
+		return NULL;
+	}
+
+	stage->fragment = glsl_shader_new(GL_FRAGMENT_SHADER, overlay_fs,
+					  ARRAY_SIZE(overlay_fs));
+	if (!stage->fragment) {
+		fprintf(stderr, "failed to create fragment shader\n");
+		return NULL;
+	}
+
+	stage->program = glsl_program_new(stage->vertex, stage->fragment);
+	if (!stage->program) {
+		fprintf(stderr, "failed to create GLSL program\n");
+		return NULL;
+	}
+
+	if (glsl_program_link(stage->program) < 0) {
+		fprintf(stderr, "failed to link GLSL program\n");
+		return NULL;
+	}
+
+	stage->pos = glGetAttribLocation(stage->program->id, "position");
+	stage->tex = glGetAttribLocation(stage->program->id, "tex");
+	stage->input = glGetUniformLocation(stage->program->id, "source");
+
+	return &stage->base;
+}
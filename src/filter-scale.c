@@ -0,0 +1,413 @@
+/*
+ * Copyright (C) 2013 Avionic Design GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pipeline.h"
+#include "geometry.h"
+#include "gles.h"
+
+#define SCALE_MAX_LEVELS 8
+#define SCALE_MAX_RADIUS 16
+
+struct scale_pass {
+	struct glsl_shader *vertex, *fragment;
+	struct glsl_program *program;
+
+	/* attribute locations */
+	GLint pos, tex;
+
+	/* uniform locations */
+	GLint input, size, direction, stretch;
+
+	/* kernel stretch factor when minifying */
+	GLfloat vstretch;
+};
+
+struct scale {
+	struct pipeline_stage base;
+
+	struct geometry *geometry;
+	struct geometry *plane;
+
+	/* requested output size, zero keeps the size of the input */
+	unsigned int width;
+	unsigned int height;
+
+	enum scale_filter filter;
+	bool mipmap;
+
+	/*
+	 * Successively halved copies of the input, down to less than twice
+	 * the output size. GLES2 can't generate mipmaps for textures whose
+	 * size isn't a power of two, so the levels are rendered explicitly.
+	 */
+	struct framebuffer *levels[SCALE_MAX_LEVELS];
+	unsigned int num_levels;
+
+	/* result of the horizontal pass of the separable kernels */
+	struct framebuffer *intermediate;
+
+	struct scale_pass bilinear;
+	struct scale_pass horizontal;
+	struct scale_pass vertical;
+
+	bool prepared;
+};
+
+static const GLchar *scale_vs[] = {
+	"attribute vec3 position;\n",
+	"attribute vec2 tex;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"   gl_Position = vec4(position, 1.0);\n",
+	"   vtex = tex;\n",
+	"}"
+};
+
+static const GLchar *scale_bilinear_fs[] = {
+	"precision mediump float;\n",
+	"uniform sampler2D source;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"    gl_FragColor = texture2D(source, vtex);\n",
+	"}"
+};
+
+/*
+ * One dimension of a separable kernel, preceded by the definitions of
+ * the kernel and its radius in texels. When minifying the kernel is
+ * stretched to cover all input texels contributing to an output texel.
+ */
+static const GLchar *scale_separable_fs[] = {
+	GLSL_PRECISION_HIGH,
+	"uniform sampler2D source;\n",
+	"uniform vec2 size;\n",
+	"uniform vec2 direction;\n",
+	"uniform float stretch;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"float weight(float x)\n",
+	"{\n",
+	"    x = abs(x);\n",
+	"#ifdef LANCZOS\n",
+	"    if (x < 0.0001)\n",
+	"        return 1.0;\n",
+	"    if (x >= 3.0)\n",
+	"        return 0.0;\n",
+	"    x *= 3.14159265;\n",
+	"    return 3.0 * sin(x) * sin(x / 3.0) / (x * x);\n",
+	"#else\n",
+	"    if (x < 1.0)\n",
+	"        return (1.5 * x - 2.5) * x * x + 1.0;\n",
+	"    if (x < 2.0)\n",
+	"        return ((-0.5 * x + 2.5) * x - 4.0) * x + 2.0;\n",
+	"    return 0.0;\n",
+	"#endif\n",
+	"}\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"    float coord = dot(vtex * size, direction) - 0.5;\n",
+	"    float base = floor(coord);\n",
+	"    vec4 sum = vec4(0.0);\n",
+	"    float total = 0.0;\n",
+	"\n",
+	"    for (int i = 1 - RADIUS; i <= RADIUS; i++) {\n",
+	"        float t = base + float(i);\n",
+	"        float w = weight((t - coord) / stretch);\n",
+	"        vec2 pos = mix(vtex, vec2(t + 0.5) / size, direction);\n",
+	"\n",
+	"        sum += texture2D(source, pos) * w;\n",
+	"        total += w;\n",
+	"    }\n",
+	"\n",
+	"    gl_FragColor = sum / total;\n",
+	"}"
+};
+
+static inline struct scale *to_scale(struct pipeline_stage *stage)
+{
+	return (struct scale *)stage;
+}
+
+static int scale_pass_init(struct scale *scale, struct scale_pass *pass,
+			   unsigned int input, unsigned int output)
+{
+	const GLchar *fs[ARRAY_SIZE(scale_separable_fs) + 2];
+	const GLchar **lines = scale_bilinear_fs;
+	GLint count = ARRAY_SIZE(scale_bilinear_fs);
+	char radius[32];
+	unsigned int i;
+
+	if (pass != &scale->bilinear) {
+		GLfloat support = 2.0f;
+
+		if (scale->filter == SCALE_LANCZOS)
+			support = 3.0f;
+
+		pass->vstretch = (GLfloat)input / output;
+		if (pass->vstretch < 1.0f)
+			pass->vstretch = 1.0f;
+
+		i = ceilf(support * pass->vstretch);
+		if (i > SCALE_MAX_RADIUS)
+			i = SCALE_MAX_RADIUS;
+
+		snprintf(radius, sizeof(radius), "#define RADIUS %u\n", i);
+
+		fs[0] = scale->filter == SCALE_LANCZOS ?
+			"#define LANCZOS\n" : "\n";
+		fs[1] = radius;
+
+		for (i = 0; i < ARRAY_SIZE(scale_separable_fs); i++)
+			fs[i + 2] = scale_separable_fs[i];
+
+		lines = fs;
+		count = ARRAY_SIZE(fs);
+	}
+
+	pass->vertex = glsl_shader_new(GL_VERTEX_SHADER, scale_vs,
+				       ARRAY_SIZE(scale_vs));
+	if (!pass->vertex) {
+		fprintf(stderr, "failed to create vertex shader\n");
+		return -1;
+	}
+
+	pass->fragment = glsl_shader_new(GL_FRAGMENT_SHADER, lines, count);
+	if (!pass->fragment) {
+		fprintf(stderr, "failed to create fragment shader\n");
+		return -1;
+	}
+
+	pass->program = glsl_program_new(pass->vertex, pass->fragment);
+	if (!pass->program) {
+		fprintf(stderr, "failed to create GLSL program\n");
+		return -1;
+	}
+
+	if (glsl_program_link(pass->program) < 0) {
+		fprintf(stderr, "failed to link GLSL program\n");
+		return -1;
+	}
+
+	pass->pos = glGetAttribLocation(pass->program->id, "position");
+	pass->tex = glGetAttribLocation(pass->program->id, "tex");
+	pass->input = glGetUniformLocation(pass->program->id, "source");
+	pass->size = glGetUniformLocation(pass->program->id, "size");
+	pass->direction = glGetUniformLocation(pass->program->id,
+					       "direction");
+	pass->stretch = glGetUniformLocation(pass->program->id, "stretch");
+
+	return 0;
+}
+
+static void scale_pass_render(struct scale_pass *pass,
+			      struct geometry *geometry,
+			      struct framebuffer *source,
+			      GLfloat dx, GLfloat dy)
+{
+	glUseProgram(pass->program->id);
+
+	glVertexAttribPointer(pass->pos, 3, GL_FLOAT, GL_FALSE,
+			      3 * sizeof(GLfloat), geometry->vertices);
+	glEnableVertexAttribArray(pass->pos);
+
+	glVertexAttribPointer(pass->tex, 2, GL_FLOAT, GL_FALSE,
+			      2 * sizeof(GLfloat), geometry->uv);
+	glEnableVertexAttribArray(pass->tex);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, source->texture->id);
+	glUniform1i(pass->input, 0);
+
+	glUniform2f(pass->size, source->width, source->height);
+	glUniform2f(pass->direction, dx, dy);
+	glUniform1f(pass->stretch, pass->vstretch);
+
+	glDrawElements(GL_TRIANGLES, geometry->num_indices, GL_UNSIGNED_SHORT,
+		       geometry->indices);
+}
+
+/*
+ * The programs depend on the ratio of input and output sizes, which are
+ * only known once the pipeline has been prepared.
+ */
+static int scale_prepare(struct scale *scale, struct framebuffer *source)
+{
+	unsigned int width = source->width, height = source->height;
+	unsigned int out_width = scale->base.width;
+	unsigned int out_height = scale->base.height;
+
+	while (scale->mipmap && scale->num_levels < SCALE_MAX_LEVELS &&
+	       (width >= 2 * out_width || height >= 2 * out_height)) {
+		struct framebuffer *level;
+
+		if (width >= 2 * out_width)
+			width = (width + 1) / 2;
+
+		if (height >= 2 * out_height)
+			height = (height + 1) / 2;
+
+		level = pipeline_stage_framebuffer_new(&scale->base, width,
+						       height);
+		if (!level)
+			return -1;
+
+		scale->levels[scale->num_levels++] = level;
+	}
+
+	if (scale->filter == SCALE_BILINEAR)
+		return 0;
+
+	scale->intermediate = pipeline_stage_framebuffer_new(&scale->base,
+							     out_width,
+							     height);
+	if (!scale->intermediate)
+		return -1;
+
+	if (scale_pass_init(scale, &scale->horizontal, width, out_width) < 0)
+		return -1;
+
+	if (scale_pass_init(scale, &scale->vertical, height, out_height) < 0)
+		return -1;
+
+	return 0;
+}
+
+static void scale_release(struct pipeline_stage *stage)
+{
+	struct scale *scale = to_scale(stage);
+	unsigned int i;
+
+	for (i = 0; i < scale->num_levels; i++)
+		framebuffer_free(scale->levels[i]);
+
+	if (scale->intermediate)
+		framebuffer_free(scale->intermediate);
+
+	glsl_program_free(scale->vertical.program);
+	glsl_program_free(scale->horizontal.program);
+	glsl_program_free(scale->bilinear.program);
+	geometry_free(scale->plane);
+	free(scale);
+}
+
+static void scale_render(struct pipeline_stage *stage)
+{
+	struct scale *scale = to_scale(stage);
+	struct framebuffer *source = stage->sources[0];
+	struct pipeline *pipeline = stage->pipeline;
+	unsigned int i;
+
+	if (!scale->prepared) {
+		if (scale_prepare(scale, source) < 0) {
+			fprintf(stderr, "failed to prepare scaler\n");
+			return;
+		}
+
+		scale->prepared = true;
+	}
+
+	/* each level is a 2x2 box filtered copy of the previous one */
+	for (i = 0; i < scale->num_levels; i++) {
+		pipeline_bind_framebuffer(pipeline, scale->levels[i]);
+		scale_pass_render(&scale->bilinear, scale->plane, source,
+				  0.0f, 0.0f);
+		source = scale->levels[i];
+	}
+
+	if (scale->filter == SCALE_BILINEAR) {
+		pipeline_bind_framebuffer(pipeline, stage->target);
+		scale_pass_render(&scale->bilinear, scale->geometry, source,
+				  0.0f, 0.0f);
+		return;
+	}
+
+	pipeline_bind_framebuffer(pipeline, scale->intermediate);
+	scale_pass_render(&scale->horizontal, scale->plane, source,
+			  1.0f, 0.0f);
+
+	pipeline_bind_framebuffer(pipeline, stage->target);
+	scale_pass_render(&scale->vertical, scale->geometry,
+			  scale->intermediate, 0.0f, 1.0f);
+}
+
+static void scale_output_size(struct pipeline_stage *stage,
+			      unsigned int *width, unsigned int *height)
+{
+	struct scale *scale = to_scale(stage);
+
+	if (scale->width)
+		*width = scale->width;
+
+	if (scale->height)
+		*height = scale->height;
+}
+
+struct pipeline_stage *scale_new(struct gles *gles, struct geometry *geometry,
+				 unsigned int width, unsigned int height,
+				 enum scale_filter filter, bool mipmap)
+{
+	struct scale *stage;
+
+	stage = calloc(1, sizeof(*stage));
+	if (!stage)
+		return NULL;
+
+	switch (filter) {
+	case SCALE_BILINEAR:
+		stage->base.name = "bilinear scale operation";
+		break;
+
+	case SCALE_BICUBIC:
+		stage->base.name = "separable bicubic scale operation";
+		break;
+
+	case SCALE_LANCZOS:
+		stage->base.name = "separable Lanczos-3 scale operation";
+		break;
+	}
+
+	stage->base.release = scale_release;
+	stage->base.render = scale_render;
+	stage->base.output_size = scale_output_size;
+	stage->base.num_inputs = 1;
+
+	stage->geometry = geometry;
+	stage->width = width;
+	stage->height = height;
+	stage->filter = filter;
+	stage->mipmap = mipmap;
+
+	stage->plane = grid_new(0);
+	if (!stage->plane)
+		return NULL;
+
+	if (scale_pass_init(stage, &stage->bilinear, 1, 1) < 0)
+		return NULL;
+
+	return &stage->base;
+}
@@ -28,7 +28,6 @@ struct checkerboard {
 	struct pipeline_stage base;
 
 	struct geometry *geometry;
-	struct framebuffer *target;
 
 	struct glsl_shader *vertex, *fragment;
 	struct glsl_program *program;
@@ -98,7 +97,6 @@ static void checkerboard_render(struct pipeline_stage *stage)
 	struct geometry *geometry = board->geometry;
 	static const GLfloat frequency = 16.0f;
 
-	glBindFramebuffer(GL_FRAMEBUFFER, board->target->id);
 	glUseProgram(board->program->id);
 
 	glVertexAttribPointer(board->pos, 3, GL_FLOAT, GL_FALSE,
@@ -118,8 +116,7 @@ static void checkerboard_render(struct pipeline_stage *stage)
 }
 
 struct pipeline_stage *checkerboard_new(struct gles *gles,
-					struct geometry *geometry,
-					struct framebuffer *target)
+					struct geometry *geometry)
 {
 	struct checkerboard *stage;
 
@@ -132,7 +129,6 @@ struct pipeline_stage *checkerboard_new(struct gles *gles,
 	stage->base.render = checkerboard_render;
 
 	stage->geometry = geometry;
-	stage->target = target;
 
 	stage->vertex = glsl_shader_new(GL_VERTEX_SHADER, checkerboard_vs,
 					ARRAY_SIZE(checkerboard_vs));
@@ -25,7 +25,6 @@
 
 struct clear {
 	struct pipeline_stage base;
-	struct framebuffer *target;
 	GLfloat red, green, blue;
 	bool black;
 };
@@ -46,9 +45,6 @@ static void clear_render(struct pipeline_stage *stage)
 {
 	struct clear *clear = to_clear(stage);
 
-	glBindFramebuffer(GL_FRAMEBUFFER, clear->target->id);
-	glViewport(0, 0, clear->target->width, clear->target->height);
-
 	if (clear->black)
 		glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 	else
@@ -58,8 +54,8 @@ static void clear_render(struct pipeline_stage *stage)
 	clear->black = !clear->black;
 }
 
-struct pipeline_stage *clear_new(struct gles *gles, struct framebuffer *target,
-				 GLfloat red, GLfloat green, GLfloat blue)
+struct pipeline_stage *clear_new(struct gles *gles, GLfloat red,
+				 GLfloat green, GLfloat blue)
 {
 	struct clear *stage;
 
@@ -70,8 +66,8 @@ struct pipeline_stage *clear_new(struct gles *gles, struct framebuffer *target,
 	stage->base.name = "clear generator";
 	stage->base.release = clear_release;
 	stage->base.render = clear_render;
+	stage->base.stateful = true;
 
-	stage->target = target;
 	stage->red = red;
 	stage->green = green;
 	stage->blue = blue;
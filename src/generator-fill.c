@@ -28,7 +28,6 @@ struct simple_fill {
 	struct pipeline_stage base;
 
 	struct geometry *geometry;
-	struct framebuffer *target;
 
 	struct glsl_shader *vertex, *fragment;
 	struct glsl_program *program;
@@ -83,7 +82,6 @@ static void simple_fill_render(struct pipeline_stage *stage)
 	struct simple_fill *fill = to_simple_fill(stage);
 	struct geometry *geometry = fill->geometry;
 
-	glBindFramebuffer(GL_FRAMEBUFFER, fill->target->id);
 	glUseProgram(fill->program->id);
 
 	glVertexAttribPointer(fill->pos, 3, GL_FLOAT, GL_FALSE,
@@ -102,7 +100,6 @@ static void simple_fill_render(struct pipeline_stage *stage)
 
 struct pipeline_stage *simple_fill_new(struct gles *gles,
 				       struct geometry *geometry,
-				       struct framebuffer *target,
 				       GLfloat red, GLfloat green,
 				       GLfloat blue)
 {
@@ -117,7 +114,6 @@ struct pipeline_stage *simple_fill_new(struct gles *gles,
 	stage->base.render = simple_fill_render;
 
 	stage->geometry = geometry;
-	stage->target = target;
 	stage->red = red;
 	stage->green = green;
 	stage->blue = blue;
@@ -0,0 +1,476 @@
+/*
+ * Copyright (C) 2013 Avionic Design GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pipeline.h"
+#include "geometry.h"
+#include "gles.h"
+
+/* size of the noise texture, a power of two so that it can repeat */
+#define PATTERN_NOISE_SIZE 256
+
+#define PATTERN_PI 3.14159265f
+
+/*
+ * Test patterns that change completely from one frame to the next, like
+ * live video does, so that neither texture caches nor framebuffer
+ * compression can make the pipeline look cheaper than it is. All random
+ * choices are taken from a generator initialized by the seed, so that a
+ * given seed always produces the same sequence of frames.
+ */
+struct pattern {
+	struct pipeline_stage base;
+
+	struct geometry *geometry;
+	enum pattern_type type;
+
+	struct glsl_shader *vertex, *fragment;
+	struct glsl_program *program;
+
+	/* attribute locations */
+	GLint pos, tex;
+
+	/* uniform locations */
+	GLint size, offset, params, dx, dy;
+
+	struct texture *noise;
+
+	/* xorshift generator state */
+	uint32_t state;
+	unsigned long frame;
+
+	/* chosen by the seed: rates of change and pattern parameters */
+	GLfloat speed[4];
+	GLfloat vparams[4];
+	GLfloat vdx[3], vdy[3];
+
+	/* changed for every frame */
+	GLfloat voffset[4];
+};
+
+static const GLchar *pattern_vs[] = {
+	"attribute vec3 position;\n",
+	"attribute vec2 tex;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"   gl_Position = vec4(position, 1.0);\n",
+	"   vtex = tex;\n",
+	"}"
+};
+
+/*
+ * One noise texel per pixel. The two lookups use different offsets and
+ * the second one is transposed, so that the repeating texture doesn't
+ * show as a regular pattern. The scaled coordinates exceed the range in
+ * which mediump resolves single texels.
+ */
+static const GLchar *pattern_noise_fs[] = {
+	GLSL_PRECISION_HIGH,
+	"uniform sampler2D noise;\n",
+	"uniform vec2 size;\n",
+	"uniform vec4 offset;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"    vec2 position = vtex * size;\n",
+	"    vec3 a = texture2D(noise, position + offset.xy).rgb;\n",
+	"    vec3 b = texture2D(noise, position.yx + offset.zw).rgb;\n",
+	"\n",
+	"    gl_FragColor = vec4(fract(a + b), 1.0);\n",
+	"}"
+};
+
+/*
+ * Circular zone plate, whose frequency rises from the center to the
+ * Nyquist limit at the left and right edges. The center wanders around
+ * and the phase advances from frame to frame. The phase needs more than
+ * mediump precision to stay accurate away from the center.
+ */
+static const GLchar *pattern_zone_plate_fs[] = {
+	GLSL_PRECISION_HIGH,
+	"uniform vec2 size;\n",
+	"uniform vec4 offset;\n",
+	"uniform vec4 params;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"    vec2 position = (vtex - offset.xy) * size;\n",
+	"    float phase = dot(position, position) * params.x - offset.z;\n",
+	"\n",
+	"    gl_FragColor = vec4(0.5 + 0.5 * cos(phase + params.yzw), 1.0);\n",
+	"}"
+};
+
+/* every channel is a triangle wave along its own direction */
+static const GLchar *pattern_gradient_fs[] = {
+	"precision mediump float;\n",
+	"uniform vec3 dx, dy;\n",
+	"uniform vec4 offset;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"    vec3 ramp = fract(vtex.x * dx + vtex.y * dy + offset.xyz);\n",
+	"\n",
+	"    gl_FragColor = vec4(abs(ramp * 2.0 - 1.0), 1.0);\n",
+	"}"
+};
+
+/*
+ * Vertical bars and a disc moving horizontally, with the even and odd
+ * lines showing them at the times of two successive fields, as cameras
+ * capture interlaced video. Moving edges are combed, static parts are
+ * not.
+ */
+static const GLchar *pattern_motion_fs[] = {
+	"precision mediump float;\n",
+	"uniform vec4 offset;\n",
+	"uniform vec4 params;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"    float field = mod(floor(gl_FragCoord.y), 2.0);\n",
+	"    vec2 position = mix(offset.xy, offset.zw, field);\n",
+	"    float bars = step(0.5, fract((vtex.x + position.x) * 8.0));\n",
+	"    vec2 disc = vtex - vec2(position.y, 0.5);\n",
+	"    vec3 color = vec3(bars * 0.75);\n",
+	"\n",
+	"    if (vtex.y > 0.75)\n",
+	"        color = vec3(vtex.x);\n",
+	"\n",
+	"    if (length(disc) < 0.15)\n",
+	"        color = params.rgb;\n",
+	"\n",
+	"    gl_FragColor = vec4(color, 1.0);\n",
+	"}"
+};
+
+static inline struct pattern *to_pattern(struct pipeline_stage *stage)
+{
+	return (struct pattern *)stage;
+}
+
+static uint32_t pattern_random(struct pattern *pattern)
+{
+	uint32_t x = pattern->state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	return pattern->state = x;
+}
+
+/* uniformly distributed in [0, 1) */
+static GLfloat pattern_uniform(struct pattern *pattern)
+{
+	return (pattern_random(pattern) >> 8) / 16777216.0f;
+}
+
+/* uniformly distributed in [min, max), with a random sign */
+static GLfloat pattern_rate(struct pattern *pattern, GLfloat min,
+			    GLfloat max)
+{
+	GLfloat rate = min + (max - min) * pattern_uniform(pattern);
+
+	return (pattern_random(pattern) & 1) ? -rate : rate;
+}
+
+static struct texture *pattern_noise_new(struct pattern *pattern)
+{
+	unsigned int size = PATTERN_NOISE_SIZE * PATTERN_NOISE_SIZE * 3;
+	struct texture *noise;
+	uint8_t *data;
+	unsigned int i;
+
+	data = malloc(size);
+	if (!data)
+		return NULL;
+
+	for (i = 0; i < size; i++)
+		data[i] = pattern_random(pattern) >> 24;
+
+	noise = texture_new(GL_NEAREST);
+	if (!noise) {
+		free(data);
+		return NULL;
+	}
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, PATTERN_NOISE_SIZE,
+		     PATTERN_NOISE_SIZE, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	free(data);
+	return noise;
+}
+
+/* choose the parameters that stay the same for all frames */
+static void pattern_setup(struct pattern *pattern)
+{
+	unsigned int i;
+
+	switch (pattern->type) {
+	case PATTERN_NOISE:
+		break;
+
+	case PATTERN_ZONE_PLATE:
+		/* wander rates of the center and phase advance per frame */
+		pattern->speed[0] = pattern_rate(pattern, 0.005f, 0.02f);
+		pattern->speed[1] = pattern_rate(pattern, 0.005f, 0.02f);
+		pattern->speed[2] = pattern_rate(pattern, 0.1f, 0.5f);
+
+		for (i = 1; i < 4; i++)
+			pattern->vparams[i] = 2.0f * PATTERN_PI *
+					      pattern_uniform(pattern);
+		break;
+
+	case PATTERN_GRADIENT:
+		for (i = 0; i < 3; i++) {
+			pattern->vdx[i] = pattern_rate(pattern, 0.5f, 4.0f);
+			pattern->vdy[i] = pattern_rate(pattern, 0.5f, 4.0f);
+			pattern->speed[i] = pattern_rate(pattern, 0.002f,
+							 0.02f);
+		}
+		break;
+
+	case PATTERN_MOTION:
+		/* movement of the bars and the disc per field */
+		pattern->speed[0] = pattern_rate(pattern, 0.002f, 0.01f);
+		pattern->speed[1] = pattern_rate(pattern, 0.002f, 0.01f);
+
+		for (i = 0; i < 3; i++)
+			pattern->vparams[i] = pattern_uniform(pattern);
+		break;
+	}
+}
+
+/* choose the parameters of the next frame */
+static void pattern_advance(struct pattern *pattern)
+{
+	GLfloat time = pattern->frame;
+	unsigned int i;
+
+	switch (pattern->type) {
+	case PATTERN_NOISE:
+		/* whole texels, so that pixels keep sampling texel centers */
+		for (i = 0; i < 4; i++)
+			pattern->voffset[i] = (pattern_random(pattern) >> 24) /
+					      (GLfloat)PATTERN_NOISE_SIZE;
+		break;
+
+	case PATTERN_ZONE_PLATE:
+		pattern->voffset[0] = 0.5f + 0.25f *
+				      sinf(time * pattern->speed[0]);
+		pattern->voffset[1] = 0.5f + 0.25f *
+				      cosf(time * pattern->speed[1]);
+		pattern->voffset[2] = fmodf(time * pattern->speed[2],
+					    2.0f * PATTERN_PI);
+		break;
+
+	case PATTERN_GRADIENT:
+		for (i = 0; i < 3; i++)
+			pattern->voffset[i] = fmodf(time * pattern->speed[i],
+						    1.0f);
+		break;
+
+	case PATTERN_MOTION:
+		/* positions at the times of both fields */
+		for (i = 0; i < 2; i++) {
+			GLfloat field = time * 2.0f + i;
+
+			pattern->voffset[i * 2 + 0] =
+				fmodf(field * pattern->speed[0], 1.0f);
+			pattern->voffset[i * 2 + 1] = 0.5f + 0.4f *
+				sinf(field * pattern->speed[1] * 2.0f *
+				     PATTERN_PI);
+		}
+		break;
+	}
+
+	pattern->frame++;
+}
+
+static void pattern_release(struct pipeline_stage *stage)
+{
+	struct pattern *pattern = to_pattern(stage);
+
+	if (pattern->noise)
+		texture_free(pattern->noise);
+
+	glsl_program_free(pattern->program);
+	free(pattern);
+}
+
+static void pattern_render(struct pipeline_stage *stage)
+{
+	struct pattern *pattern = to_pattern(stage);
+	struct geometry *geometry = pattern->geometry;
+	GLfloat size[2] = { stage->width, stage->height };
+
+	pattern_advance(pattern);
+
+	glUseProgram(pattern->program->id);
+
+	glVertexAttribPointer(pattern->pos, 3, GL_FLOAT, GL_FALSE,
+			      3 * sizeof(GLfloat), geometry->vertices);
+	glEnableVertexAttribArray(pattern->pos);
+
+	glVertexAttribPointer(pattern->tex, 2, GL_FLOAT, GL_FALSE,
+			      2 * sizeof(GLfloat), geometry->uv);
+	glEnableVertexAttribArray(pattern->tex);
+
+	switch (pattern->type) {
+	case PATTERN_NOISE:
+		size[0] /= PATTERN_NOISE_SIZE;
+		size[1] /= PATTERN_NOISE_SIZE;
+
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, pattern->noise->id);
+		glUniform1i(pattern->noise->loc, 0);
+		break;
+
+	case PATTERN_ZONE_PLATE:
+		/* reaches the Nyquist limit at half the width */
+		pattern->vparams[0] = PATTERN_PI / stage->width;
+		break;
+
+	case PATTERN_GRADIENT:
+		glUniform3fv(pattern->dx, 1, pattern->vdx);
+		glUniform3fv(pattern->dy, 1, pattern->vdy);
+		break;
+
+	case PATTERN_MOTION:
+		break;
+	}
+
+	glUniform2fv(pattern->size, 1, size);
+	glUniform4fv(pattern->offset, 1, pattern->voffset);
+	glUniform4fv(pattern->params, 1, pattern->vparams);
+
+	glDrawElements(GL_TRIANGLES, geometry->num_indices, GL_UNSIGNED_SHORT,
+		       geometry->indices);
+}
+
+struct pipeline_stage *pattern_new(struct gles *gles,
+				   struct geometry *geometry,
+				   enum pattern_type type, unsigned int seed)
+{
+	const GLchar **fs = pattern_noise_fs;
+	GLint count = ARRAY_SIZE(pattern_noise_fs);
+	struct pattern *stage;
+
+	stage = calloc(1, sizeof(*stage));
+	if (!stage)
+		return NULL;
+
+	stage->base.release = pattern_release;
+	stage->base.render = pattern_render;
+	stage->base.stateful = true;
+
+	switch (type) {
+	case PATTERN_NOISE:
+		stage->base.name = "noise pattern generator";
+		break;
+
+	case PATTERN_ZONE_PLATE:
+		stage->base.name = "zone plate pattern generator";
+		fs = pattern_zone_plate_fs;
+		count = ARRAY_SIZE(pattern_zone_plate_fs);
+		break;
+
+	case PATTERN_GRADIENT:
+		stage->base.name = "gradient pattern generator";
+		fs = pattern_gradient_fs;
+		count = ARRAY_SIZE(pattern_gradient_fs);
+		break;
+
+	case PATTERN_MOTION:
+		stage->base.name = "interlaced motion pattern generator";
+		fs = pattern_motion_fs;
+		count = ARRAY_SIZE(pattern_motion_fs);
+		break;
+	}
+
+	stage->geometry = geometry;
+	stage->type = type;
+
+	/* xorshift never leaves a zero state */
+	stage->state = seed * 2654435761u + 0x9e3779b9u;
+	if (!stage->state)
+		stage->state = 1;
+
+	pattern_setup(stage);
+
+	if (type == PATTERN_NOISE) {
+		stage->noise = pattern_noise_new(stage);
+		if (!stage->noise)
+			return NULL;
+	}
+
+	stage->vertex = glsl_shader_new(GL_VERTEX_SHADER, pattern_vs,
+					ARRAY_SIZE(pattern_vs));
+	if (!stage->vertex) {
+		fprintf(stderr, "failed to create vertex shader\n");
+		return NULL;
+	}
+
+	stage->fragment = glsl_shader_new(GL_FRAGMENT_SHADER, fs, count);
+	if (!stage->fragment) {
+		fprintf(stderr, "failed to create fragment shader\n");
+		return NULL;
+	}
+
+	stage->program = glsl_program_new(stage->vertex, stage->fragment);
+	if (!stage->program) {
+		fprintf(stderr, "failed to create GLSL program\n");
+		return NULL;
+	}
+
+	if (glsl_program_link(stage->program) < 0) {
+		fprintf(stderr, "failed to link GLSL program\n");
+		return NULL;
+	}
+
+	stage->pos = glGetAttribLocation(stage->program->id, "position");
+	stage->tex = glGetAttribLocation(stage->program->id, "tex");
+	stage->size = glGetUniformLocation(stage->program->id, "size");
+	stage->offset = glGetUniformLocation(stage->program->id, "offset");
+	stage->params = glGetUniformLocation(stage->program->id, "params");
+	stage->dx = glGetUniformLocation(stage->program->id, "dx");
+	stage->dy = glGetUniformLocation(stage->program->id, "dy");
+
+	if (stage->noise)
+		stage->noise->loc = glGetUniformLocation(stage->program->id,
+							 "noise");
+
+	return &stage->base;
+}
@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2013 Avionic Design GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pipeline.h"
+#include "geometry.h"
+#include "gles.h"
+
+struct ticker {
+	struct pipeline_stage base;
+
+	struct geometry *geometry;
+
+	struct glsl_shader *vertex, *fragment;
+	struct glsl_program *program;
+
+	/* attribute locations */
+	GLint pos, tex;
+
+	/* uniform locations */
+	GLint height, offset;
+
+	GLfloat vheight, voffset;
+};
+
+static const GLchar *ticker_vs[] = {
+	"attribute vec3 position;\n",
+	"attribute vec2 tex;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"   gl_Position = vec4(position, 1.0);\n",
+	"   vtex = tex;\n",
+	"}"
+};
+
+static const GLchar *ticker_fs[] = {
+	"precision mediump float;\n",
+	"uniform float height;\n",
+	"uniform float offset;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"    vec3 color = vec3(0.0, 0.0, 0.5);\n",
+	"\n",
+	"    if (vtex.y < height)\n",
+	"        color = vec3(step(0.5, fract((vtex.x + offset) * 32.0)));\n",
+	"\n",
+	"    gl_FragColor = vec4(color, 1.0);\n",
+	"}"
+};
+
+static inline struct ticker *to_ticker(struct pipeline_stage *stage)
+{
+	return (struct ticker *)stage;
+}
+
+static void ticker_release(struct pipeline_stage *stage)
+{
+	struct ticker *ticker = to_ticker(stage);
+
+	glsl_program_free(ticker->program);
+	free(ticker);
+}
+
+static void ticker_render(struct pipeline_stage *stage)
+{
+	struct ticker *ticker = to_ticker(stage);
+	struct geometry *geometry = ticker->geometry;
+
+	glUseProgram(ticker->program->id);
+
+	glVertexAttribPointer(ticker->pos, 3, GL_FLOAT, GL_FALSE,
+			      3 * sizeof(GLfloat), geometry->vertices);
+	glEnableVertexAttribArray(ticker->pos);
+
+	glVertexAttribPointer(ticker->tex, 2, GL_FLOAT, GL_FALSE,
+			      2 * sizeof(GLfloat), geometry->uv);
+	glEnableVertexAttribArray(ticker->tex);
+
+	glUniform1f(ticker->height, ticker->vheight);
+	glUniform1f(ticker->offset, ticker->voffset);
+
+	glDrawElements(GL_TRIANGLES, geometry->num_indices, GL_UNSIGNED_SHORT,
+		       geometry->indices);
+
+	ticker->voffset += 1.0f / 256;
+	if (ticker->voffset >= 1.0f)
+		ticker->voffset -= 1.0f;
+}
+
+/* only the band at the bottom changes from frame to frame */
+static void ticker_footprint(struct pipeline_stage *stage,
+			     struct region *region)
+{
+	struct ticker *ticker = to_ticker(stage);
+
+	region->x0 = 0.0f;
+	region->y0 = 0.0f;
+	region->x1 = 1.0f;
+	region->y1 = ticker->vheight;
+
+	geometry_map_region(ticker->geometry, region, region);
+}
+
+struct pipeline_stage *ticker_new(struct gles *gles,
+				  struct geometry *geometry,
+				  GLfloat height)
+{
+	struct ticker *stage;
+
+	stage = calloc(1, sizeof(*stage));
+	if (!stage)
+		return NULL;
+
+	stage->base.name = "ticker pattern generator";
+	stage->base.release = ticker_release;
+	stage->base.render = ticker_render;
+	stage->base.footprint = ticker_footprint;
+	stage->base.stateful = true;
+
+	stage->geometry = geometry;
+	stage->vheight = height;
+
+	stage->vertex = glsl_shader_new(GL_VERTEX_SHADER, ticker_vs,
+					ARRAY_SIZE(ticker_vs));
+	if (!stage->vertex) {
+		fprintf(stderr, "failed to create vertex shader\n");
+		return NULL;
+	}
+
+	stage->fragment = glsl_shader_new(GL_FRAGMENT_SHADER, ticker_fs,
+					  ARRAY_SIZE(ticker_fs));
+	if (!stage->fragment) {
+		fprintf(stderr, "failed to create fragment shader\n");
+		return NULL;
+	}
+
+	stage->program = glsl_program_new(stage->vertex, stage->fragment);
+	if (!stage->program) {
+		fprintf(stderr, "failed to create GLSL program\n");
+		return NULL;
+	}
+
+	if (glsl_program_link(stage->program) < 0) {
+		fprintf(stderr, "failed to link GLSL program\n");
+		return NULL;
+	}
+
+	stage->pos = glGetAttribLocation(stage->program->id, "position");
+	stage->tex = glGetAttribLocation(stage->program->id, "tex");
+	stage->height = glGetUniformLocation(stage->program->id, "height");
+	stage->offset = glGetUniformLocation(stage->program->id, "offset");
+
+	return &stage->base;
+}
@@ -22,6 +22,45 @@
 
 #include "geometry.h"
 
+bool region_is_empty(const struct region *region)
+{
+	return region->x0 >= region->x1 || region->y0 >= region->y1;
+}
+
+void region_union(struct region *region, const struct region *other)
+{
+	if (region_is_empty(other))
+		return;
+
+	if (region_is_empty(region)) {
+		*region = *other;
+		return;
+	}
+
+	if (other->x0 < region->x0)
+		region->x0 = other->x0;
+
+	if (other->y0 < region->y0)
+		region->y0 = other->y0;
+
+	if (other->x1 > region->x1)
+		region->x1 = other->x1;
+
+	if (other->y1 > region->y1)
+		region->y1 = other->y1;
+}
+
+void region_grow(struct region *region, GLfloat dx, GLfloat dy)
+{
+	if (region_is_empty(region))
+		return;
+
+	region->x0 = region->x0 - dx < 0.0f ? 0.0f : region->x0 - dx;
+	region->y0 = region->y0 - dy < 0.0f ? 0.0f : region->y0 - dy;
+	region->x1 = region->x1 + dx > 1.0f ? 1.0f : region->x1 + dx;
+	region->y1 = region->y1 + dy > 1.0f ? 1.0f : region->y1 + dy;
+}
+
 static GLfloat gluRandom(GLfloat min, GLfloat max)
 {
 	return min + (max - min) * rand() / RAND_MAX;
@@ -136,3 +175,164 @@ void grid_randomize(struct geometry *grid)
 		}
 	}
 }
+
+/*
+ * Check whether the geometry maps the texture coordinates 1:1 onto the
+ * viewport, in which case rendering it is a plain copy.
+ */
+bool geometry_is_identity(const struct geometry *geometry)
+{
+	const GLfloat epsilon = 1.0f / 65536;
+	unsigned int i;
+
+	for (i = 0; i < geometry->num_vertices; i++) {
+		const GLfloat *v = geometry->vertices + i * 3;
+		const GLfloat *t = geometry->uv + i * 2;
+		GLfloat dx = v[0] - (t[0] * 2.0f - 1.0f);
+		GLfloat dy = v[1] - (t[1] * 2.0f - 1.0f);
+
+		if (dx < -epsilon || dx > epsilon ||
+		    dy < -epsilon || dy > epsilon)
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Map a point through one triangle of the geometry, using its barycentric
+ * coordinates in the triangle given by a and their values in b. All of the
+ * coordinates are normalized to [0, 1].
+ */
+static void triangle_map_point(const GLfloat a[3][2], const GLfloat b[3][2],
+			       GLfloat det, GLfloat u, GLfloat v,
+			       GLfloat *x, GLfloat *y)
+{
+	GLfloat l0, l1, l2;
+
+	l1 = ((u - a[0][0]) * (a[2][1] - a[0][1]) -
+	      (v - a[0][1]) * (a[2][0] - a[0][0])) / det;
+	l2 = ((v - a[0][1]) * (a[1][0] - a[0][0]) -
+	      (u - a[0][0]) * (a[1][1] - a[0][1])) / det;
+	l0 = 1.0f - l1 - l2;
+
+	*x = l0 * b[0][0] + l1 * b[1][0] + l2 * b[2][0];
+	*y = l0 * b[0][1] + l1 * b[1][1] + l2 * b[2][1];
+}
+
+/*
+ * Map a region through every triangle of the geometry, from texture
+ * coordinates to the viewport or the other way around. Each triangle is
+ * an affine mapping, so the bounding box of the mapped corners of the
+ * intersection with the triangle's bounds is a conservative estimate
+ * that is exact for an untransformed plane.
+ */
+static void geometry_map(const struct geometry *geometry,
+			 const struct region *source, struct region *target,
+			 bool inverse)
+{
+	struct region result = { 1.0f, 1.0f, 0.0f, 0.0f };
+	unsigned int i, j;
+
+	for (i = 0; i < geometry->num_indices; i += 3) {
+		GLfloat pos[3][2], tex[3][2];
+		GLfloat (*a)[2], (*b)[2];
+		struct region bounds;
+		GLfloat det, x, y;
+
+		for (j = 0; j < 3; j++) {
+			GLushort index = geometry->indices[i + j];
+			const GLfloat *p = geometry->vertices + index * 3;
+			const GLfloat *t = geometry->uv + index * 2;
+
+			pos[j][0] = (p[0] + 1.0f) / 2.0f;
+			pos[j][1] = (p[1] + 1.0f) / 2.0f;
+			tex[j][0] = t[0];
+			tex[j][1] = t[1];
+		}
+
+		a = inverse ? pos : tex;
+		b = inverse ? tex : pos;
+
+		bounds.x0 = bounds.x1 = a[0][0];
+		bounds.y0 = bounds.y1 = a[0][1];
+
+		for (j = 1; j < 3; j++) {
+			if (a[j][0] < bounds.x0)
+				bounds.x0 = a[j][0];
+
+			if (a[j][0] > bounds.x1)
+				bounds.x1 = a[j][0];
+
+			if (a[j][1] < bounds.y0)
+				bounds.y0 = a[j][1];
+
+			if (a[j][1] > bounds.y1)
+				bounds.y1 = a[j][1];
+		}
+
+		/* intersect with the region to map */
+		if (source->x0 > bounds.x0)
+			bounds.x0 = source->x0;
+
+		if (source->y0 > bounds.y0)
+			bounds.y0 = source->y0;
+
+		if (source->x1 < bounds.x1)
+			bounds.x1 = source->x1;
+
+		if (source->y1 < bounds.y1)
+			bounds.y1 = source->y1;
+
+		if (region_is_empty(&bounds))
+			continue;
+
+		det = (a[1][0] - a[0][0]) * (a[2][1] - a[0][1]) -
+		      (a[2][0] - a[0][0]) * (a[1][1] - a[0][1]);
+		if (det == 0.0f)
+			continue;
+
+		for (j = 0; j < 4; j++) {
+			GLfloat u = (j & 1) ? bounds.x1 : bounds.x0;
+			GLfloat v = (j & 2) ? bounds.y1 : bounds.y0;
+
+			triangle_map_point(a, b, det, u, v, &x, &y);
+
+			if (x < result.x0)
+				result.x0 = x;
+
+			if (x > result.x1)
+				result.x1 = x;
+
+			if (y < result.y0)
+				result.y0 = y;
+
+			if (y > result.y1)
+				result.y1 = y;
+		}
+	}
+
+	/* clamp to the unit square */
+	region_grow(&result, 0.0f, 0.0f);
+	*target = result;
+}
+
+/*
+ * Compute the region of the viewport that is covered when rendering the
+ * given region of the source texture with this geometry.
+ */
+void geometry_map_region(const struct geometry *geometry,
+			 const struct region *source, struct region *target)
+{
+	geometry_map(geometry, source, target, false);
+}
+
+/*
+ * Compute the region of the source texture that is sampled when rendering
+ * the given region of the viewport with this geometry.
+ */
+void geometry_unmap_region(const struct geometry *geometry,
+			   const struct region *target, struct region *source)
+{
+	geometry_map(geometry, target, source, true);
+}
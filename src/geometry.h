@@ -20,8 +20,20 @@
 #ifndef GLES_TESTBENCH_GEOMETRY_H
 #define GLES_TESTBENCH_GEOMETRY_H 1
 
+#include <stdbool.h>
+
 #include <GLES2/gl2.h>
 
+/* rectangle in normalized coordinates, the origin is the lower left corner */
+struct region {
+	GLfloat x0, y0;
+	GLfloat x1, y1;
+};
+
+bool region_is_empty(const struct region *region);
+void region_union(struct region *region, const struct region *other);
+void region_grow(struct region *region, GLfloat dx, GLfloat dy);
+
 struct geometry {
 	unsigned int num_cols;
 	unsigned int num_rows;
@@ -37,5 +49,10 @@ struct geometry {
 struct geometry *grid_new(unsigned int subdivisions);
 void geometry_free(struct geometry *geometry);
 void grid_randomize(struct geometry *grid);
+bool geometry_is_identity(const struct geometry *geometry);
+void geometry_map_region(const struct geometry *geometry,
+			 const struct region *source, struct region *target);
+void geometry_unmap_region(const struct geometry *geometry,
+			   const struct region *target, struct region *source);
 
 #endif
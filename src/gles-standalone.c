@@ -34,25 +34,272 @@
 #include "pipeline.h"
 #include "geometry.h"
 #include "gles.h"
+#include "video-file.h"
 
 #define FRAME_COUNT 600
+#define MAX_FRAMES_IN_FLIGHT 16
 
 static unsigned int subdivisions = 0;
 static bool transform = false;
+static bool optimize = true;
+static bool partial = false;
+static unsigned int frames_in_flight = 0;
+static const char *intermediate_format = NULL;
+static unsigned int tile_size = 0;
+
+/*
+ * Pipeline stages are specified on the command-line as
+ *
+ *   [LABEL=]STAGE[,KEY=VALUE...][:INPUT[,INPUT...]]
+ *
+ * where LABEL names the output of the stage so that later stages can use
+ * it as INPUT. If no inputs are given, a stage consumes the output of the
+ * stage preceding it on the command-line.
+ */
+#define STAGE_MAX_OPTIONS 8
+
+struct stage_args {
+	char *buffer;
+
+	const char *label;
+	const char *type;
+
+	struct {
+		const char *key;
+		const char *value;
+	} options[STAGE_MAX_OPTIONS];
+	unsigned int num_options;
+
+	const char *inputs[PIPELINE_STAGE_MAX_INPUTS];
+	unsigned int num_inputs;
+};
+
+static int stage_args_parse(struct stage_args *args, const char *arg)
+{
+	char *inputs, *token, *value;
+
+	memset(args, 0, sizeof(*args));
+
+	args->buffer = strdup(arg);
+	if (!args->buffer)
+		return -1;
+
+	inputs = strchr(args->buffer, ':');
+	if (inputs) {
+		*inputs++ = '\0';
+
+		while ((token = strsep(&inputs, ",")) != NULL) {
+			if (args->num_inputs >= PIPELINE_STAGE_MAX_INPUTS) {
+				fprintf(stderr, "too many inputs: %s\n", arg);
+				return -1;
+			}
+
+			args->inputs[args->num_inputs++] = token;
+		}
+	}
+
+	inputs = args->buffer;
+	token = strsep(&inputs, ",");
+
+	value = strchr(token, '=');
+	if (value) {
+		*value++ = '\0';
+		args->label = token;
+		args->type = value;
+	} else {
+		args->type = token;
+	}
+
+	while ((token = strsep(&inputs, ",")) != NULL) {
+		if (args->num_options >= STAGE_MAX_OPTIONS) {
+			fprintf(stderr, "too many options: %s\n", arg);
+			return -1;
+		}
+
+		value = strchr(token, '=');
+		if (!value) {
+			fprintf(stderr, "invalid option: %s\n", token);
+			return -1;
+		}
+
+		*value++ = '\0';
+		args->options[args->num_options].key = token;
+		args->options[args->num_options].value = value;
+		args->num_options++;
+	}
+
+	return 0;
+}
+
+static const char *stage_args_get(const struct stage_args *args,
+				  const char *key)
+{
+	unsigned int i;
+
+	for (i = 0; i < args->num_options; i++)
+		if (strcmp(args->options[i].key, key) == 0)
+			return args->options[i].value;
+
+	return NULL;
+}
+
+static float stage_args_get_float(const struct stage_args *args,
+				  const char *key, float def)
+{
+	const char *value = stage_args_get(args, key);
+
+	return value ? strtof(value, NULL) : def;
+}
+
+static unsigned long stage_args_get_uint(const struct stage_args *args,
+					 const char *key, unsigned long def)
+{
+	const char *value = stage_args_get(args, key);
+
+	return value ? strtoul(value, NULL, 10) : def;
+}
+
+static int stage_args_get_matrix(const struct stage_args *args,
+				 enum yuv_matrix *matrix)
+{
+	const char *value = stage_args_get(args, "matrix");
+
+	if (!value || strcmp(value, "601") == 0)
+		*matrix = YUV_MATRIX_BT601;
+	else if (strcmp(value, "709") == 0)
+		*matrix = YUV_MATRIX_BT709;
+	else if (strcmp(value, "2020") == 0)
+		*matrix = YUV_MATRIX_BT2020;
+	else {
+		fprintf(stderr, "unsupported matrix: %s\n", value);
+		return -1;
+	}
+
+	return 0;
+}
+
+static const struct framebuffer_format *find_format(struct gles *gles,
+						   const char *name)
+{
+	const struct framebuffer_format *format;
+
+	format = framebuffer_format_find(name);
+	if (!format) {
+		fprintf(stderr, "unknown format: %s\n", name);
+		return NULL;
+	}
+
+	if (!gles_framebuffer_format_supported(gles, format)) {
+		fprintf(stderr, "format not supported: %s\n", name);
+		return NULL;
+	}
+
+	return format;
+}
+
+/* the format and resolution options apply to the output of any stage */
+static int stage_set_output(struct gles *gles, struct pipeline_stage *stage,
+			    const struct stage_args *args)
+{
+	const char *format = stage_args_get(args, "format");
+	const char *resolution = stage_args_get(args, "resolution");
+
+	if (!format && !resolution)
+		return 0;
+
+	if (stage->terminal) {
+		fprintf(stderr, "%s: outputs have no format or resolution\n",
+			args->type);
+		return -1;
+	}
+
+	if (format) {
+		stage->format = find_format(gles, format);
+		if (!stage->format)
+			return -1;
+	}
+
+	if (resolution) {
+		stage->resolution = strtof(resolution, NULL);
+		if (stage->resolution <= 0.0f) {
+			fprintf(stderr, "invalid resolution: %s\n",
+				resolution);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int stage_connect(struct pipeline *pipeline,
+			 struct pipeline_stage *stage,
+			 const struct stage_args *args,
+			 struct pipeline_stage *previous)
+{
+	unsigned int i;
+
+	if (args->num_inputs > stage->num_inputs) {
+		fprintf(stderr, "%s: too many inputs\n", args->type);
+		return -1;
+	}
+
+	for (i = 0; i < stage->num_inputs; i++) {
+		struct pipeline_stage *producer = previous;
+
+		if (i < args->num_inputs) {
+			producer = pipeline_find_stage(pipeline,
+						       args->inputs[i]);
+			if (!producer) {
+				fprintf(stderr, "%s: unknown input: %s\n",
+					args->type, args->inputs[i]);
+				return -1;
+			}
+		}
+
+		pipeline_stage_connect(stage, i, producer);
+	}
+
+	if (args->label) {
+		if (pipeline_find_stage(pipeline, args->label)) {
+			fprintf(stderr, "duplicate label: %s\n", args->label);
+			return -1;
+		}
+
+		stage->label = strdup(args->label);
+		if (!stage->label)
+			return -1;
+	}
+
+	return 0;
+}
 
 static struct pipeline *create_pipeline(struct gles *gles, int argc,
 					char *argv[], bool regenerate,
 					struct framebuffer *source)
 {
-	struct framebuffer *target = NULL;
+	struct pipeline_stage *previous = NULL;
 	struct geometry *plane, *output, *geometry;
 	struct pipeline *pipeline;
+	struct stage_args args;
 	int i;
 
 	pipeline = pipeline_new(gles);
 	if (!pipeline)
 		return NULL;
 
+	pipeline->source = source;
+	pipeline->regenerate = regenerate;
+	pipeline->optimize = optimize;
+	pipeline->partial = partial;
+	pipeline->frames_in_flight = frames_in_flight;
+	pipeline->tile_size = tile_size;
+
+	if (intermediate_format) {
+		pipeline->format = find_format(gles, intermediate_format);
+		if (!pipeline->format)
+			goto free;
+	}
+
 	/*
 	 * FIXME: Keep a reference to the created geometry so that it can be
 	 *        properly disposed of.
@@ -71,6 +318,9 @@ static struct pipeline *create_pipeline(struct gles *gles, int argc,
 	for (i = 0; i < argc; i++) {
 		struct pipeline_stage *stage = NULL;
 
+		if (stage_args_parse(&args, argv[i]) < 0)
+			goto error;
+
 		/*
 		 * Render intermediate stages to a plane (2 triangles) geometry
 		 * and the final one to a randomized grid to simulate geometric
@@ -81,94 +331,513 @@ static struct pipeline *create_pipeline(struct gles *gles, int argc,
 		else
 			geometry = plane;
 
-		/*
-		 * FIXME: Keep a reference to the created target framebuffers
-		 *        so that they can be properly disposed of.
-		 */
-		if (i < argc - 1) {
-			target = framebuffer_new(gles->width, gles->height);
-			if (!target) {
-				fprintf(stderr, "failed to create framebuffer\n");
+		if (strcmp(args.type, "fill") == 0) {
+			stage = simple_fill_new(gles, geometry, 1.0, 0.0, 1.0);
+			if (!stage) {
+				fprintf(stderr, "simple_fill_new() failed\n");
 				goto error;
 			}
-		} else {
-			target = display_framebuffer_new(gles->width, gles->height);
-			if (!target) {
-				fprintf(stderr, "failed to create display\n");
+		} else if (strcmp(args.type, "checkerboard") == 0) {
+			stage = checkerboard_new(gles, geometry);
+			if (!stage) {
+				fprintf(stderr, "checkerboard_new() failed\n");
 				goto error;
 			}
-		}
+		} else if (strcmp(args.type, "ticker") == 0) {
+			GLfloat height = stage_args_get_float(&args, "height",
+							      0.1f);
 
-		if (strcmp(argv[i], "fill") == 0) {
-			stage = simple_fill_new(gles, geometry, target,
-						1.0, 0.0, 1.0);
+			stage = ticker_new(gles, geometry, height);
 			if (!stage) {
-				fprintf(stderr, "simple_fill_new() failed\n");
+				fprintf(stderr, "ticker_new() failed\n");
 				goto error;
 			}
-		} else if (strcmp(argv[i], "checkerboard") == 0) {
-			stage = checkerboard_new(gles, geometry, target);
+		} else if (strcmp(args.type, "noise") == 0 ||
+			   strcmp(args.type, "zoneplate") == 0 ||
+			   strcmp(args.type, "gradient") == 0 ||
+			   strcmp(args.type, "motion") == 0) {
+			enum pattern_type type = PATTERN_NOISE;
+			unsigned int seed;
+
+			if (strcmp(args.type, "zoneplate") == 0)
+				type = PATTERN_ZONE_PLATE;
+			else if (strcmp(args.type, "gradient") == 0)
+				type = PATTERN_GRADIENT;
+			else if (strcmp(args.type, "motion") == 0)
+				type = PATTERN_MOTION;
+
+			seed = stage_args_get_uint(&args, "seed", 0);
+
+			stage = pattern_new(gles, geometry, type, seed);
 			if (!stage) {
-				fprintf(stderr, "checkerboard_new() failed\n");
+				fprintf(stderr, "pattern_new() failed\n");
+				goto error;
+			}
+		} else if (strcmp(args.type, "nv12") == 0 ||
+			   strcmp(args.type, "i420") == 0 ||
+			   strcmp(args.type, "yuyv") == 0) {
+			enum yuv_matrix matrix = YUV_MATRIX_BT601;
+			enum yuv_format format = YUV_FORMAT_NV12;
+			unsigned int width, height;
+			const char *value;
+			bool full_range;
+
+			if (strcmp(args.type, "i420") == 0)
+				format = YUV_FORMAT_I420;
+			else if (strcmp(args.type, "yuyv") == 0)
+				format = YUV_FORMAT_YUYV;
+
+			if (stage_args_get_matrix(&args, &matrix) < 0)
+				goto error;
+
+			value = stage_args_get(&args, "range");
+			full_range = value && strcmp(value, "full") == 0;
+
+			width = stage_args_get_uint(&args, "width",
+						    gles->width);
+			height = stage_args_get_uint(&args, "height",
+						     gles->height);
+
+			stage = yuv_source_new(gles, geometry, format, matrix,
+					       full_range, width, height);
+			if (!stage) {
+				fprintf(stderr, "yuv_source_new() failed\n");
+				goto error;
+			}
+		} else if (strcmp(args.type, "upload") == 0) {
+			enum video_layout layout = VIDEO_LAYOUT_RGBA;
+			enum upload_mode mode = UPLOAD_SUB_IMAGE;
+			unsigned int ring, width, height, ahead;
+			struct video_file *file = NULL;
+			const char *value;
+
+			value = stage_args_get(&args, "mode");
+			if (!value || strcmp(value, "subimage") == 0)
+				mode = UPLOAD_SUB_IMAGE;
+			else if (strcmp(value, "image") == 0)
+				mode = UPLOAD_IMAGE;
+			else {
+				fprintf(stderr, "unsupported mode: %s\n",
+					value);
 				goto error;
 			}
-		} else if (strcmp(argv[i], "clear") == 0) {
-			stage = clear_new(gles, target, 1.0f, 1.0f, 0.0f);
+
+			ring = stage_args_get_uint(&args, "ring", 1);
+			width = stage_args_get_uint(&args, "width",
+						    gles->width);
+			height = stage_args_get_uint(&args, "height",
+						     gles->height);
+
+			value = stage_args_get(&args, "layout");
+			if (value && strcmp(value, "i420") == 0)
+				layout = VIDEO_LAYOUT_I420;
+
+			ahead = stage_args_get_uint(&args, "prefetch", 8);
+
+			value = stage_args_get(&args, "file");
+			if (value) {
+				file = video_file_open(value, layout, width,
+						       height, ahead);
+				if (!file)
+					goto error;
+			}
+
+			stage = upload_new(gles, geometry, mode, ring, width,
+					   height, file);
+			if (!stage) {
+				fprintf(stderr, "upload_new() failed\n");
+				video_file_close(file);
+				goto error;
+			}
+		} else if (strcmp(args.type, "dmabuf") == 0) {
+			unsigned int ring, width, height;
+			bool reimport;
+
+			ring = stage_args_get_uint(&args, "ring", 3);
+			width = stage_args_get_uint(&args, "width",
+						    gles->width);
+			height = stage_args_get_uint(&args, "height",
+						     gles->height);
+			reimport = stage_args_get_uint(&args, "reimport", 0);
+
+			stage = dmabuf_new(gles, geometry, ring, width, height,
+					   reimport);
+			if (!stage) {
+				fprintf(stderr, "dmabuf_new() failed\n");
+				goto error;
+			}
+		} else if (strcmp(args.type, "nv12out") == 0 ||
+			   strcmp(args.type, "i420out") == 0) {
+			enum yuv_matrix matrix = YUV_MATRIX_BT601;
+			enum yuv_format format = YUV_FORMAT_NV12;
+			bool full_range, readback;
+			const char *value;
+
+			if (strcmp(args.type, "i420out") == 0)
+				format = YUV_FORMAT_I420;
+
+			if (stage_args_get_matrix(&args, &matrix) < 0)
+				goto error;
+
+			value = stage_args_get(&args, "range");
+			full_range = value && strcmp(value, "full") == 0;
+			readback = stage_args_get_uint(&args, "readback", 0);
+
+			stage = yuv_sink_new(gles, format, matrix, full_range,
+					     readback);
+			if (!stage) {
+				fprintf(stderr, "yuv_sink_new() failed\n");
+				goto error;
+			}
+		} else if (strcmp(args.type, "average") == 0) {
+			bool readback;
+
+			readback = stage_args_get_uint(&args, "readback", 1);
+
+			stage = average_new(gles, readback);
+			if (!stage) {
+				fprintf(stderr, "average_new() failed\n");
+				goto error;
+			}
+		} else if (strcmp(args.type, "histogram") == 0) {
+			unsigned int step;
+			bool readback;
+
+			step = stage_args_get_uint(&args, "step", 2);
+			readback = stage_args_get_uint(&args, "readback", 1);
+
+			stage = histogram_new(gles, step, readback);
+			if (!stage) {
+				fprintf(stderr, "histogram_new() failed\n");
+				goto error;
+			}
+		} else if (strcmp(args.type, "capture") == 0) {
+			unsigned int delay, buffers, interval, rate;
+			const char *file;
+
+			file = stage_args_get(&args, "file");
+			if (!file) {
+				fprintf(stderr, "capture needs a file\n");
+				goto error;
+			}
+
+			delay = stage_args_get_uint(&args, "delay", 2);
+			buffers = stage_args_get_uint(&args, "buffers", 4);
+			interval = stage_args_get_uint(&args, "interval", 1);
+			rate = stage_args_get_uint(&args, "rate", 60);
+
+			stage = capture_new(gles, file, delay, buffers,
+					    interval, rate);
+			if (!stage) {
+				fprintf(stderr, "capture_new() failed\n");
+				goto error;
+			}
+		} else if (strcmp(args.type, "psnr") == 0) {
+			unsigned int interval;
+
+			interval = stage_args_get_uint(&args, "interval", 30);
+
+			stage = psnr_new(gles, interval);
+			if (!stage) {
+				fprintf(stderr, "psnr_new() failed\n");
+				goto error;
+			}
+		} else if (strcmp(args.type, "clear") == 0) {
+			stage = clear_new(gles, 1.0f, 1.0f, 0.0f);
 			if (!stage) {
 				fprintf(stderr, "clear_new() failed\n");
 				goto error;
 			}
-		} else if (strcmp(argv[i], "copy") == 0) {
-			stage = simple_copy_new(gles, geometry, source, target);
+		} else if (strcmp(args.type, "copy") == 0) {
+			stage = simple_copy_new(gles, geometry);
 			if (!stage) {
 				fprintf(stderr, "simple_copy_new() failed\n");
 				goto error;
 			}
-		} else if (strcmp(argv[i], "copyone") == 0) {
-			stage = copy_one_new(gles, geometry, source, target);
+		} else if (strcmp(args.type, "copyone") == 0) {
+			stage = copy_one_new(gles, geometry);
 			if (!stage) {
 				fprintf(stderr, "copy_one_new() failed\n");
 				goto error;
 			}
-		} else if (strcmp(argv[i], "deinterlace") == 0) {
-			stage = deinterlace_new(gles, geometry, source, target);
+		} else if (strcmp(args.type, "deinterlace") == 0) {
+			enum deinterlace_mode mode = DEINTERLACE_LINEAR;
+			const char *value = stage_args_get(&args, "mode");
+
+			if (value && strcmp(value, "bob") == 0)
+				mode = DEINTERLACE_BOB;
+			else if (value && strcmp(value, "field") == 0)
+				mode = DEINTERLACE_FIELD;
+			else if (value && strcmp(value, "linear") != 0) {
+				fprintf(stderr, "unsupported mode: %s\n",
+					value);
+				goto error;
+			}
+
+			stage = deinterlace_new(gles, geometry, mode);
 			if (!stage) {
 				fprintf(stderr, "deinterlace_new() failed\n");
 				goto error;
 			}
-		} else if (strcmp(argv[i], "cc") == 0) {
-			stage = color_correct_new(gles, geometry, source,
-						  target);
+		} else if (strcmp(args.type, "mdeinterlace") == 0) {
+			unsigned int fields;
+			GLfloat threshold;
+
+			fields = stage_args_get_uint(&args, "fields", 2);
+			threshold = stage_args_get_float(&args, "threshold",
+							 0.04f);
+
+			stage = motion_deinterlace_new(gles, geometry, fields,
+						       threshold);
+			if (!stage) {
+				fprintf(stderr,
+					"motion_deinterlace_new() failed\n");
+				goto error;
+			}
+		} else if (strcmp(args.type, "cc") == 0) {
+			GLfloat add = stage_args_get_float(&args, "add", 0.0f);
+			GLfloat factor = stage_args_get_float(&args, "factor",
+							      1.0f);
+
+			stage = color_correct_new(gles, geometry, add, factor);
 			if (!stage) {
 				fprintf(stderr, "color_correct_new() failed\n");
 				goto error;
 			}
+		} else if (strcmp(args.type, "lut") == 0) {
+			const char *filename = stage_args_get(&args, "file");
+			const char *precision;
+			unsigned int size;
+			bool highp;
+
+			size = stage_args_get_uint(&args, "size", 17);
+			precision = stage_args_get(&args, "precision");
+			highp = precision && strcmp(precision, "highp") == 0;
+
+			stage = lut_new(gles, geometry, filename, size, highp);
+			if (!stage) {
+				fprintf(stderr, "lut_new() failed\n");
+				goto error;
+			}
+		} else if (strcmp(args.type, "overlay") == 0) {
+			bool premultiplied, skip;
+			GLfloat size, coverage;
+			unsigned int layers;
+
+			layers = stage_args_get_uint(&args, "layers", 3);
+			size = stage_args_get_float(&args, "size", 0.5f);
+			coverage = stage_args_get_float(&args, "coverage",
+							0.5f);
+			premultiplied = stage_args_get_uint(&args,
+							    "premultiplied",
+							    1);
+			skip = stage_args_get_uint(&args, "skip", 0);
+
+			stage = overlay_new(gles, geometry, layers, size,
+					    coverage, premultiplied, skip);
+			if (!stage) {
+				fprintf(stderr, "overlay_new() failed\n");
+				goto error;
+			}
+		} else if (strcmp(args.type, "edgeblend") == 0) {
+			GLfloat ramps[4], gamma, black;
+			bool mask;
+
+			ramps[0] = stage_args_get_float(&args, "left", 0.0f);
+			ramps[1] = stage_args_get_float(&args, "right", 0.0f);
+			ramps[2] = stage_args_get_float(&args, "bottom", 0.0f);
+			ramps[3] = stage_args_get_float(&args, "top", 0.0f);
+			gamma = stage_args_get_float(&args, "gamma", 2.2f);
+			black = stage_args_get_float(&args, "black", 0.0f);
+			mask = stage_args_get_uint(&args, "mask", 0);
+
+			stage = edge_blend_new(gles, geometry, ramps, gamma,
+					       black, mask);
+			if (!stage) {
+				fprintf(stderr, "edge_blend_new() failed\n");
+				goto error;
+			}
+		} else if (strcmp(args.type, "frc") == 0) {
+			unsigned int input_rate, output_rate;
+			const char *value;
+			bool blend = true;
+
+			input_rate = stage_args_get_uint(&args, "in", 50);
+			output_rate = stage_args_get_uint(&args, "out", 60);
+
+			value = stage_args_get(&args, "mode");
+			if (value && strcmp(value, "nearest") == 0)
+				blend = false;
+			else if (value && strcmp(value, "blend") != 0) {
+				fprintf(stderr, "unsupported mode: %s\n",
+					value);
+				goto error;
+			}
+
+			stage = frame_rate_new(gles, geometry, input_rate,
+					       output_rate, blend);
+			if (!stage) {
+				fprintf(stderr, "frame_rate_new() failed\n");
+				goto error;
+			}
+		} else if (strcmp(args.type, "dither") == 0) {
+			unsigned int bits[3] = { 8, 8, 8 };
+
+			/* default to the depth of the display */
+			if (gles->depth == 16) {
+				bits[0] = bits[2] = 5;
+				bits[1] = 6;
+			} else if (gles->depth == 30) {
+				bits[0] = bits[1] = bits[2] = 10;
+			}
+
+			if (stage_args_get(&args, "bits"))
+				bits[0] = bits[1] = bits[2] =
+					stage_args_get_uint(&args, "bits", 8);
+
+			stage = dither_new(gles, geometry, bits);
+			if (!stage) {
+				fprintf(stderr, "dither_new() failed\n");
+				goto error;
+			}
+		} else if (strcmp(args.type, "gauss") == 0 ||
+			   strcmp(args.type, "box") == 0 ||
+			   strcmp(args.type, "unsharp") == 0) {
+			enum convolve_kernel kernel = CONVOLVE_GAUSSIAN;
+			unsigned int radius;
+			GLfloat sigma, amount;
+
+			if (strcmp(args.type, "box") == 0)
+				kernel = CONVOLVE_BOX;
+			else if (strcmp(args.type, "unsharp") == 0)
+				kernel = CONVOLVE_UNSHARP;
+
+			radius = stage_args_get_uint(&args, "radius", 4);
+			sigma = stage_args_get_float(&args, "sigma", 0.0f);
+			amount = stage_args_get_float(&args, "amount", 1.0f);
+
+			stage = convolve_new(gles, geometry, kernel, radius,
+					     sigma, amount);
+			if (!stage) {
+				fprintf(stderr, "convolve_new() failed\n");
+				goto error;
+			}
+		} else if (strcmp(args.type, "scale") == 0) {
+			enum scale_filter filter = SCALE_BILINEAR;
+			unsigned int width, height;
+			const char *value;
+			bool mipmap;
+
+			value = stage_args_get(&args, "filter");
+			if (value && strcmp(value, "bicubic") == 0)
+				filter = SCALE_BICUBIC;
+			else if (value && strcmp(value, "lanczos") == 0)
+				filter = SCALE_LANCZOS;
+			else if (value && strcmp(value, "bilinear") != 0) {
+				fprintf(stderr, "unsupported filter: %s\n",
+					value);
+				goto error;
+			}
+
+			width = stage_args_get_uint(&args, "width", 0);
+			height = stage_args_get_uint(&args, "height", 0);
+			mipmap = stage_args_get_uint(&args, "mipmap", 0);
+
+			stage = scale_new(gles, geometry, width, height,
+					  filter, mipmap);
+			if (!stage) {
+				fprintf(stderr, "scale_new() failed\n");
+				goto error;
+			}
+		} else if (strcmp(args.type, "orient") == 0) {
+			enum orientation_mode mode = ORIENTATION_ROTATE_90;
+			unsigned int block;
+			const char *value;
+			bool tiled;
+
+			value = stage_args_get(&args, "mode");
+			if (!value || strcmp(value, "90") == 0)
+				mode = ORIENTATION_ROTATE_90;
+			else if (strcmp(value, "180") == 0)
+				mode = ORIENTATION_ROTATE_180;
+			else if (strcmp(value, "270") == 0)
+				mode = ORIENTATION_ROTATE_270;
+			else if (strcmp(value, "hflip") == 0)
+				mode = ORIENTATION_FLIP_HORIZONTAL;
+			else if (strcmp(value, "vflip") == 0)
+				mode = ORIENTATION_FLIP_VERTICAL;
+			else if (strcmp(value, "transpose") == 0)
+				mode = ORIENTATION_TRANSPOSE;
+			else {
+				fprintf(stderr, "unsupported mode: %s\n",
+					value);
+				goto error;
+			}
+
+			tiled = stage_args_get_uint(&args, "tiled", 0);
+			block = stage_args_get_uint(&args, "block", 64);
+
+			stage = orientation_new(gles, geometry, mode, tiled,
+						block);
+			if (!stage) {
+				fprintf(stderr, "orientation_new() failed\n");
+				goto error;
+			}
+		} else if (strcmp(args.type, "blend") == 0) {
+			GLfloat alpha = stage_args_get_float(&args, "alpha",
+							     0.5f);
+
+			stage = blend_new(gles, geometry, alpha);
+			if (!stage) {
+				fprintf(stderr, "blend_new() failed\n");
+				goto error;
+			}
 		} else {
 			fprintf(stderr, "unsupported pipeline stage: %s\n",
-				argv[i]);
+				args.type);
 			goto error;
 		}
 
-		/*
-		 * Only add the generator to the pipeline if the regenerate
-		 * flag was passed. Otherwise, render it only once.
-		 */
-		if (i > 0 || regenerate || argc == 1) {
-			pipeline_add_stage(pipeline, stage);
-		} else {
-			stage->pipeline = pipeline;
-			stage->render(stage);
+		if (stage_set_output(gles, stage, &args) < 0) {
+			pipeline_stage_free(stage);
+			goto error;
+		}
+
+		if (stage_connect(pipeline, stage, &args, previous) < 0) {
 			pipeline_stage_free(stage);
+			goto error;
 		}
 
-		if (i < argc - 1)
-			source = target;
+		pipeline_add_stage(pipeline, stage);
+		free(args.buffer);
+
+		/* outputs don't produce anything to chain the next stage to */
+		if (!stage->terminal)
+			previous = stage;
 	}
 
+	/* a pipeline ending in an output displays the stage it consumed */
+	if (pipeline->last->terminal) {
+		struct pipeline_stage *stage;
+
+		stage = simple_copy_new(gles, output);
+		if (!stage) {
+			fprintf(stderr, "simple_copy_new() failed\n");
+			goto free;
+		}
+
+		pipeline_stage_connect(stage, 0, previous);
+		pipeline_add_stage(pipeline, stage);
+	}
+
+	if (pipeline_prepare(pipeline) < 0)
+		goto free;
+
 	return pipeline;
 
 error:
-	framebuffer_free(target);
+	free(args.buffer);
+free:
 	pipeline_free(pipeline);
 	return NULL;
 }
@@ -178,20 +847,92 @@ static void usage(FILE *fp, const char *program)
 	fprintf(fp, "Usage: %s [options] PIPELINE...\n", program);
 	fprintf(fp, "Options:\n");
 	fprintf(fp, "  -d, --depth DEPTH     Set color depth.\n");
+	fprintf(fp, "  -f, --frames-in-flight N\n");
+	fprintf(fp, "                        Allow N frames in flight (0: driver default,\n");
+	fprintf(fp, "                        at most %u).\n", MAX_FRAMES_IN_FLIGHT);
 	fprintf(fp, "  -h, --help            Display help screen and exit.\n");
-	fprintf(fp, "  -r, --regenerate      Regenerate test pattern for every frame.\n");
+	fprintf(fp, "  -i, --intermediate-format FORMAT\n");
+	fprintf(fp, "                        Set the format of intermediate framebuffers.\n");
+	fprintf(fp, "  -n, --no-optimize     Don't remove redundant pipeline stages.\n");
+	fprintf(fp, "  -p, --partial         Render only the damaged regions of stages.\n");
+	fprintf(fp, "  -r, --regenerate      Render all stages for every frame (no caching).\n");
 	fprintf(fp, "  -s, --subdivisions N  Use N subdivisions to generate geometry.\n");
 	fprintf(fp, "  -t, --transform       Transform generated geometry.\n");
+	fprintf(fp, "  -T, --tile-size N     Render the pipeline in tiles of NxN pixels.\n");
 	fprintf(fp, "  -V, --version         Display program version and exit.\n");
 	fprintf(fp, "\n");
 	fprintf(fp, "Pipeline Stages:\n");
 	fprintf(fp, "  fill          simple uniform fill generator\n");
 	fprintf(fp, "  checkerboard  checkerboard generator\n");
+	fprintf(fp, "  ticker        scrolling band generator (height=H)\n");
+	fprintf(fp, "  noise         per-frame noise generator (seed=N)\n");
+	fprintf(fp, "  zoneplate     moving zone plate generator (seed=N)\n");
+	fprintf(fp, "  gradient      scrolling gradient generator (seed=N)\n");
+	fprintf(fp, "  motion        interlaced motion generator (seed=N)\n");
 	fprintf(fp, "  clear         clear generator\n");
+	fprintf(fp, "  nv12          NV12 source (matrix=601|709|2020,\n");
+	fprintf(fp, "                range=full|limited, width=W, height=H)\n");
+	fprintf(fp, "  i420          I420 source (options as for nv12)\n");
+	fprintf(fp, "  yuyv          YUYV source (options as for nv12)\n");
+	fprintf(fp, "  upload        upload an RGBA frame every frame (mode=image|\n");
+	fprintf(fp, "                subimage, ring=N textures, width=W, height=H)\n");
+	fprintf(fp, "                or frames of a raw or YUV4MPEG2 file=FILE in\n");
+	fprintf(fp, "                a loop (layout=rgba|i420 for raw files,\n");
+	fprintf(fp, "                prefetch=N frames ahead)\n");
+	fprintf(fp, "  dmabuf        sample RGBA frames from a ring=N of dma-bufs\n");
+	fprintf(fp, "                (width=W, height=H, reimport=0|1 to import\n");
+	fprintf(fp, "                every frame), uploads them if not supported\n");
+	fprintf(fp, "  nv12out       convert to NV12 (matrix=601|709|2020,\n");
+	fprintf(fp, "                range=full|limited, readback=0|1)\n");
+	fprintf(fp, "  i420out       convert to I420 (options as for nv12out)\n");
+	fprintf(fp, "  average       average luma by reduction to 1x1 (readback=0|1)\n");
+	fprintf(fp, "  histogram     256-bin luma histogram of every step=N-th pixel\n");
+	fprintf(fp, "                (readback=0|1)\n");
+	fprintf(fp, "  capture       record every interval=N-th frame to a raw RGBA or\n");
+	fprintf(fp, "                .y4m file=FILE, read back delay=N frames later\n");
+	fprintf(fp, "                into a pool of buffers=N (rate=R for .y4m)\n");
+	fprintf(fp, "  psnr          PSNR of the second input relative to the first,\n");
+	fprintf(fp, "                measured every interval=N frames\n");
 	fprintf(fp, "  copy          simple copy\n");
 	fprintf(fp, "  copyone       copy a single source pixel\n");
-	fprintf(fp, "  deinterlace   linear deinterlacer\n");
-	fprintf(fp, "  cc            color correction\n");
+	fprintf(fp, "  deinterlace   deinterlacer (mode=linear|bob|field, the latter\n");
+	fprintf(fp, "                two at field rate, field at half height)\n");
+	fprintf(fp, "  mdeinterlace  motion-adaptive deinterlacer (fields=2|4,\n");
+	fprintf(fp, "                threshold=T)\n");
+	fprintf(fp, "  cc            color correction (add=A, factor=F)\n");
+	fprintf(fp, "  lut           3D LUT color grading (file=CUBE or size=N for\n");
+	fprintf(fp, "                a built-in grade, precision=mediump|highp)\n");
+	fprintf(fp, "  overlay       blend RGBA layers over the input (layers=N,\n");
+	fprintf(fp, "                size=S, coverage=C, premultiplied=0|1,\n");
+	fprintf(fp, "                skip=0|1 to skip transparent tiles)\n");
+	fprintf(fp, "  edgeblend     projector edge blending (left=W, right=W,\n");
+	fprintf(fp, "                bottom=W, top=W, gamma=G, black=B, mask=0|1)\n");
+	fprintf(fp, "  frc           frame rate conversion from in=R to out=R frames\n");
+	fprintf(fp, "                per second (mode=blend|nearest)\n");
+	fprintf(fp, "  dither        ordered dither to bits=N per channel (default:\n");
+	fprintf(fp, "                display depth)\n");
+	fprintf(fp, "  gauss         separable gaussian blur (radius=R, sigma=S)\n");
+	fprintf(fp, "  box           separable box blur (radius=R)\n");
+	fprintf(fp, "  unsharp       unsharp mask (radius=R, sigma=S, amount=A)\n");
+	fprintf(fp, "  scale         scale to width=W, height=H (default: input size,\n");
+	fprintf(fp, "                display size for the final stage) with\n");
+	fprintf(fp, "                filter=bilinear|bicubic|lanczos, mipmap=0|1\n");
+	fprintf(fp, "  orient        rotate or mirror (mode=90|180|270|hflip|vflip|\n");
+	fprintf(fp, "                transpose, tiled=0|1 to render in blocks of\n");
+	fprintf(fp, "                block=N pixels)\n");
+	fprintf(fp, "  blend         blend two inputs (alpha=A)\n");
+	fprintf(fp, "\n");
+	fprintf(fp, "Each stage is given as [LABEL=]STAGE[,KEY=VALUE...][:INPUT,...]\n");
+	fprintf(fp, "where INPUT refers to the LABEL of an earlier stage. Stages\n");
+	fprintf(fp, "without explicit inputs consume the output of the preceding\n");
+	fprintf(fp, "stage, e.g.: a=checkerboard fill blend,alpha=0.25:a cc\n");
+	fprintf(fp, "The output of any stage can be given a format=FORMAT of rgb565,\n");
+	fprintf(fp, "rgba4444, rgb8 (default), rgba8, rgb10a2 or rgba16f, and can be\n");
+	fprintf(fp, "rendered at a resolution=F fraction of the display resolution.\n");
+	fprintf(fp, "Outputs (nv12out, i420out, average, histogram, psnr, capture) can't be\n");
+	fprintf(fp, "used as inputs. A stage following an output consumes the stage\n");
+	fprintf(fp, "preceding it instead. If the pipeline ends in an output, the\n");
+	fprintf(fp, "stage it consumes is copied to the display.\n");
 }
 
 static inline uint64_t timespec_to_usec(const struct timespec *tp)
@@ -203,18 +944,30 @@ int main(int argc, char **argv)
 {
 	static const struct option options[] = {
 		{ "depth", 1, NULL, 'd' },
+		{ "frames-in-flight", 1, NULL, 'f' },
 		{ "help", 0, NULL, 'h' },
+		{ "intermediate-format", 1, NULL, 'i' },
+		{ "no-optimize", 0, NULL, 'n' },
+		{ "partial", 0, NULL, 'p' },
 		{ "regenerate", 0, NULL, 'r' },
 		{ "subdivisions", 1, NULL, 's' },
+		{ "tile-size", 1, NULL, 'T' },
 		{ "transform", 0, NULL, 't' },
 		{ "version", 0, NULL, 'V' },
 		{ NULL, 0, NULL, 0 },
 	};
-	struct framebuffer *display;
 	struct framebuffer *source;
 	struct pipeline *pipeline;
-	unsigned long depth = 24;
+	unsigned long depth = 24, value;
+	char *endp;
 	bool regenerate = false;
+	unsigned long long shaded, covered, written, readback_bytes;
+	unsigned long long upload_bytes, import_bytes;
+	uint64_t readback, readback_max, upload, upload_max;
+	uint64_t import, import_max;
+	unsigned long readbacks, uploads, imports;
+	uint64_t latency, latency_min, latency_max;
+	unsigned long renders, reuses, latencies;
 	float duration, texels;
 	unsigned int frames;
 	uint64_t start, end;
@@ -222,7 +975,7 @@ int main(int argc, char **argv)
 	struct gles *gles;
 	int opt;
 
-	while ((opt = getopt_long(argc, argv, "d:hrs:tV", options, NULL)) != -1) {
+	while ((opt = getopt_long(argc, argv, "d:f:hi:nprs:tT:V", options, NULL)) != -1) {
 		switch (opt) {
 		case 'd':
 			depth = strtoul(optarg, NULL, 10);
@@ -232,10 +985,34 @@ int main(int argc, char **argv)
 			}
 			break;
 
+		case 'f':
+			value = strtoul(optarg, &endp, 10);
+			if (endp == optarg || *endp != '\0' ||
+			    value > MAX_FRAMES_IN_FLIGHT) {
+				fprintf(stderr, "invalid number of frames in "
+					"flight: %s\n", optarg);
+				return 1;
+			}
+
+			frames_in_flight = value;
+			break;
+
 		case 'h':
 			usage(stdout, argv[0]);
 			return 0;
 
+		case 'i':
+			intermediate_format = optarg;
+			break;
+
+		case 'n':
+			optimize = false;
+			break;
+
+		case 'p':
+			partial = true;
+			break;
+
 		case 'r':
 			regenerate = true;
 			break;
@@ -248,6 +1025,10 @@ int main(int argc, char **argv)
 			transform = true;
 			break;
 
+		case 'T':
+			tile_size = strtoul(optarg, NULL, 10);
+			break;
+
 		case 'V':
 			printf("%s %s\n", argv[0], PACKAGE_VERSION);
 			return 0;
@@ -269,12 +1050,6 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
-	display = display_framebuffer_new(gles->width, gles->height);
-	if (!display) {
-		fprintf(stderr, "display_framebuffer_new() failed\n");
-		return 1;
-	}
-
 	source = framebuffer_new(gles->width, gles->height);
 	if (!source) {
 		fprintf(stderr, "failed to create framebuffer\n");
@@ -296,18 +1071,78 @@ int main(int argc, char **argv)
 	for (frames = 0; frames < FRAME_COUNT; frames++)
 		pipeline_render(pipeline);
 
+	pipeline_finish(pipeline);
+
 	clock_gettime(CLOCK_MONOTONIC, &ts);
 	end = timespec_to_usec(&ts);
 
+	renders = pipeline->renders;
+	reuses = pipeline->reuses;
+	latency = pipeline->latency_total;
+	latency_min = pipeline->latency_min;
+	latency_max = pipeline->latency_max;
+	latencies = pipeline->latency_count;
+	shaded = pipeline->pixels_shaded;
+	covered = pipeline->pixels_total;
+	written = pipeline->bytes_written;
+	readback = pipeline->readback_total;
+	readback_max = pipeline->readback_max;
+	readback_bytes = pipeline->readback_bytes;
+	readbacks = pipeline->readback_count;
+	upload = pipeline->upload_total;
+	upload_max = pipeline->upload_max;
+	upload_bytes = pipeline->upload_bytes;
+	uploads = pipeline->upload_count;
+	import = pipeline->import_total;
+	import_max = pipeline->import_max;
+	import_bytes = pipeline->import_bytes;
+	imports = pipeline->import_count;
+
 	pipeline_free(pipeline);
 	framebuffer_free(source);
-	display_framebuffer_free(display);
 	gles_free(gles);
 
 	duration = (end - start) / 1000000.0f;
 	printf("Rendered %d frames in %fs\n", FRAME_COUNT, duration);
 	printf("Average fps was %.02f\n", FRAME_COUNT / duration);
 	printf("MTexels/s: %fs\n", (texels / 1000000.0f) / duration);
+	printf("Stages rendered: %lu, reused from cache: %lu\n", renders,
+	       reuses);
+
+	if (latencies > 0)
+		printf("Latency (ms, upper bound): average %.02f, min %.02f, "
+		       "max %.02f\n",
+		       latency / 1000.0f / latencies, latency_min / 1000.0f,
+		       latency_max / 1000.0f);
+
+	if (covered > 0)
+		printf("Pixels shaded per frame: %llu (%.02f%%)\n",
+		       shaded / FRAME_COUNT, shaded * 100.0 / covered);
+
+	if (written > 0)
+		printf("Intermediate MiB written per frame: %.02f\n",
+		       written / 1048576.0 / FRAME_COUNT);
+
+	if (readbacks > 0)
+		printf("Readback stall (ms): average %.03f, max %.03f, "
+		       "%lu readbacks of %llu bytes\n",
+		       readback / 1000.0f / readbacks, readback_max / 1000.0f,
+		       readbacks, readback_bytes / readbacks);
+
+	/* throughput while the CPU is blocked in the uploads */
+	if (uploads > 0)
+		printf("Upload stall (ms): average %.03f, max %.03f, "
+		       "%lu uploads of %llu bytes, %.02f MB/s\n",
+		       upload / 1000.0f / uploads, upload_max / 1000.0f,
+		       uploads, upload_bytes / uploads,
+		       upload ? (double)upload_bytes / upload : 0.0);
+
+	/* shown next to uploads, which import replaces */
+	if (imports > 0)
+		printf("Import (ms): average %.03f, max %.03f, %lu imports, "
+		       "%.02f MiB per frame not copied\n",
+		       import / 1000.0f / imports, import_max / 1000.0f,
+		       imports, import_bytes / 1048576.0 / FRAME_COUNT);
 
 	return 0;
 }
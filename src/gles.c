@@ -34,6 +34,7 @@
 #include <GLES2/gl2ext.h>
 
 #include <X11/Xatom.h>
+#include <X11/Xutil.h>
 
 #include "gles.h"
 
@@ -64,16 +65,29 @@ void texture_free(struct texture *texture)
 }
 
 struct framebuffer *framebuffer_new(unsigned int width, unsigned int height)
+{
+	return framebuffer_new_format(width, height, GL_RGB, GL_UNSIGNED_BYTE);
+}
+
+struct framebuffer *framebuffer_new_format(unsigned int width,
+					   unsigned int height,
+					   GLenum format, GLenum type)
 {
 	struct framebuffer *framebuffer;
+	GLenum status;
+	GLint binding;
 
 	framebuffer = calloc(1, sizeof(*framebuffer));
 	if (!framebuffer)
 		return NULL;
 
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &binding);
+
 	glGenFramebuffers(1, &framebuffer->id);
 	framebuffer->width = width;
 	framebuffer->height = height;
+	framebuffer->format = format;
+	framebuffer->type = type;
 
 	framebuffer->texture = texture_new(GL_LINEAR);
 	if (!framebuffer->texture) {
@@ -81,12 +95,22 @@ struct framebuffer *framebuffer_new(unsigned int width, unsigned int height)
 		return NULL;
 	}
 
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB,
-		     GL_UNSIGNED_BYTE, NULL);
+	glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, type,
+		     NULL);
 
 	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer->id);
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
 			       GL_TEXTURE_2D, framebuffer->texture->id, 0);
+	status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+
+	/* don't disturb the framebuffer currently being rendered to */
+	glBindFramebuffer(GL_FRAMEBUFFER, binding);
+
+	/* not all formats that can be sampled can be rendered to */
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		framebuffer_free(framebuffer);
+		return NULL;
+	}
 
 	return framebuffer;
 }
@@ -98,6 +122,73 @@ void framebuffer_free(struct framebuffer *framebuffer)
 	free(framebuffer);
 }
 
+/* size of a pixel in memory, or 0 if unknown (e.g. for the display) */
+unsigned int framebuffer_bytes_per_pixel(const struct framebuffer *framebuffer)
+{
+	unsigned int components;
+
+	switch (framebuffer->format) {
+	case GL_LUMINANCE:
+	case GL_ALPHA:
+		components = 1;
+		break;
+
+	case GL_LUMINANCE_ALPHA:
+		components = 2;
+		break;
+
+	case GL_RGB:
+		components = 3;
+		break;
+
+	case GL_RGBA:
+		components = 4;
+		break;
+
+	default:
+		return 0;
+	}
+
+	switch (framebuffer->type) {
+	case GL_UNSIGNED_BYTE:
+		return components;
+
+	case GL_HALF_FLOAT_OES:
+		return components * 2;
+
+	case GL_UNSIGNED_SHORT_5_6_5:
+	case GL_UNSIGNED_SHORT_4_4_4_4:
+	case GL_UNSIGNED_SHORT_5_5_5_1:
+		return 2;
+
+	case GL_UNSIGNED_INT_2_10_10_10_REV_EXT:
+		return 4;
+	}
+
+	return 0;
+}
+
+static const struct framebuffer_format framebuffer_formats[] = {
+	{ "rgb565", GL_RGB, GL_UNSIGNED_SHORT_5_6_5, NULL },
+	{ "rgba4444", GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4, NULL },
+	{ "rgb8", GL_RGB, GL_UNSIGNED_BYTE, NULL },
+	{ "rgba8", GL_RGBA, GL_UNSIGNED_BYTE, NULL },
+	{ "rgb10a2", GL_RGBA, GL_UNSIGNED_INT_2_10_10_10_REV_EXT,
+	  "GL_EXT_texture_type_2_10_10_10_REV" },
+	{ "rgba16f", GL_RGBA, GL_HALF_FLOAT_OES, "GL_OES_texture_half_float" },
+};
+
+const struct framebuffer_format *framebuffer_format_find(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(framebuffer_formats); i++)
+		if (strcmp(framebuffer_formats[i].name, name) == 0)
+			return &framebuffer_formats[i];
+
+	return NULL;
+}
+
 struct framebuffer *display_framebuffer_new(unsigned int width,
 					    unsigned int height)
 {
@@ -122,6 +213,69 @@ void display_framebuffer_free(struct framebuffer *framebuffer)
 
 /* EGL implementation */
 
+static bool extension_list_contains(const char *extensions,
+				    const char *name)
+{
+	size_t length = strlen(name);
+	const char *start, *end;
+
+	if (!extensions)
+		return false;
+
+	start = extensions;
+
+	while ((start = strstr(start, name)) != NULL) {
+		end = start + length;
+
+		if ((start == extensions || start[-1] == ' ') &&
+		    (*end == ' ' || *end == '\0'))
+			return true;
+
+		start = end;
+	}
+
+	return false;
+}
+
+bool gles_egl_has_extension(struct gles *gles, const char *name)
+{
+	const char *extensions;
+
+	extensions = eglQueryString(gles->egl.display, EGL_EXTENSIONS);
+
+	return extension_list_contains(extensions, name);
+}
+
+bool gles_has_extension(struct gles *gles, const char *name)
+{
+	const char *extensions;
+
+	extensions = (const char *)glGetString(GL_EXTENSIONS);
+
+	return extension_list_contains(extensions, name);
+}
+
+/*
+ * The extensions only guarantee that textures of a format can be sampled,
+ * so check that they can be rendered to as well.
+ */
+bool gles_framebuffer_format_supported(struct gles *gles,
+				       const struct framebuffer_format *format)
+{
+	struct framebuffer *framebuffer;
+
+	if (format->extension && !gles_has_extension(gles, format->extension))
+		return false;
+
+	framebuffer = framebuffer_new_format(1, 1, format->format,
+					     format->type);
+	if (!framebuffer)
+		return false;
+
+	framebuffer_free(framebuffer);
+	return true;
+}
+
 static int gles_egl_init(struct gles *gles)
 {
 	const EGLint config_attribs[] = {
@@ -179,6 +333,26 @@ static int gles_egl_init(struct gles *gles)
 		return -1;
 	}
 
+	if (gles_egl_has_extension(gles, "EGL_KHR_fence_sync")) {
+		gles->egl.create_sync = (PFNEGLCREATESYNCKHRPROC)
+			eglGetProcAddress("eglCreateSyncKHR");
+		gles->egl.destroy_sync = (PFNEGLDESTROYSYNCKHRPROC)
+			eglGetProcAddress("eglDestroySyncKHR");
+		gles->egl.client_wait_sync = (PFNEGLCLIENTWAITSYNCKHRPROC)
+			eglGetProcAddress("eglClientWaitSyncKHR");
+	}
+
+	if (gles_egl_has_extension(gles, "EGL_KHR_image_base") &&
+	    gles_has_extension(gles, "GL_OES_EGL_image")) {
+		gles->egl.create_image = (PFNEGLCREATEIMAGEKHRPROC)
+			eglGetProcAddress("eglCreateImageKHR");
+		gles->egl.destroy_image = (PFNEGLDESTROYIMAGEKHRPROC)
+			eglGetProcAddress("eglDestroyImageKHR");
+		gles->egl.image_target_texture =
+			(PFNGLEGLIMAGETARGETTEXTURE2DOESPROC)
+			eglGetProcAddress("glEGLImageTargetTexture2DOES");
+	}
+
 	return 0;
 }
 
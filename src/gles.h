@@ -25,12 +25,25 @@
 #include <stdbool.h>
 
 #include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
 #include <EGL/egl.h>
+#include <EGL/eglext.h>
 
 #include <X11/Xlib.h>
 
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
 
+/*
+ * Fragment shader preamble selecting highp precision, which is optional in
+ * GLES2, where it is supported and mediump elsewhere.
+ */
+#define GLSL_PRECISION_HIGH \
+	"#ifdef GL_FRAGMENT_PRECISION_HIGH\n" \
+	"precision highp float;\n" \
+	"#else\n" \
+	"precision mediump float;\n" \
+	"#endif\n"
+
 enum glsl_program_type {
 	GLSL_PROGRAM_DEINT_LINEAR,
 	GLSL_PROGRAM_COPY,
@@ -75,11 +88,31 @@ struct framebuffer {
 	GLuint id;
 	GLuint width;
 	GLuint height;
+	GLenum format;
+	GLenum type;
 	struct texture *texture;
+
+	/* incremented whenever the contents change */
+	unsigned int generation;
 };
 
 struct framebuffer *framebuffer_new(unsigned int width, unsigned int height);
+struct framebuffer *framebuffer_new_format(unsigned int width,
+					   unsigned int height,
+					   GLenum format, GLenum type);
 void framebuffer_free(struct framebuffer *framebuffer);
+unsigned int framebuffer_bytes_per_pixel(const struct framebuffer *framebuffer);
+
+struct framebuffer_format {
+	const char *name;
+	GLenum format;
+	GLenum type;
+
+	/* extension required for textures of this format, if any */
+	const char *extension;
+};
+
+const struct framebuffer_format *framebuffer_format_find(const char *name);
 
 struct framebuffer *display_framebuffer_new(unsigned int width,
 					    unsigned int height);
@@ -100,6 +133,16 @@ struct gles {
 		EGLDisplay display;
 		EGLSurface surface;
 		EGLContext context;
+
+		/* EGL_KHR_fence_sync */
+		PFNEGLCREATESYNCKHRPROC create_sync;
+		PFNEGLDESTROYSYNCKHRPROC destroy_sync;
+		PFNEGLCLIENTWAITSYNCKHRPROC client_wait_sync;
+
+		/* EGL_KHR_image_base, GL_OES_EGL_image */
+		PFNEGLCREATEIMAGEKHRPROC create_image;
+		PFNEGLDESTROYIMAGEKHRPROC destroy_image;
+		PFNGLEGLIMAGETARGETTEXTURE2DOESPROC image_target_texture;
 	} egl;
 
 	/* properties */
@@ -119,5 +162,9 @@ struct gles {
 
 struct gles *gles_new(unsigned int depth, bool regenerate);
 void gles_free(struct gles *gles);
+bool gles_egl_has_extension(struct gles *gles, const char *name);
+bool gles_has_extension(struct gles *gles, const char *name);
+bool gles_framebuffer_format_supported(struct gles *gles,
+				       const struct framebuffer_format *format);
 
 #endif
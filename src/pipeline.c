@@ -17,17 +17,436 @@
  * Boston, MA 02111-1307, USA.
  */
 
+#include <limits.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "pipeline.h"
 #include "gles.h"
 
+#define PIPELINE_UNSCHEDULED UINT_MAX
+
+static uint64_t pipeline_get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
 void pipeline_stage_free(struct pipeline_stage *stage)
 {
-	if (stage && stage->release)
+	if (!stage)
+		return;
+
+	free(stage->label);
+
+	if (stage->release)
 		stage->release(stage);
 }
 
+int pipeline_stage_connect(struct pipeline_stage *stage, unsigned int input,
+			   struct pipeline_stage *producer)
+{
+	if (input >= stage->num_inputs)
+		return -1;
+
+	stage->inputs[input] = producer;
+
+	return 0;
+}
+
+static bool pipeline_stage_consumes(struct pipeline_stage *stage,
+				    struct pipeline_stage *producer)
+{
+	unsigned int i;
+
+	for (i = 0; i < stage->num_inputs; i++)
+		if (stage->inputs[i] == producer)
+			return true;
+
+	return false;
+}
+
+static bool pipeline_stage_ready(struct pipeline_stage *stage)
+{
+	unsigned int i;
+
+	if (stage->position != PIPELINE_UNSCHEDULED)
+		return false;
+
+	for (i = 0; i < stage->num_inputs; i++) {
+		struct pipeline_stage *producer = stage->inputs[i];
+
+		if (producer && producer->position == PIPELINE_UNSCHEDULED)
+			return false;
+	}
+
+	return true;
+}
+
+static bool pipeline_stage_changed(struct pipeline_stage *stage)
+{
+	unsigned int i;
+
+	if (!stage->cacheable || !stage->rendered)
+		return true;
+
+	for (i = 0; i < stage->num_inputs; i++)
+		if (stage->sources[i]->generation != stage->generations[i])
+			return true;
+
+	return false;
+}
+
+static const struct framebuffer_format *
+pipeline_stage_format(struct pipeline_stage *stage)
+{
+	return stage->format ? stage->format : stage->pipeline->format;
+}
+
+/*
+ * Private framebuffers of a stage, such as those of intermediate passes,
+ * use the format of its output.
+ */
+struct framebuffer *pipeline_stage_framebuffer_new(struct pipeline_stage *stage,
+						   unsigned int width,
+						   unsigned int height)
+{
+	const struct framebuffer_format *format = pipeline_stage_format(stage);
+
+	return framebuffer_new_format(width, height, format->format,
+				      format->type);
+}
+
+/*
+ * Stages rendering in multiple passes must use this to switch between
+ * their private framebuffers and the target.
+ */
+void pipeline_bind_framebuffer(struct pipeline *pipeline,
+			       struct framebuffer *framebuffer)
+{
+	if (pipeline->bound != framebuffer) {
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer->id);
+		glViewport(0, 0, framebuffer->width, framebuffer->height);
+		pipeline->bound = framebuffer;
+	}
+}
+
+/*
+ * Read back the lower left part of a framebuffer as RGBA bytes. Reading
+ * blocks until the rendering has completed, the time spent waiting is
+ * accounted as a stall of the pipeline.
+ */
+void pipeline_read_pixels(struct pipeline *pipeline,
+			  struct framebuffer *framebuffer, unsigned int width,
+			  unsigned int height, void *data)
+{
+	uint64_t start, stall;
+
+	pipeline_bind_framebuffer(pipeline, framebuffer);
+
+	start = pipeline_get_time();
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, data);
+	stall = pipeline_get_time() - start;
+
+	if (stall > pipeline->readback_max)
+		pipeline->readback_max = stall;
+
+	pipeline->readback_total += stall;
+	pipeline->readback_bytes += width * height * 4;
+	pipeline->readback_count++;
+}
+
+/*
+ * Upload 8-bit texels to the currently bound texture, either reallocating
+ * its storage or replacing its contents. The upload blocks for as long as
+ * the driver needs to copy the data, and until the GPU is done with the
+ * texture if the driver can't rename it, which is accounted as a stall.
+ */
+void pipeline_upload(struct pipeline *pipeline, bool allocate,
+		     unsigned int width, unsigned int height, GLenum format,
+		     const void *data)
+{
+	unsigned int bpp = 4;
+	uint64_t start, stall;
+
+	switch (format) {
+	case GL_LUMINANCE:
+	case GL_ALPHA:
+		bpp = 1;
+		break;
+
+	case GL_LUMINANCE_ALPHA:
+		bpp = 2;
+		break;
+
+	case GL_RGB:
+		bpp = 3;
+		break;
+	}
+
+	start = pipeline_get_time();
+
+	if (allocate)
+		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0,
+			     format, GL_UNSIGNED_BYTE, data);
+	else
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height,
+				format, GL_UNSIGNED_BYTE, data);
+
+	stall = pipeline_get_time() - start;
+
+	if (stall > pipeline->upload_max)
+		pipeline->upload_max = stall;
+
+	pipeline->upload_total += stall;
+	pipeline->upload_bytes += width * height * bpp;
+	pipeline->upload_count++;
+}
+
+static const struct region region_full = { 0.0f, 0.0f, 1.0f, 1.0f };
+
+/*
+ * Compute the region of the output that needs to be rendered. Only
+ * stages that still hold their previous output in the target can be
+ * rendered partially. That's not the case when the target is shared with
+ * another stage, nor for the display unless its contents are preserved
+ * across buffer swaps.
+ */
+static void pipeline_stage_get_damage(struct pipeline_stage *stage,
+				      struct region *region)
+{
+	struct pipeline *pipeline = stage->pipeline;
+	unsigned int i;
+
+	*region = region_full;
+
+	if (!pipeline->partial || !stage->footprint || !stage->rendered)
+		return;
+
+	if (stage->target->generation != stage->generation)
+		return;
+
+	if (stage->target == pipeline->display && !pipeline->preserved)
+		return;
+
+	region->x0 = region->y0 = 1.0f;
+	region->x1 = region->y1 = 0.0f;
+
+	for (i = 0; i < stage->num_inputs; i++) {
+		struct pipeline_stage *producer = stage->inputs[i];
+
+		if (producer)
+			region_union(region, &producer->damage);
+	}
+
+	stage->footprint(stage, region);
+}
+
+/* render the given region of the output, clipping to it if needed */
+static void pipeline_stage_draw(struct pipeline_stage *stage,
+				const struct region *region)
+{
+	struct pipeline *pipeline = stage->pipeline;
+	struct framebuffer *target = stage->target;
+	unsigned long long pixels;
+	bool scissor;
+
+	pixels = target->width * target->height;
+
+	pipeline_bind_framebuffer(pipeline, target);
+
+	scissor = region->x0 > 0.0f || region->y0 > 0.0f ||
+		  region->x1 < 1.0f || region->y1 < 1.0f;
+	if (scissor) {
+		GLint x0 = region->x0 * target->width;
+		GLint y0 = region->y0 * target->height;
+		GLint x1 = region->x1 * target->width + 0.999f;
+		GLint y1 = region->y1 * target->height + 0.999f;
+
+		glEnable(GL_SCISSOR_TEST);
+		glScissor(x0, y0, x1 - x0, y1 - y0);
+		pixels = (x1 - x0) * (y1 - y0);
+	}
+
+	stage->render(stage);
+
+	if (scissor)
+		glDisable(GL_SCISSOR_TEST);
+
+	stage->generation = ++target->generation;
+	stage->rendered = true;
+	pipeline->pixels_shaded += pixels;
+	pipeline->bytes_written += pixels *
+				   framebuffer_bytes_per_pixel(target);
+}
+
+static void pipeline_stage_render(struct pipeline_stage *stage)
+{
+	struct pipeline *pipeline = stage->pipeline;
+	struct framebuffer *target = stage->target;
+	struct region damage;
+	unsigned int i;
+
+	if (!target) {
+		for (i = 0; i < stage->num_inputs; i++)
+			stage->generations[i] = stage->sources[i]->generation;
+
+		pipeline->renders++;
+		stage->render(stage);
+		stage->rendered = true;
+		return;
+	}
+
+	if (!pipeline_stage_changed(stage)) {
+		stage->damage.x0 = stage->damage.x1 = 0.0f;
+		stage->damage.y0 = stage->damage.y1 = 0.0f;
+		pipeline->reuses++;
+		return;
+	}
+
+	pipeline_stage_get_damage(stage, &damage);
+	stage->damage = damage;
+
+	for (i = 0; i < stage->num_inputs; i++)
+		stage->generations[i] = stage->sources[i]->generation;
+
+	pipeline->pixels_total += target->width * target->height;
+	pipeline->renders++;
+
+	if (region_is_empty(&damage))
+		return;
+
+	pipeline_stage_draw(stage, &damage);
+}
+
+/*
+ * Propagate the region of the display covered by a tile back through the
+ * pipeline, to determine which part of each output the tile depends on.
+ * Stages that can't be rendered in parts need their inputs completely,
+ * until they have been rendered for the frame.
+ */
+static void pipeline_tile_reach(struct pipeline *pipeline,
+				const struct region *tile)
+{
+	struct pipeline_stage *stage;
+	unsigned int i;
+
+	for (stage = pipeline->first; stage; stage = stage->next) {
+		stage->need.x0 = stage->need.y0 = 1.0f;
+		stage->need.x1 = stage->need.y1 = 0.0f;
+
+		if (stage->terminal)
+			stage->need = region_full;
+	}
+
+	pipeline->sink->need = *tile;
+
+	for (stage = pipeline->last; stage; stage = stage->prev) {
+		struct region reach = stage->need;
+
+		if (region_is_empty(&reach))
+			continue;
+
+		if (!stage->tileable) {
+			if (stage->drawn)
+				continue;
+
+			reach = region_full;
+		} else if (stage->num_inputs > 0) {
+			stage->reach(stage, &reach);
+		}
+
+		for (i = 0; i < stage->num_inputs; i++) {
+			struct pipeline_stage *producer = stage->inputs[i];
+			struct region halo = reach;
+
+			if (!producer)
+				continue;
+
+			/* bilinear filtering reads one more texel */
+			region_grow(&halo, 1.0f / producer->width,
+				    1.0f / producer->height);
+			region_union(&producer->need, &halo);
+		}
+	}
+}
+
+/*
+ * Render the part of a stage needed for the current tile. Stages that
+ * can't be rendered in parts are rendered completely for the first tile
+ * that needs them.
+ */
+static void pipeline_tile_render(struct pipeline_stage *stage)
+{
+	struct pipeline *pipeline = stage->pipeline;
+	struct framebuffer *target = stage->target;
+
+	if (region_is_empty(&stage->need))
+		return;
+
+	if (stage->drawn && !stage->tileable)
+		return;
+
+	if (!stage->drawn) {
+		if (target)
+			pipeline->pixels_total += target->width *
+						  target->height;
+
+		pipeline->renders++;
+	}
+
+	if (!target) {
+		stage->render(stage);
+		stage->rendered = true;
+	} else if (stage->tileable) {
+		pipeline_stage_draw(stage, &stage->need);
+	} else {
+		pipeline_stage_draw(stage, &region_full);
+	}
+
+	stage->drawn = true;
+}
+
+/*
+ * Run the complete pipeline for one tile of the display after the other,
+ * so that the intermediate results of a tile can stay in the caches until
+ * they are consumed.
+ */
+static void pipeline_render_tiled(struct pipeline *pipeline)
+{
+	unsigned int width = pipeline->display->width;
+	unsigned int height = pipeline->display->height;
+	unsigned int size = pipeline->tile_size;
+	struct pipeline_stage *stage;
+	struct region tile;
+	unsigned int x, y;
+
+	for (stage = pipeline->first; stage; stage = stage->next)
+		stage->drawn = false;
+
+	for (y = 0; y < height; y += size) {
+		for (x = 0; x < width; x += size) {
+			tile.x0 = (GLfloat)x / width;
+			tile.y0 = (GLfloat)y / height;
+			tile.x1 = x + size < width ?
+				  (GLfloat)(x + size) / width : 1.0f;
+			tile.y1 = y + size < height ?
+				  (GLfloat)(y + size) / height : 1.0f;
+
+			pipeline_tile_reach(pipeline, &tile);
+
+			for (stage = pipeline->first; stage;
+			     stage = stage->next)
+				pipeline_tile_render(stage);
+		}
+	}
+}
+
 struct pipeline *pipeline_new(struct gles *gles)
 {
 	struct pipeline *pipeline;
@@ -36,6 +455,14 @@ struct pipeline *pipeline_new(struct gles *gles)
 	if (!pipeline)
 		return NULL;
 
+	pipeline->display = display_framebuffer_new(gles->width, gles->height);
+	if (!pipeline->display) {
+		free(pipeline);
+		return NULL;
+	}
+
+	pipeline->format = framebuffer_format_find("rgb8");
+	pipeline->optimize = true;
 	pipeline->gles = gles;
 
 	return pipeline;
@@ -44,6 +471,10 @@ struct pipeline *pipeline_new(struct gles *gles)
 void pipeline_free(struct pipeline *pipeline)
 {
 	struct pipeline_stage *stage = pipeline->first;
+	unsigned int i;
+
+	pipeline_finish(pipeline);
+	free(pipeline->fences);
 
 	while (stage) {
 		struct pipeline_stage *next = stage->next;
@@ -51,6 +482,11 @@ void pipeline_free(struct pipeline *pipeline)
 		stage = next;
 	}
 
+	for (i = 0; i < pipeline->num_framebuffers; i++)
+		framebuffer_free(pipeline->framebuffers[i]);
+
+	display_framebuffer_free(pipeline->display);
+	free(pipeline->framebuffers);
 	free(pipeline);
 }
 
@@ -59,24 +495,574 @@ void pipeline_add_stage(struct pipeline *pipeline, struct pipeline_stage *stage)
 	if (pipeline->first == NULL && pipeline->last == NULL) {
 		pipeline->first = stage;
 		pipeline->last = stage;
+		stage->prev = NULL;
 	} else {
 		pipeline->last->next = stage;
+		stage->prev = pipeline->last;
 		pipeline->last = stage;
 	}
 
+	stage->index = pipeline->num_stages++;
 	stage->pipeline = pipeline;
 	stage->next = NULL;
+
+	/* the most recently added stage with an output renders to the display */
+	if (!stage->terminal)
+		pipeline->sink = stage;
+}
+
+struct pipeline_stage *pipeline_find_stage(struct pipeline *pipeline,
+					   const char *label)
+{
+	struct pipeline_stage *stage;
+
+	for (stage = pipeline->first; stage; stage = stage->next)
+		if (stage->label && strcmp(stage->label, label) == 0)
+			return stage;
+
+	return NULL;
+}
+
+static void pipeline_remove_stage(struct pipeline *pipeline,
+				  struct pipeline_stage *stage)
+{
+	if (stage->prev)
+		stage->prev->next = stage->next;
+	else
+		pipeline->first = stage->next;
+
+	if (stage->next)
+		stage->next->prev = stage->prev;
+	else
+		pipeline->last = stage->prev;
+
+	pipeline->num_stages--;
+	pipeline_stage_free(stage);
+}
+
+static void pipeline_stage_mark_live(struct pipeline_stage *stage)
+{
+	unsigned int i;
+
+	if (stage->live)
+		return;
+
+	stage->live = true;
+
+	for (i = 0; i < stage->num_inputs; i++)
+		if (stage->inputs[i])
+			pipeline_stage_mark_live(stage->inputs[i]);
+}
+
+/*
+ * Remove stages that don't contribute to the output. Stages that pass one
+ * of their inputs through unmodified (identity color corrections, copies
+ * to intermediate framebuffers, ...) are bypassed by connecting their
+ * consumers directly to that input, after which they are unused as well.
+ * Stages whose output is never read, for example because it is overwritten
+ * by a generator later on, are dropped.
+ */
+static void pipeline_optimize(struct pipeline *pipeline)
+{
+	struct pipeline_stage *stage, *other, *next;
+	unsigned int removed = 0, i;
+
+	for (stage = pipeline->first; stage; stage = stage->next) {
+		struct pipeline_stage *producer;
+		int input;
+
+		if (stage == pipeline->sink || stage->terminal ||
+		    !stage->identity)
+			continue;
+
+		/* converting the format or resolution isn't an identity */
+		if (stage->format || stage->resolution > 0.0f)
+			continue;
+
+		input = stage->identity(stage);
+		if (input < 0)
+			continue;
+
+		producer = stage->inputs[input];
+
+		for (other = pipeline->first; other; other = other->next)
+			for (i = 0; i < other->num_inputs; i++)
+				if (other->inputs[i] == stage)
+					other->inputs[i] = producer;
+
+		printf("Optimizer: bypassing identity %s\n", stage->name);
+	}
+
+	for (stage = pipeline->first; stage; stage = stage->next)
+		stage->live = false;
+
+	/* terminal stages have side-effects and are roots like the sink */
+	for (stage = pipeline->first; stage; stage = stage->next)
+		if (stage == pipeline->sink || stage->terminal)
+			pipeline_stage_mark_live(stage);
+
+	for (stage = pipeline->first; stage; stage = next) {
+		next = stage->next;
+
+		if (!stage->live) {
+			printf("Optimizer: removing unused %s\n", stage->name);
+			pipeline_remove_stage(pipeline, stage);
+			removed++;
+		}
+	}
+
+	/* keep the stage indices contiguous for the scheduler */
+	for (stage = pipeline->first, i = 0; stage; stage = stage->next)
+		stage->index = i++;
+
+	printf("Optimizer: removed %u stages\n", removed);
+}
+
+/*
+ * Sort the stages topologically. Among the stages that are ready to run,
+ * the ones consuming the output of the previously scheduled stage are
+ * preferred, so that a branch is completed before the next one starts.
+ * This keeps the number of live framebuffers low and avoids switching
+ * back and forth between the render targets of independent branches.
+ */
+static int pipeline_schedule(struct pipeline *pipeline)
+{
+	struct pipeline_stage **stages, **order, *stage, *previous = NULL;
+	unsigned int count = pipeline->num_stages, i, j;
+
+	stages = calloc(count, sizeof(*stages));
+	if (!stages)
+		return -1;
+
+	order = calloc(count, sizeof(*order));
+	if (!order) {
+		free(stages);
+		return -1;
+	}
+
+	for (stage = pipeline->first; stage; stage = stage->next) {
+		stage->position = PIPELINE_UNSCHEDULED;
+		stages[stage->index] = stage;
+	}
+
+	for (i = 0; i < count; i++) {
+		struct pipeline_stage *next = NULL;
+
+		for (j = 0; j < count; j++) {
+			if (!pipeline_stage_ready(stages[j]))
+				continue;
+
+			if (previous &&
+			    pipeline_stage_consumes(stages[j], previous)) {
+				next = stages[j];
+				break;
+			}
+
+			if (!next)
+				next = stages[j];
+		}
+
+		if (!next) {
+			fprintf(stderr, "pipeline contains a cycle\n");
+			free(order);
+			free(stages);
+			return -1;
+		}
+
+		next->position = i;
+		order[i] = previous = next;
+	}
+
+	for (i = 0; i < count; i++) {
+		order[i]->prev = i > 0 ? order[i - 1] : NULL;
+		order[i]->next = i < count - 1 ? order[i + 1] : NULL;
+	}
+
+	pipeline->first = order[0];
+	pipeline->last = order[count - 1];
+
+	free(order);
+	free(stages);
+	return 0;
+}
+
+/*
+ * Determine for each stage at which position in the schedule its output
+ * is read for the last time. After that point the framebuffer holding the
+ * output can be reused by another stage.
+ *
+ * Pure stages that depend only on other pure stages can be served from
+ * cache. Their outputs are kept in dedicated framebuffers. The display is
+ * invalidated by every swap, so the sink is always rendered.
+ */
+static void pipeline_analyze(struct pipeline *pipeline)
+{
+	struct pipeline_stage *stage;
+	unsigned int i;
+
+	for (stage = pipeline->first; stage; stage = stage->next) {
+		stage->last_use = stage->position;
+
+		stage->cacheable = !stage->stateful && !stage->terminal &&
+				   !pipeline->regenerate &&
+				   !pipeline->tile_size &&
+				   stage != pipeline->sink;
+
+		/* stateful stages must be rendered once per frame */
+		stage->tileable = !stage->stateful && !stage->terminal &&
+				  (stage->num_inputs == 0 || stage->reach);
+
+		for (i = 0; i < stage->num_inputs; i++) {
+			struct pipeline_stage *producer = stage->inputs[i];
+
+			if (producer && !producer->cacheable)
+				stage->cacheable = false;
+		}
+	}
+
+	for (stage = pipeline->first; stage; stage = stage->next) {
+		for (i = 0; i < stage->num_inputs; i++) {
+			struct pipeline_stage *producer = stage->inputs[i];
+
+			if (!producer)
+				continue;
+
+			if (stage->position > producer->last_use)
+				producer->last_use = stage->position;
+		}
+	}
+}
+
+/*
+ * Propagate the output sizes through the pipeline in schedule order, so
+ * that the producers have been sized before their consumers.
+ */
+static void pipeline_stage_size(struct pipeline_stage *stage)
+{
+	struct pipeline *pipeline = stage->pipeline;
+	struct pipeline_stage *producer = stage->inputs[0];
+
+	if (stage == pipeline->sink || stage->num_inputs == 0 ||
+	    stage->resolution > 0.0f) {
+		stage->width = pipeline->display->width;
+		stage->height = pipeline->display->height;
+	} else if (producer) {
+		stage->width = producer->width;
+		stage->height = producer->height;
+	} else {
+		stage->width = pipeline->source->width;
+		stage->height = pipeline->source->height;
+	}
+
+	if (stage != pipeline->sink && stage->resolution > 0.0f) {
+		stage->width = stage->width * stage->resolution + 0.5f;
+		stage->height = stage->height * stage->resolution + 0.5f;
+
+		if (stage->width < 1)
+			stage->width = 1;
+
+		if (stage->height < 1)
+			stage->height = 1;
+	}
+
+	if (stage != pipeline->sink && stage->output_size)
+		stage->output_size(stage, &stage->width, &stage->height);
+}
+
+static int pipeline_allocate(struct pipeline *pipeline)
+{
+	struct pipeline_stage *stage;
+	unsigned int *busy, i;
+
+	pipeline->framebuffers = calloc(pipeline->num_stages,
+					sizeof(*pipeline->framebuffers));
+	if (!pipeline->framebuffers)
+		return -1;
+
+	/* schedule position up to which each framebuffer is in use */
+	busy = calloc(pipeline->num_stages, sizeof(*busy));
+	if (!busy)
+		return -1;
+
+	for (stage = pipeline->first; stage; stage = stage->next) {
+		const struct framebuffer_format *format;
+
+		pipeline_stage_size(stage);
+
+		if (stage->terminal) {
+			stage->target = NULL;
+			continue;
+		}
+
+		if (stage == pipeline->sink) {
+			stage->target = pipeline->display;
+			continue;
+		}
+
+		format = pipeline_stage_format(stage);
+
+		/* reuse a framebuffer of the same size that is free again */
+		for (i = 0; i < pipeline->num_framebuffers; i++) {
+			struct framebuffer *framebuffer;
+
+			framebuffer = pipeline->framebuffers[i];
+
+			if (busy[i] < stage->position &&
+			    framebuffer->width == stage->width &&
+			    framebuffer->height == stage->height &&
+			    framebuffer->format == format->format &&
+			    framebuffer->type == format->type)
+				break;
+		}
+
+		if (i == pipeline->num_framebuffers) {
+			struct framebuffer *framebuffer;
+
+			framebuffer = framebuffer_new_format(stage->width,
+							     stage->height,
+							     format->format,
+							     format->type);
+			if (!framebuffer) {
+				fprintf(stderr, "%s: failed to create %s "
+					"framebuffer\n", stage->name,
+					format->name);
+				free(busy);
+				return -1;
+			}
+
+			pipeline->framebuffers[pipeline->num_framebuffers++] =
+				framebuffer;
+		}
+
+		/*
+		 * Cached outputs must never be overwritten, and partially
+		 * rendered ones need their previous contents. Tiles render
+		 * parts of all outputs in turn, so they can't share either.
+		 */
+		if (stage->cacheable || pipeline->partial ||
+		    pipeline->tile_size)
+			busy[i] = UINT_MAX;
+		else
+			busy[i] = stage->last_use;
+
+		stage->target = pipeline->framebuffers[i];
+
+		pipeline->texels += stage->width * stage->height;
+		pipeline->texels_full += pipeline->display->width *
+					 pipeline->display->height;
+	}
+
+	for (stage = pipeline->first; stage; stage = stage->next) {
+		for (i = 0; i < stage->num_inputs; i++) {
+			struct pipeline_stage *producer = stage->inputs[i];
+
+			if (producer)
+				stage->sources[i] = producer->target;
+			else
+				stage->sources[i] = pipeline->source;
+		}
+	}
+
+	free(busy);
+	return 0;
+}
+
+int pipeline_prepare(struct pipeline *pipeline)
+{
+	unsigned long long bytes = 0;
+	struct pipeline_stage *stage;
+	unsigned int i;
+
+	if (!pipeline->first) {
+		fprintf(stderr, "pipeline is empty\n");
+		return -1;
+	}
+
+	if (!pipeline->sink) {
+		fprintf(stderr, "pipeline has no stage rendering to the display\n");
+		return -1;
+	}
+
+	for (stage = pipeline->first; stage; stage = stage->next) {
+		for (i = 0; i < stage->num_inputs; i++) {
+			struct pipeline_stage *producer = stage->inputs[i];
+
+			if (producer && producer->terminal) {
+				fprintf(stderr, "%s: %s has no output\n",
+					stage->name, producer->name);
+				return -1;
+			}
+		}
+	}
+
+	if (pipeline->tile_size && pipeline->partial) {
+		printf("Partial rendering not supported with tiles, "
+		       "disabling\n");
+		pipeline->partial = false;
+	}
+
+	if (pipeline->optimize)
+		pipeline_optimize(pipeline);
+
+	if (pipeline_schedule(pipeline) < 0)
+		return -1;
+
+	pipeline_analyze(pipeline);
+
+	if (pipeline_allocate(pipeline) < 0)
+		return -1;
+
+	for (i = 0; i < pipeline->num_framebuffers; i++) {
+		struct framebuffer *framebuffer = pipeline->framebuffers[i];
+
+		bytes += framebuffer->width * framebuffer->height *
+			 framebuffer_bytes_per_pixel(framebuffer);
+	}
+
+	printf("Pipeline: %u stages, %u intermediate framebuffers (%.02f MiB)\n",
+	       pipeline->num_stages, pipeline->num_framebuffers,
+	       bytes / 1048576.0);
+
+	if (pipeline->tile_size) {
+		unsigned int tileable = 0;
+
+		for (stage = pipeline->first; stage; stage = stage->next)
+			if (stage->tileable)
+				tileable++;
+
+		printf("Tiles: %u pixels, %u of %u stages rendered per tile\n",
+		       pipeline->tile_size, tileable, pipeline->num_stages);
+	}
+
+	if (pipeline->texels < pipeline->texels_full)
+		printf("Intermediate texels: %llu, %.02f%% of full resolution\n",
+		       pipeline->texels,
+		       pipeline->texels * 100.0 / pipeline->texels_full);
+
+	if (pipeline->frames_in_flight > 0) {
+		struct gles *gles = pipeline->gles;
+
+		if (!gles->egl.create_sync) {
+			printf("EGL_KHR_fence_sync not supported, leaving "
+			       "frame throttling to the driver\n");
+			pipeline->frames_in_flight = 0;
+		} else {
+			pipeline->fences = calloc(pipeline->frames_in_flight,
+						  sizeof(*pipeline->fences));
+			if (!pipeline->fences)
+				return -1;
+		}
+	}
+
+	if (pipeline->partial) {
+		struct gles *gles = pipeline->gles;
+
+		pipeline->preserved = eglSurfaceAttrib(gles->egl.display,
+						       gles->egl.surface,
+						       EGL_SWAP_BEHAVIOR,
+						       EGL_BUFFER_PRESERVED);
+		if (!pipeline->preserved)
+			printf("Display contents not preserved across swaps, "
+			       "rendering final stage completely\n");
+	}
+
+	return 0;
+}
+
+/*
+ * Retire the fences of completed frames, oldest first, and record their
+ * latency. Blocks until no more than the given number of frames are in
+ * flight.
+ *
+ * Fences that have already signalled are only noticed when they are
+ * polled at the start of a later frame, so the latency recorded for them
+ * can be up to a frame longer than the actual one. Only the blocking
+ * waits observe the fence as it signals.
+ */
+static void pipeline_retire_frames(struct pipeline *pipeline,
+				   unsigned int pending)
+{
+	struct gles *gles = pipeline->gles;
+
+	while (pipeline->num_fences > 0) {
+		struct pipeline_fence *fence;
+		EGLTimeKHR timeout = 0;
+		uint64_t latency;
+		EGLint status;
+
+		fence = &pipeline->fences[pipeline->fence_head];
+
+		if (pipeline->num_fences > pending)
+			timeout = EGL_FOREVER_KHR;
+
+		status = gles->egl.client_wait_sync(gles->egl.display,
+						    fence->sync,
+						    EGL_SYNC_FLUSH_COMMANDS_BIT_KHR,
+						    timeout);
+		if (status == EGL_TIMEOUT_EXPIRED_KHR)
+			break;
+
+		if (status == EGL_CONDITION_SATISFIED_KHR) {
+			latency = pipeline_get_time() - fence->start;
+
+			if (pipeline->latency_count == 0 ||
+			    latency < pipeline->latency_min)
+				pipeline->latency_min = latency;
+
+			if (latency > pipeline->latency_max)
+				pipeline->latency_max = latency;
+
+			pipeline->latency_total += latency;
+			pipeline->latency_count++;
+		}
+
+		gles->egl.destroy_sync(gles->egl.display, fence->sync);
+
+		pipeline->fence_head = (pipeline->fence_head + 1) %
+				       pipeline->frames_in_flight;
+		pipeline->num_fences--;
+	}
 }
 
 void pipeline_render(struct pipeline *pipeline)
 {
 	struct gles *gles = pipeline->gles;
 	struct pipeline_stage *stage;
+	uint64_t start;
 
-	glViewport(0, 0, gles->width, gles->height);
+	if (pipeline->fences)
+		pipeline_retire_frames(pipeline,
+				       pipeline->frames_in_flight - 1);
 
-	for (stage = pipeline->first; stage; stage = stage->next)
-		stage->render(stage);
+	start = pipeline_get_time();
+
+	if (pipeline->tile_size) {
+		pipeline_render_tiled(pipeline);
+	} else {
+		for (stage = pipeline->first; stage; stage = stage->next)
+			pipeline_stage_render(stage);
+	}
 
 	eglSwapBuffers(gles->egl.display, gles->egl.surface);
+
+	if (pipeline->fences) {
+		unsigned int tail = (pipeline->fence_head +
+				     pipeline->num_fences) %
+				    pipeline->frames_in_flight;
+		struct pipeline_fence *fence = &pipeline->fences[tail];
+
+		fence->sync = gles->egl.create_sync(gles->egl.display,
+						    EGL_SYNC_FENCE_KHR, NULL);
+		if (fence->sync != EGL_NO_SYNC_KHR) {
+			fence->start = start;
+			pipeline->num_fences++;
+		}
+	}
+}
+
+/* wait for all frames in flight to complete */
+void pipeline_finish(struct pipeline *pipeline)
+{
+	if (pipeline->fences)
+		pipeline_retire_frames(pipeline, 0);
 }
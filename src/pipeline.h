@@ -20,12 +20,23 @@
 #ifndef GLES_TESTBENCH_PIPELINE_H
 #define GLES_TESTBENCH_PIPELINE_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include <GLES2/gl2.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "geometry.h"
+
+#define PIPELINE_STAGE_MAX_INPUTS 4
 
 struct framebuffer;
+struct framebuffer_format;
 struct pipeline;
 struct geometry;
 struct gles;
+struct video_file;
 
 struct pipeline_stage {
 	const char *name;
@@ -33,6 +44,98 @@ struct pipeline_stage {
 	void (*release)(struct pipeline_stage *stage);
 	void (*render)(struct pipeline_stage *stage);
 
+	/*
+	 * Returns the index of the input that the stage passes through
+	 * unmodified with its current parameters, or a negative value if
+	 * the stage actually transforms its inputs.
+	 */
+	int (*identity)(struct pipeline_stage *stage);
+
+	/*
+	 * Maps the union of the damaged regions of the inputs to the region
+	 * of the output that needs to be rendered again. Stages without a
+	 * footprint always render their complete output.
+	 */
+	void (*footprint)(struct pipeline_stage *stage, struct region *region);
+
+	/*
+	 * Maps a region of the output to the region of the inputs needed to
+	 * render it, including the halo of neighbourhood operations. Only
+	 * stages that have it can be rendered one tile at a time.
+	 */
+	void (*reach)(struct pipeline_stage *stage, struct region *region);
+
+	/*
+	 * Adjusts the size of the output, which defaults to the size of the
+	 * first input, or of the display for stages without inputs, scaled
+	 * by the resolution if set. Not used for the final stage, which
+	 * always renders to the display.
+	 */
+	void (*output_size)(struct pipeline_stage *stage, unsigned int *width,
+			    unsigned int *height);
+
+	/* name under which the output can be referenced by other stages */
+	char *label;
+
+	/*
+	 * Stages producing the inputs of this stage. A NULL entry refers to
+	 * the pipeline source. The framebuffers are assigned to the sources
+	 * and target by pipeline_prepare().
+	 */
+	struct pipeline_stage *inputs[PIPELINE_STAGE_MAX_INPUTS];
+	struct framebuffer *sources[PIPELINE_STAGE_MAX_INPUTS];
+	unsigned int num_inputs;
+
+	struct framebuffer *target;
+
+	/* size of the output, determined by pipeline_prepare() */
+	unsigned int width;
+	unsigned int height;
+
+	/* format of the output, NULL for the pipeline default */
+	const struct framebuffer_format *format;
+
+	/*
+	 * Fraction of the display resolution to render at, instead of the
+	 * size of the first input. 0 keeps the default.
+	 */
+	GLfloat resolution;
+
+	/*
+	 * Stateful stages produce a different output every time they are
+	 * rendered. All other stages are pure functions of their inputs and
+	 * are only rendered again if one of the inputs changed.
+	 */
+	bool stateful;
+
+	/*
+	 * Terminal stages consume their inputs without producing an output
+	 * that other stages could read, for example by converting them to
+	 * another format and handing them to the application. They are
+	 * always rendered and never assigned a target.
+	 */
+	bool terminal;
+
+	/* scheduling information */
+	unsigned int index;
+	unsigned int position;
+	unsigned int last_use;
+	bool cacheable;
+	bool live;
+
+	/* tiled rendering: region needed for the current tile */
+	bool tileable;
+	struct region need;
+	bool drawn;
+
+	/* generations of the sources at the time of the last render */
+	unsigned int generations[PIPELINE_STAGE_MAX_INPUTS];
+	bool rendered;
+
+	/* region of the output changed by the last render */
+	struct region damage;
+	unsigned int generation;
+
 	struct pipeline_stage *next;
 	struct pipeline_stage *prev;
 
@@ -40,10 +143,97 @@ struct pipeline_stage {
 };
 
 void pipeline_stage_free(struct pipeline_stage *stage);
+int pipeline_stage_connect(struct pipeline_stage *stage, unsigned int input,
+			   struct pipeline_stage *producer);
+
+struct pipeline_fence {
+	EGLSyncKHR sync;
+	uint64_t start;
+};
 
 struct pipeline {
+	/* stages, in schedule order after pipeline_prepare() */
 	struct pipeline_stage *first;
 	struct pipeline_stage *last;
+	unsigned int num_stages;
+
+	/* the stage rendering to the display */
+	struct pipeline_stage *sink;
+
+	/* external input and display output */
+	struct framebuffer *source;
+	struct framebuffer *display;
+
+	/* intermediate framebuffers, shared by stages with disjoint lifetimes */
+	struct framebuffer **framebuffers;
+	unsigned int num_framebuffers;
+
+	/* default format of the intermediate framebuffers */
+	const struct framebuffer_format *format;
+
+	/* currently bound framebuffer */
+	struct framebuffer *bound;
+
+	/* number of stage invocations rendered and served from cache */
+	unsigned long renders;
+	unsigned long reuses;
+
+	/*
+	 * Ring of fences for the frames submitted but not completed yet. If
+	 * frames_in_flight is 0, throttling is left to the driver.
+	 */
+	unsigned int frames_in_flight;
+	struct pipeline_fence *fences;
+	unsigned int num_fences;
+	unsigned int fence_head;
+
+	/*
+	 * Time from the start of a frame until its fence was seen signalled,
+	 * in us. An upper bound, see pipeline_retire_frames().
+	 */
+	uint64_t latency_total;
+	uint64_t latency_min;
+	uint64_t latency_max;
+	unsigned long latency_count;
+
+	/* number of pixels shaded and covered by the rendered stages */
+	unsigned long long pixels_shaded;
+	unsigned long long pixels_total;
+
+	/* bytes written to intermediate framebuffers */
+	unsigned long long bytes_written;
+
+	/* texels of the intermediate outputs, and at display resolution */
+	unsigned long long texels;
+	unsigned long long texels_full;
+
+	/* time spent waiting for pixel readbacks, in us */
+	uint64_t readback_total;
+	uint64_t readback_max;
+	unsigned long long readback_bytes;
+	unsigned long readback_count;
+
+	/* time spent uploading textures, in us */
+	uint64_t upload_total;
+	uint64_t upload_max;
+	unsigned long long upload_bytes;
+	unsigned long upload_count;
+
+	/* time spent importing dma-bufs, in us, and bytes not copied */
+	uint64_t import_total;
+	uint64_t import_max;
+	unsigned long import_count;
+	unsigned long long import_bytes;
+
+	bool regenerate;
+	bool optimize;
+	bool partial;
+
+	/* size of the tiles rendered one after the other, 0 if disabled */
+	unsigned int tile_size;
+
+	/* whether the display contents are preserved across swaps */
+	bool preserved;
 
 	struct gles *gles;
 };
@@ -52,33 +242,169 @@ struct pipeline *pipeline_new(struct gles *gles);
 void pipeline_free(struct pipeline *pipeline);
 void pipeline_add_stage(struct pipeline *pipeline,
 			struct pipeline_stage *stage);
+struct pipeline_stage *pipeline_find_stage(struct pipeline *pipeline,
+					   const char *label);
+int pipeline_prepare(struct pipeline *pipeline);
+struct framebuffer *pipeline_stage_framebuffer_new(struct pipeline_stage *stage,
+						   unsigned int width,
+						   unsigned int height);
+void pipeline_bind_framebuffer(struct pipeline *pipeline,
+			       struct framebuffer *framebuffer);
+void pipeline_read_pixels(struct pipeline *pipeline,
+			  struct framebuffer *framebuffer, unsigned int width,
+			  unsigned int height, void *data);
+void pipeline_upload(struct pipeline *pipeline, bool allocate,
+		     unsigned int width, unsigned int height, GLenum format,
+		     const void *data);
 void pipeline_render(struct pipeline *pipeline);
+void pipeline_finish(struct pipeline *pipeline);
 
 struct pipeline_stage *simple_fill_new(struct gles *gles,
 				       struct geometry *geometry,
-				       struct framebuffer *target,
 				       GLfloat red, GLfloat green,
 				       GLfloat blue);
 struct pipeline_stage *checkerboard_new(struct gles *gles,
-					struct geometry *geometry,
-					struct framebuffer *target);
-struct pipeline_stage *clear_new(struct gles *gles, struct framebuffer *target,
-				 GLfloat red, GLfloat green, GLfloat blue);
+					struct geometry *geometry);
+struct pipeline_stage *clear_new(struct gles *gles, GLfloat red,
+				 GLfloat green, GLfloat blue);
 struct pipeline_stage *simple_copy_new(struct gles *gles,
-				       struct geometry *geometry,
-				       struct framebuffer *source,
-				       struct framebuffer *target);
+				       struct geometry *geometry);
 struct pipeline_stage *copy_one_new(struct gles *gles,
-				    struct geometry *geometry,
-				    struct framebuffer *source,
-				    struct framebuffer *target);
+				    struct geometry *geometry);
+
+enum deinterlace_mode {
+	DEINTERLACE_LINEAR,
+	DEINTERLACE_BOB,
+	DEINTERLACE_FIELD,
+};
+
 struct pipeline_stage *deinterlace_new(struct gles *gles,
 				       struct geometry *geometry,
-				       struct framebuffer *source,
-				       struct framebuffer *target);
+				       enum deinterlace_mode mode);
+struct pipeline_stage *motion_deinterlace_new(struct gles *gles,
+					      struct geometry *geometry,
+					      unsigned int fields,
+					      GLfloat threshold);
 struct pipeline_stage *color_correct_new(struct gles *gles,
 					 struct geometry *geometry,
-					 struct framebuffer *source,
-					 struct framebuffer *target);
+					 GLfloat add, GLfloat factor);
+struct pipeline_stage *ticker_new(struct gles *gles,
+				  struct geometry *geometry,
+				  GLfloat height);
+
+enum pattern_type {
+	PATTERN_NOISE,
+	PATTERN_ZONE_PLATE,
+	PATTERN_GRADIENT,
+	PATTERN_MOTION,
+};
+
+struct pipeline_stage *pattern_new(struct gles *gles,
+				   struct geometry *geometry,
+				   enum pattern_type type, unsigned int seed);
+
+enum yuv_format {
+	YUV_FORMAT_NV12,
+	YUV_FORMAT_I420,
+	YUV_FORMAT_YUYV,
+};
+
+enum yuv_matrix {
+	YUV_MATRIX_BT601,
+	YUV_MATRIX_BT709,
+	YUV_MATRIX_BT2020,
+};
+
+void yuv_matrix_setup(enum yuv_matrix matrix, bool full_range,
+		      GLfloat coeff[9], GLfloat offset[3]);
+struct pipeline_stage *yuv_source_new(struct gles *gles,
+				      struct geometry *geometry,
+				      enum yuv_format format,
+				      enum yuv_matrix matrix,
+				      bool full_range, unsigned int width,
+				      unsigned int height);
+
+enum upload_mode {
+	UPLOAD_IMAGE,
+	UPLOAD_SUB_IMAGE,
+};
+
+struct pipeline_stage *upload_new(struct gles *gles,
+				  struct geometry *geometry,
+				  enum upload_mode mode, unsigned int ring,
+				  unsigned int width, unsigned int height,
+				  struct video_file *file);
+
+struct pipeline_stage *dmabuf_new(struct gles *gles,
+				  struct geometry *geometry, unsigned int ring,
+				  unsigned int width, unsigned int height,
+				  bool reimport);
+
+struct pipeline_stage *yuv_sink_new(struct gles *gles, enum yuv_format format,
+				    enum yuv_matrix matrix, bool full_range,
+				    bool readback);
+struct pipeline_stage *average_new(struct gles *gles, bool readback);
+struct pipeline_stage *histogram_new(struct gles *gles, unsigned int step,
+				     bool readback);
+struct pipeline_stage *psnr_new(struct gles *gles, unsigned int interval);
+struct pipeline_stage *capture_new(struct gles *gles, const char *filename,
+				   unsigned int delay, unsigned int buffers,
+				   unsigned int interval, unsigned int rate);
+
+enum convolve_kernel {
+	CONVOLVE_GAUSSIAN,
+	CONVOLVE_BOX,
+	CONVOLVE_UNSHARP,
+};
+
+struct pipeline_stage *convolve_new(struct gles *gles,
+				    struct geometry *geometry,
+				    enum convolve_kernel kernel,
+				    unsigned int radius, GLfloat sigma,
+				    GLfloat amount);
+struct pipeline_stage *lut_new(struct gles *gles, struct geometry *geometry,
+			       const char *filename, unsigned int size,
+			       bool highp);
+struct pipeline_stage *overlay_new(struct gles *gles,
+				   struct geometry *geometry,
+				   unsigned int layers, GLfloat size,
+				   GLfloat coverage, bool premultiplied,
+				   bool skip);
+struct pipeline_stage *edge_blend_new(struct gles *gles,
+				      struct geometry *geometry,
+				      const GLfloat ramps[4], GLfloat gamma,
+				      GLfloat black, bool mask);
+struct pipeline_stage *dither_new(struct gles *gles, struct geometry *geometry,
+				  const unsigned int bits[3]);
+struct pipeline_stage *frame_rate_new(struct gles *gles,
+				      struct geometry *geometry,
+				      unsigned int input_rate,
+				      unsigned int output_rate, bool blend);
+
+enum scale_filter {
+	SCALE_BILINEAR,
+	SCALE_BICUBIC,
+	SCALE_LANCZOS,
+};
+
+struct pipeline_stage *scale_new(struct gles *gles, struct geometry *geometry,
+				 unsigned int width, unsigned int height,
+				 enum scale_filter filter, bool mipmap);
+
+enum orientation_mode {
+	ORIENTATION_ROTATE_90,
+	ORIENTATION_ROTATE_180,
+	ORIENTATION_ROTATE_270,
+	ORIENTATION_FLIP_HORIZONTAL,
+	ORIENTATION_FLIP_VERTICAL,
+	ORIENTATION_TRANSPOSE,
+};
+
+struct pipeline_stage *orientation_new(struct gles *gles,
+				       struct geometry *geometry,
+				       enum orientation_mode mode, bool tiled,
+				       unsigned int block);
+struct pipeline_stage *blend_new(struct gles *gles, struct geometry *geometry,
+				 GLfloat alpha);
 
 #endif
@@ -0,0 +1,238 @@
+/*
+ * Copyright (C) 2013 Avionic Design GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pipeline.h"
+#include "geometry.h"
+#include "gles.h"
+
+/* enough levels to reduce 65536x65536 to a single texel */
+#define AVERAGE_MAX_LEVELS 16
+
+/*
+ * Average luma of the input, reduced by a pyramid of framebuffers that
+ * halve in size down to 1x1. Each level is sampled in the middle of 2x2
+ * texels of the previous one, so that bilinear filtering averages them
+ * with a single fetch. Levels of odd size are slightly biased towards
+ * their last row or column.
+ */
+struct average {
+	struct pipeline_stage base;
+
+	struct geometry *plane;
+
+	struct framebuffer *levels[AVERAGE_MAX_LEVELS];
+	unsigned int num_levels;
+
+	struct glsl_shader *vertex, *fragment;
+	struct glsl_program *program;
+
+	/* attribute locations */
+	GLint pos, tex;
+
+	/* uniform locations */
+	GLint input, coeff;
+
+	bool readback;
+	uint8_t texel[4];
+	unsigned long frames;
+	unsigned long long sum;
+};
+
+static const GLchar *average_vs[] = {
+	"attribute vec3 position;\n",
+	"attribute vec2 tex;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"   gl_Position = vec4(position, 1.0);\n",
+	"   vtex = tex;\n",
+	"}"
+};
+
+/* the coefficients sum up to one, so reducing luma again preserves it */
+static const GLchar *average_fs[] = {
+	"precision mediump float;\n",
+	"uniform sampler2D source;\n",
+	"uniform vec3 coeff;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"    float luma = dot(texture2D(source, vtex).rgb, coeff);\n",
+	"\n",
+	"    gl_FragColor = vec4(vec3(luma), 1.0);\n",
+	"}"
+};
+
+/* BT.709 luma coefficients */
+static const GLfloat average_coeff[3] = { 0.2126f, 0.7152f, 0.0722f };
+
+static inline struct average *to_average(struct pipeline_stage *stage)
+{
+	return (struct average *)stage;
+}
+
+static int average_allocate(struct average *average,
+			    struct framebuffer *source)
+{
+	unsigned int width = source->width, height = source->height;
+
+	while (width > 1 || height > 1) {
+		struct framebuffer *level;
+
+		if (average->num_levels == AVERAGE_MAX_LEVELS)
+			return -1;
+
+		width = (width + 1) / 2;
+		height = (height + 1) / 2;
+
+		level = framebuffer_new_format(width, height, GL_RGBA,
+					       GL_UNSIGNED_BYTE);
+		if (!level)
+			return -1;
+
+		average->levels[average->num_levels++] = level;
+	}
+
+	return 0;
+}
+
+static void average_release(struct pipeline_stage *stage)
+{
+	struct average *average = to_average(stage);
+	unsigned int i;
+
+	if (average->frames > 0)
+		printf("Average luma: %.04f over %lu frames\n",
+		       average->sum / 255.0 / average->frames,
+		       average->frames);
+
+	for (i = 0; i < average->num_levels; i++)
+		framebuffer_free(average->levels[i]);
+
+	geometry_free(average->plane);
+	glsl_program_free(average->program);
+	free(average);
+}
+
+static void average_render(struct pipeline_stage *stage)
+{
+	struct average *average = to_average(stage);
+	struct framebuffer *source = stage->sources[0];
+	struct pipeline *pipeline = stage->pipeline;
+	struct geometry *geometry = average->plane;
+	struct framebuffer *level = source;
+	unsigned int i;
+
+	if (!average->num_levels) {
+		if (average_allocate(average, source) < 0) {
+			fprintf(stderr, "failed to allocate pyramid\n");
+			return;
+		}
+	}
+
+	glUseProgram(average->program->id);
+
+	glVertexAttribPointer(average->pos, 3, GL_FLOAT, GL_FALSE,
+			      3 * sizeof(GLfloat), geometry->vertices);
+	glEnableVertexAttribArray(average->pos);
+
+	glVertexAttribPointer(average->tex, 2, GL_FLOAT, GL_FALSE,
+			      2 * sizeof(GLfloat), geometry->uv);
+	glEnableVertexAttribArray(average->tex);
+
+	glActiveTexture(GL_TEXTURE0);
+	glUniform1i(average->input, 0);
+	glUniform3fv(average->coeff, 1, average_coeff);
+
+	for (i = 0; i < average->num_levels; i++) {
+		pipeline_bind_framebuffer(pipeline, average->levels[i]);
+		glBindTexture(GL_TEXTURE_2D, level->texture->id);
+
+		glDrawElements(GL_TRIANGLES, geometry->num_indices,
+			       GL_UNSIGNED_SHORT, geometry->indices);
+
+		level = average->levels[i];
+	}
+
+	if (average->readback) {
+		pipeline_read_pixels(pipeline, level, 1, 1, average->texel);
+		average->sum += average->texel[0];
+		average->frames++;
+	}
+}
+
+struct pipeline_stage *average_new(struct gles *gles, bool readback)
+{
+	struct average *stage;
+
+	stage = calloc(1, sizeof(*stage));
+	if (!stage)
+		return NULL;
+
+	stage->base.name = "luma average";
+	stage->base.release = average_release;
+	stage->base.render = average_render;
+	stage->base.num_inputs = 1;
+	stage->base.stateful = true;
+	stage->base.terminal = true;
+
+	stage->readback = readback;
+
+	stage->plane = grid_new(0);
+	if (!stage->plane)
+		return NULL;
+
+	stage->vertex = glsl_shader_new(GL_VERTEX_SHADER, average_vs,
+					ARRAY_SIZE(average_vs));
+	if (!stage->vertex) {
+		fprintf(stderr, "failed to create vertex shader\n");
+		return NULL;
+	}
+
+	stage->fragment = glsl_shader_new(GL_FRAGMENT_SHADER, average_fs,
+					  ARRAY_SIZE(average_fs));
+	if (!stage->fragment) {
+		fprintf(stderr, "failed to create fragment shader\n");
+		return NULL;
+	}
+
+	stage->program = glsl_program_new(stage->vertex, stage->fragment);
+	if (!stage->program) {
+		fprintf(stderr, "failed to create GLSL program\n");
+		return NULL;
+	}
+
+	if (glsl_program_link(stage->program) < 0) {
+		fprintf(stderr, "failed to link GLSL program\n");
+		return NULL;
+	}
+
+	stage->pos = glGetAttribLocation(stage->program->id, "position");
+	stage->tex = glGetAttribLocation(stage->program->id, "tex");
+	stage->input = glGetUniformLocation(stage->program->id, "source");
+	stage->coeff = glGetUniformLocation(stage->program->id, "coeff");
+
+	return &stage->base;
+}
@@ -0,0 +1,429 @@
+/*
+ * Copyright (C) 2013 Avionic Design GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pipeline.h"
+#include "gles.h"
+
+#define CAPTURE_MAX_DELAY 8
+#define CAPTURE_MAX_BUFFERS 32
+
+/*
+ * Records every interval-th input frame to a raw RGBA or, if the file name
+ * ends in .y4m, a YUV4MPEG2 file.
+ *
+ * GLES2 has no asynchronous readback, so a captured frame is first copied
+ * to one of delay framebuffers on the GPU and only read back delay frames
+ * later, when its rendering has most likely completed and the readback
+ * doesn't have to wait for it. The frames are read back into a pool of
+ * buffers, which a thread converts and writes to the file. If the writer
+ * falls behind and all buffers are in use, frames are dropped rather than
+ * stalling the pipeline.
+ */
+struct capture {
+	struct pipeline_stage base;
+
+	/* frames waiting on the GPU to be read back */
+	struct framebuffer *slots[CAPTURE_MAX_DELAY];
+	bool pending[CAPTURE_MAX_DELAY];
+	unsigned int delay;
+
+	unsigned int width;
+	unsigned int height;
+	bool failed;
+
+	/* the pool is used in order, buffers are written in the same order */
+	uint8_t *buffers[CAPTURE_MAX_BUFFERS];
+	unsigned int num_buffers;
+	unsigned long queued;
+	unsigned long written;
+
+	FILE *file;
+	bool y4m;
+	uint8_t *planes;
+	size_t planes_size;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool running;
+	bool done;
+
+	unsigned int interval;
+	unsigned int rate;
+	unsigned long frames;
+	unsigned long dropped;
+
+	/* time the writer spent converting and writing, in us */
+	uint64_t write_time;
+	unsigned long long write_bytes;
+};
+
+static inline struct capture *to_capture(struct pipeline_stage *stage)
+{
+	return (struct capture *)stage;
+}
+
+static uint64_t capture_get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+/*
+ * Convert to limited range BT.601 4:2:0, with chroma taken from the top
+ * left pixel of every 2x2 block. Readbacks are bottom-up, frames in the
+ * file top-down.
+ */
+static void capture_convert_i420(struct capture *capture, const uint8_t *rgba)
+{
+	unsigned int width = capture->width, height = capture->height;
+	unsigned int cw = (width + 1) / 2, ch = (height + 1) / 2;
+	uint8_t *y = capture->planes;
+	uint8_t *u = y + width * height;
+	uint8_t *v = u + cw * ch;
+	unsigned int row, col;
+
+	for (row = 0; row < height; row++) {
+		const uint8_t *pixel = rgba + (height - 1 - row) * width * 4;
+
+		for (col = 0; col < width; col++, pixel += 4) {
+			int r = pixel[0], g = pixel[1], b = pixel[2];
+
+			y[row * width + col] = ((66 * r + 129 * g + 25 * b +
+						 128) >> 8) + 16;
+
+			if ((row | col) & 1)
+				continue;
+
+			u[row / 2 * cw + col / 2] = ((-38 * r - 74 * g +
+						      112 * b + 128) >> 8) + 128;
+			v[row / 2 * cw + col / 2] = ((112 * r - 94 * g -
+						      18 * b + 128) >> 8) + 128;
+		}
+	}
+}
+
+static int capture_write(struct capture *capture, const uint8_t *rgba)
+{
+	unsigned int width = capture->width, height = capture->height;
+	size_t size, stride = width * 4;
+	unsigned int row;
+
+	if (capture->y4m) {
+		size = capture->planes_size;
+
+		capture_convert_i420(capture, rgba);
+
+		if (fputs("FRAME\n", capture->file) < 0 ||
+		    fwrite(capture->planes, size, 1, capture->file) != 1)
+			return -1;
+
+		capture->write_bytes += size;
+		return 0;
+	}
+
+	for (row = 0; row < height; row++) {
+		const uint8_t *line = rgba + (height - 1 - row) * stride;
+
+		if (fwrite(line, stride, 1, capture->file) != 1)
+			return -1;
+	}
+
+	capture->write_bytes += height * stride;
+	return 0;
+}
+
+static void *capture_writer(void *data)
+{
+	struct capture *capture = data;
+	bool failed = false;
+	uint64_t start;
+	uint8_t *buffer;
+
+	pthread_mutex_lock(&capture->lock);
+
+	while (capture->written < capture->queued || !capture->done) {
+		if (capture->written == capture->queued) {
+			pthread_cond_wait(&capture->cond, &capture->lock);
+			continue;
+		}
+
+		buffer = capture->buffers[capture->written %
+					  capture->num_buffers];
+		pthread_mutex_unlock(&capture->lock);
+
+		if (!failed) {
+			start = capture_get_time();
+
+			if (capture_write(capture, buffer) < 0) {
+				fprintf(stderr, "failed to write frame: %s\n",
+					strerror(errno));
+				failed = true;
+			}
+
+			capture->write_time += capture_get_time() - start;
+		}
+
+		pthread_mutex_lock(&capture->lock);
+		capture->written++;
+	}
+
+	pthread_mutex_unlock(&capture->lock);
+
+	return NULL;
+}
+
+static int capture_allocate(struct capture *capture)
+{
+	struct framebuffer *source = capture->base.sources[0];
+	unsigned int i;
+	int err;
+
+	capture->width = source->width;
+	capture->height = source->height;
+
+	/* copies of the source frames need its format */
+	for (i = 0; i < capture->delay; i++) {
+		capture->slots[i] = framebuffer_new_format(capture->width,
+							   capture->height,
+							   source->format,
+							   source->type);
+		if (!capture->slots[i])
+			return -1;
+	}
+
+	for (i = 0; i < capture->num_buffers; i++) {
+		capture->buffers[i] = malloc(capture->width *
+					     capture->height * 4);
+		if (!capture->buffers[i])
+			return -1;
+	}
+
+	if (capture->y4m) {
+		unsigned int cw = (capture->width + 1) / 2;
+		unsigned int ch = (capture->height + 1) / 2;
+
+		capture->planes_size = capture->width * capture->height +
+				       cw * ch * 2;
+
+		capture->planes = malloc(capture->planes_size);
+		if (!capture->planes)
+			return -1;
+
+		fprintf(capture->file, "YUV4MPEG2 W%u H%u F%u:%u Ip A1:1 "
+			"C420jpeg\n", capture->width, capture->height,
+			capture->rate, capture->interval);
+	}
+
+	err = pthread_create(&capture->thread, NULL, capture_writer, capture);
+	if (err) {
+		fprintf(stderr, "failed to create thread: %s\n",
+			strerror(err));
+		return -1;
+	}
+
+	capture->running = true;
+
+	return 0;
+}
+
+/* read a frame back into the next buffer of the pool, unless it is full */
+static void capture_queue(struct capture *capture,
+			  struct framebuffer *framebuffer)
+{
+	struct pipeline *pipeline = capture->base.pipeline;
+	uint8_t *buffer;
+
+	pthread_mutex_lock(&capture->lock);
+
+	if (capture->queued - capture->written == capture->num_buffers) {
+		pthread_mutex_unlock(&capture->lock);
+		capture->dropped++;
+		return;
+	}
+
+	buffer = capture->buffers[capture->queued % capture->num_buffers];
+	pthread_mutex_unlock(&capture->lock);
+
+	pipeline_read_pixels(pipeline, framebuffer, capture->width,
+			     capture->height, buffer);
+
+	pthread_mutex_lock(&capture->lock);
+	capture->queued++;
+	pthread_cond_signal(&capture->cond);
+	pthread_mutex_unlock(&capture->lock);
+}
+
+static void capture_release(struct pipeline_stage *stage)
+{
+	struct capture *capture = to_capture(stage);
+	unsigned int i, slot;
+
+	/* frames still on the GPU are read back, oldest first */
+	for (i = 0; i < capture->delay; i++) {
+		slot = (capture->frames + i) % capture->delay;
+
+		if (capture->pending[slot])
+			capture_queue(capture, capture->slots[slot]);
+	}
+
+	if (capture->running) {
+		pthread_mutex_lock(&capture->lock);
+		capture->done = true;
+		pthread_cond_signal(&capture->cond);
+		pthread_mutex_unlock(&capture->lock);
+
+		pthread_join(capture->thread, NULL);
+	}
+
+	if (capture->written > 0)
+		printf("Capture: %lu frames written, %lu dropped, writer "
+		       "%.02f MB/s, busy %.02f ms per frame\n",
+		       capture->written, capture->dropped,
+		       capture->write_time ?
+		       (double)capture->write_bytes / capture->write_time : 0.0,
+		       capture->write_time / 1000.0 / capture->written);
+
+	for (i = 0; i < capture->delay; i++)
+		if (capture->slots[i])
+			framebuffer_free(capture->slots[i]);
+
+	for (i = 0; i < capture->num_buffers; i++)
+		free(capture->buffers[i]);
+
+	if (capture->file)
+		fclose(capture->file);
+
+	pthread_cond_destroy(&capture->cond);
+	pthread_mutex_destroy(&capture->lock);
+	free(capture->planes);
+	free(capture);
+}
+
+static void capture_render(struct pipeline_stage *stage)
+{
+	struct capture *capture = to_capture(stage);
+	struct framebuffer *source = stage->sources[0];
+	unsigned long frame = capture->frames++;
+	unsigned int slot;
+
+	if (capture->failed)
+		return;
+
+	if (!capture->running) {
+		if (capture_allocate(capture) < 0) {
+			fprintf(stderr, "failed to allocate capture buffers\n");
+			capture->failed = true;
+			return;
+		}
+	}
+
+	if (!capture->delay) {
+		if (frame % capture->interval == 0)
+			capture_queue(capture, source);
+
+		return;
+	}
+
+	/* the frame captured delay frames ago is due before it is replaced */
+	slot = frame % capture->delay;
+
+	if (capture->pending[slot]) {
+		capture_queue(capture, capture->slots[slot]);
+		capture->pending[slot] = false;
+	}
+
+	if (frame % capture->interval)
+		return;
+
+	pipeline_bind_framebuffer(stage->pipeline, source);
+
+	glBindTexture(GL_TEXTURE_2D, capture->slots[slot]->texture->id);
+	glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, capture->width,
+			    capture->height);
+
+	capture->pending[slot] = true;
+}
+
+struct pipeline_stage *capture_new(struct gles *gles, const char *filename,
+				   unsigned int delay, unsigned int buffers,
+				   unsigned int interval, unsigned int rate)
+{
+	struct capture *stage;
+	const char *suffix;
+
+	if (delay > CAPTURE_MAX_DELAY) {
+		fprintf(stderr, "delay must be at most %u\n",
+			CAPTURE_MAX_DELAY);
+		return NULL;
+	}
+
+	if (buffers < 1 || buffers > CAPTURE_MAX_BUFFERS) {
+		fprintf(stderr, "buffers must be within [1, %u]\n",
+			CAPTURE_MAX_BUFFERS);
+		return NULL;
+	}
+
+	if (interval < 1 || rate < 1) {
+		fprintf(stderr, "interval and rate must be at least 1\n");
+		return NULL;
+	}
+
+	stage = calloc(1, sizeof(*stage));
+	if (!stage)
+		return NULL;
+
+	stage->base.name = "frame capture";
+	stage->base.release = capture_release;
+	stage->base.render = capture_render;
+	stage->base.num_inputs = 1;
+	stage->base.stateful = true;
+	stage->base.terminal = true;
+
+	stage->delay = delay;
+	stage->num_buffers = buffers;
+	stage->interval = interval;
+	stage->rate = rate;
+
+	pthread_mutex_init(&stage->lock, NULL);
+	pthread_cond_init(&stage->cond, NULL);
+
+	suffix = strrchr(filename, '.');
+	stage->y4m = suffix && strcmp(suffix, ".y4m") == 0;
+
+	stage->file = fopen(filename, "wb");
+	if (!stage->file) {
+		fprintf(stderr, "failed to open %s: %s\n", filename,
+			strerror(errno));
+		return NULL;
+	}
+
+	return &stage->base;
+}
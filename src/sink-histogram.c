@@ -0,0 +1,342 @@
+/*
+ * Copyright (C) 2013 Avionic Design GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pipeline.h"
+#include "geometry.h"
+#include "gles.h"
+
+#define HISTOGRAM_BINS 256
+
+/* hits an 8-bit channel can count before it saturates */
+#define HISTOGRAM_CHANNEL_MAX 255
+
+/*
+ * 256-bin luma histogram. Every sampled input pixel is drawn as a point
+ * whose vertex shader fetches the pixel and moves the point to the bin of
+ * its luma, where additive blending counts it.
+ *
+ * GLES2 can only blend into 8-bit channels, so the counts are spread over
+ * the four channels and over as many rows as needed for no channel to see
+ * more than 255 hits, even if all pixels fall into the same bin. The rows
+ * are summed up on the CPU after reading back the framebuffer.
+ */
+struct histogram {
+	struct pipeline_stage base;
+
+	struct framebuffer *framebuffer;
+	unsigned int rows;
+
+	/*
+	 * Source position, row and channel of every point. They never change
+	 * and are kept in a buffer object so that they aren't transferred
+	 * again for every frame.
+	 */
+	GLuint points;
+	unsigned int num_points;
+
+	struct glsl_shader *vertex, *fragment;
+	struct glsl_program *program;
+
+	/* attribute locations */
+	GLint point;
+
+	/* uniform locations */
+	GLint input, coeff;
+
+	unsigned int step;
+	bool readback;
+
+	uint8_t *data;
+	unsigned long long bins[HISTOGRAM_BINS];
+	unsigned long frames;
+};
+
+static const GLchar *histogram_vs[] = {
+	"attribute vec4 point;\n",
+	"uniform sampler2D source;\n",
+	"uniform vec3 coeff;\n",
+	"varying vec4 vcolor;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"   vec3 color = texture2DLod(source, point.xy, 0.0).rgb;\n",
+	"   float bin = floor(dot(color, coeff) * 255.0 + 0.5);\n",
+	"\n",
+	"   gl_Position = vec4((bin + 0.5) / 128.0 - 1.0, point.z, 0.0, 1.0);\n",
+	"   gl_PointSize = 1.0;\n",
+	"   vcolor = vec4(equal(vec4(point.w), vec4(0.0, 1.0, 2.0, 3.0))) / 255.0;\n",
+	"}"
+};
+
+static const GLchar *histogram_fs[] = {
+	"precision mediump float;\n",
+	"varying vec4 vcolor;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"    gl_FragColor = vcolor;\n",
+	"}"
+};
+
+/* BT.709 luma coefficients */
+static const GLfloat histogram_coeff[3] = { 0.2126f, 0.7152f, 0.0722f };
+
+static inline struct histogram *to_histogram(struct pipeline_stage *stage)
+{
+	return (struct histogram *)stage;
+}
+
+static int histogram_allocate(struct histogram *histogram,
+			      struct framebuffer *source)
+{
+	unsigned int width = (source->width + histogram->step - 1) /
+			     histogram->step;
+	unsigned int height = (source->height + histogram->step - 1) /
+			      histogram->step;
+	unsigned int x, y, i, capacity;
+	GLfloat *points;
+	GLint max_size;
+
+	histogram->num_points = width * height;
+	capacity = HISTOGRAM_CHANNEL_MAX * 4;
+	histogram->rows = (histogram->num_points + capacity - 1) / capacity;
+
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+	if (histogram->rows > (unsigned int)max_size) {
+		fprintf(stderr, "histogram needs %u rows, increase the step\n",
+			histogram->rows);
+		return -1;
+	}
+
+	points = malloc(histogram->num_points * 4 * sizeof(GLfloat));
+	if (!points)
+		return -1;
+
+	for (y = 0, i = 0; y < height; y++) {
+		for (x = 0; x < width; x++, i++) {
+			GLfloat *point = points + i * 4;
+			unsigned int row = i % histogram->rows;
+
+			point[0] = (x * histogram->step + 0.5f) /
+				   source->width;
+			point[1] = (y * histogram->step + 0.5f) /
+				   source->height;
+			point[2] = (row + 0.5f) * 2.0f / histogram->rows - 1.0f;
+			point[3] = (i / histogram->rows) % 4;
+		}
+	}
+
+	glGenBuffers(1, &histogram->points);
+	glBindBuffer(GL_ARRAY_BUFFER, histogram->points);
+	glBufferData(GL_ARRAY_BUFFER, histogram->num_points * 4 *
+		     sizeof(GLfloat), points, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	free(points);
+
+	histogram->framebuffer = framebuffer_new_format(HISTOGRAM_BINS,
+							histogram->rows,
+							GL_RGBA,
+							GL_UNSIGNED_BYTE);
+	if (!histogram->framebuffer)
+		return -1;
+
+	histogram->data = malloc(HISTOGRAM_BINS * histogram->rows * 4);
+	if (!histogram->data)
+		return -1;
+
+	return 0;
+}
+
+static void histogram_accumulate(struct histogram *histogram)
+{
+	unsigned int row, bin, i;
+
+	for (row = 0; row < histogram->rows; row++) {
+		const uint8_t *texel = histogram->data +
+				       row * HISTOGRAM_BINS * 4;
+
+		for (bin = 0; bin < HISTOGRAM_BINS; bin++, texel += 4)
+			for (i = 0; i < 4; i++)
+				histogram->bins[bin] += texel[i];
+	}
+
+	histogram->frames++;
+}
+
+/* prints the percentiles of the luma distribution over all frames */
+static void histogram_report(struct histogram *histogram)
+{
+	static const unsigned int percentiles[] = { 1, 10, 50, 90, 99 };
+	unsigned long long total = 0, count = 0;
+	unsigned int bin, i = 0;
+
+	for (bin = 0; bin < HISTOGRAM_BINS; bin++)
+		total += histogram->bins[bin];
+
+	if (!total)
+		return;
+
+	printf("Luma histogram: %u samples per frame, percentiles",
+	       histogram->num_points);
+
+	for (bin = 0; bin < HISTOGRAM_BINS; bin++) {
+		count += histogram->bins[bin];
+
+		while (i < ARRAY_SIZE(percentiles) &&
+		       count * 100 >= total * percentiles[i]) {
+			printf(" %u%%: %u", percentiles[i], bin);
+			i++;
+		}
+	}
+
+	printf("\n");
+}
+
+static void histogram_release(struct pipeline_stage *stage)
+{
+	struct histogram *histogram = to_histogram(stage);
+
+	histogram_report(histogram);
+
+	if (histogram->framebuffer)
+		framebuffer_free(histogram->framebuffer);
+
+	if (histogram->points)
+		glDeleteBuffers(1, &histogram->points);
+
+	glsl_program_free(histogram->program);
+	free(histogram->data);
+	free(histogram);
+}
+
+static void histogram_render(struct pipeline_stage *stage)
+{
+	struct histogram *histogram = to_histogram(stage);
+	struct framebuffer *source = stage->sources[0];
+	struct pipeline *pipeline = stage->pipeline;
+
+	if (!histogram->framebuffer) {
+		if (histogram_allocate(histogram, source) < 0) {
+			fprintf(stderr, "failed to allocate histogram\n");
+			return;
+		}
+	}
+
+	pipeline_bind_framebuffer(pipeline, histogram->framebuffer);
+
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	glUseProgram(histogram->program->id);
+
+	glBindBuffer(GL_ARRAY_BUFFER, histogram->points);
+	glVertexAttribPointer(histogram->point, 4, GL_FLOAT, GL_FALSE,
+			      4 * sizeof(GLfloat), NULL);
+	glEnableVertexAttribArray(histogram->point);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, source->texture->id);
+	glUniform1i(histogram->input, 0);
+	glUniform3fv(histogram->coeff, 1, histogram_coeff);
+
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE);
+
+	glDrawArrays(GL_POINTS, 0, histogram->num_points);
+
+	/* the other stages use client-side vertex arrays */
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glDisable(GL_BLEND);
+
+	if (histogram->readback) {
+		pipeline_read_pixels(pipeline, histogram->framebuffer,
+				     HISTOGRAM_BINS, histogram->rows,
+				     histogram->data);
+		histogram_accumulate(histogram);
+	}
+}
+
+struct pipeline_stage *histogram_new(struct gles *gles, unsigned int step,
+				     bool readback)
+{
+	struct histogram *stage;
+	GLint units;
+
+	if (step < 1) {
+		fprintf(stderr, "step must be at least 1\n");
+		return NULL;
+	}
+
+	glGetIntegerv(GL_MAX_VERTEX_TEXTURE_IMAGE_UNITS, &units);
+	if (units < 1) {
+		fprintf(stderr, "vertex texture fetch not supported\n");
+		return NULL;
+	}
+
+	stage = calloc(1, sizeof(*stage));
+	if (!stage)
+		return NULL;
+
+	stage->base.name = "luma histogram";
+	stage->base.release = histogram_release;
+	stage->base.render = histogram_render;
+	stage->base.num_inputs = 1;
+	stage->base.stateful = true;
+	stage->base.terminal = true;
+
+	stage->step = step;
+	stage->readback = readback;
+
+	stage->vertex = glsl_shader_new(GL_VERTEX_SHADER, histogram_vs,
+					ARRAY_SIZE(histogram_vs));
+	if (!stage->vertex) {
+		fprintf(stderr, "failed to create vertex shader\n");
+		return NULL;
+	}
+
+	stage->fragment = glsl_shader_new(GL_FRAGMENT_SHADER, histogram_fs,
+					  ARRAY_SIZE(histogram_fs));
+	if (!stage->fragment) {
+		fprintf(stderr, "failed to create fragment shader\n");
+		return NULL;
+	}
+
+	stage->program = glsl_program_new(stage->vertex, stage->fragment);
+	if (!stage->program) {
+		fprintf(stderr, "failed to create GLSL program\n");
+		return NULL;
+	}
+
+	if (glsl_program_link(stage->program) < 0) {
+		fprintf(stderr, "failed to link GLSL program\n");
+		return NULL;
+	}
+
+	stage->point = glGetAttribLocation(stage->program->id, "point");
+	stage->input = glGetUniformLocation(stage->program->id, "source");
+	stage->coeff = glGetUniformLocation(stage->program->id, "coeff");
+
+	return &stage->base;
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2013 Avionic Design GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pipeline.h"
+#include "gles.h"
+
+/*
+ * Peak signal-to-noise ratio of the second input relative to the first,
+ * over the color channels. Both inputs are read back and compared on the
+ * CPU, which keeps the full precision of the squared errors. The readback
+ * stalls the pipeline, so only every interval-th frame is measured.
+ */
+struct psnr {
+	struct pipeline_stage base;
+
+	uint8_t *data[2];
+	unsigned int width;
+	unsigned int height;
+
+	unsigned int interval;
+	unsigned long frames;
+	bool failed;
+
+	/* PSNR in dB of the measured frames, identical ones are skipped */
+	double sum, min;
+	unsigned long measured;
+	unsigned long identical;
+};
+
+static inline struct psnr *to_psnr(struct pipeline_stage *stage)
+{
+	return (struct psnr *)stage;
+}
+
+static int psnr_allocate(struct psnr *psnr)
+{
+	struct framebuffer **sources = psnr->base.sources;
+	unsigned int i;
+
+	if (sources[0]->width != sources[1]->width ||
+	    sources[0]->height != sources[1]->height) {
+		fprintf(stderr, "inputs differ in size: %ux%u and %ux%u\n",
+			sources[0]->width, sources[0]->height,
+			sources[1]->width, sources[1]->height);
+		return -1;
+	}
+
+	psnr->width = sources[0]->width;
+	psnr->height = sources[0]->height;
+
+	for (i = 0; i < 2; i++) {
+		psnr->data[i] = malloc(psnr->width * psnr->height * 4);
+		if (!psnr->data[i])
+			return -1;
+	}
+
+	return 0;
+}
+
+static void psnr_measure(struct psnr *psnr)
+{
+	unsigned long long error = 0;
+	unsigned int i, count;
+	double mse, db;
+
+	count = psnr->width * psnr->height * 4;
+
+	for (i = 0; i < count; i++) {
+		int diff = psnr->data[0][i] - psnr->data[1][i];
+
+		/* alpha is not part of the picture */
+		if ((i & 3) == 3)
+			continue;
+
+		error += diff * diff;
+	}
+
+	if (!error) {
+		psnr->identical++;
+		return;
+	}
+
+	mse = (double)error / (psnr->width * psnr->height * 3);
+	db = 10.0 * log10(255.0 * 255.0 / mse);
+
+	if (psnr->measured == 0 || db < psnr->min)
+		psnr->min = db;
+
+	psnr->sum += db;
+	psnr->measured++;
+}
+
+static void psnr_release(struct pipeline_stage *stage)
+{
+	struct psnr *psnr = to_psnr(stage);
+
+	if (psnr->measured > 0)
+		printf("PSNR: average %.02f dB, min %.02f dB over %lu frames\n",
+		       psnr->sum / psnr->measured, psnr->min,
+		       psnr->measured);
+
+	if (psnr->identical > 0)
+		printf("PSNR: %lu frames identical\n", psnr->identical);
+
+	free(psnr->data[0]);
+	free(psnr->data[1]);
+	free(psnr);
+}
+
+static void psnr_render(struct pipeline_stage *stage)
+{
+	struct psnr *psnr = to_psnr(stage);
+	struct pipeline *pipeline = stage->pipeline;
+	unsigned int i;
+
+	if (psnr->failed || psnr->frames++ % psnr->interval)
+		return;
+
+	if (!psnr->data[0]) {
+		if (psnr_allocate(psnr) < 0) {
+			fprintf(stderr, "failed to allocate PSNR buffers\n");
+			psnr->failed = true;
+			return;
+		}
+	}
+
+	for (i = 0; i < 2; i++)
+		pipeline_read_pixels(pipeline, stage->sources[i], psnr->width,
+				     psnr->height, psnr->data[i]);
+
+	psnr_measure(psnr);
+}
+
+struct pipeline_stage *psnr_new(struct gles *gles, unsigned int interval)
+{
+	struct psnr *stage;
+
+	if (interval < 1) {
+		fprintf(stderr, "interval must be at least 1\n");
+		return NULL;
+	}
+
+	stage = calloc(1, sizeof(*stage));
+	if (!stage)
+		return NULL;
+
+	stage->base.name = "PSNR measurement";
+	stage->base.release = psnr_release;
+	stage->base.render = psnr_render;
+	stage->base.num_inputs = 2;
+	stage->base.stateful = true;
+	stage->base.terminal = true;
+
+	stage->interval = interval;
+
+	return &stage->base;
+}
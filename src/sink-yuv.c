@@ -0,0 +1,439 @@
+/*
+ * Copyright (C) 2013 Avionic Design GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pipeline.h"
+#include "geometry.h"
+#include "gles.h"
+
+#define YUV_MAX_PLANES 3
+
+/*
+ * GLES2 can neither render to single channel textures nor to multiple
+ * render targets, so each plane is produced by a separate pass into an
+ * RGBA framebuffer that holds four consecutive bytes of the plane in
+ * every texel. Read back with GL_RGBA/GL_UNSIGNED_BYTE the framebuffer
+ * contents are the plane in its native layout.
+ */
+struct yuv_sink_plane {
+	struct framebuffer *framebuffer;
+
+	struct glsl_shader *vertex, *fragment;
+	struct glsl_program *program;
+
+	/* attribute locations */
+	GLint pos, tex;
+
+	/* uniform locations */
+	GLint source, pack, coeff0, coeff1, bias;
+
+	/* size of the plane in bytes */
+	unsigned int width;
+	unsigned int height;
+
+	/* samples stored per texel and horizontal subsampling factor */
+	unsigned int samples;
+	unsigned int subsampling;
+
+	/* rows of the conversion matrix and offsets of the components */
+	GLfloat vcoeff[2][3];
+	GLfloat vbias[2];
+
+	uint8_t *data;
+};
+
+struct yuv_sink {
+	struct pipeline_stage base;
+
+	struct geometry *plane;
+
+	struct yuv_sink_plane planes[YUV_MAX_PLANES];
+	unsigned int num_planes;
+
+	enum yuv_format format;
+	bool readback;
+};
+
+static const GLchar *yuv_sink_vs[] = {
+	"attribute vec3 position;\n",
+	"attribute vec2 tex;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"   gl_Position = vec4(position, 1.0);\n",
+	"   vtex = tex;\n",
+	"}"
+};
+
+/*
+ * Four samples of one component per texel (Y, or U and V of I420). The
+ * chroma planes are rendered at half height, so vtex.y falls between two
+ * rows of the source and bilinear filtering averages them. Horizontally
+ * chroma samples are placed between two columns for the same reason.
+ */
+static const GLchar *yuv_sink_pack4_fs[] = {
+	GLSL_PRECISION_HIGH,
+	"uniform sampler2D source;\n",
+	"uniform vec2 pack;\n",
+	"uniform vec3 coeff0;\n",
+	"uniform vec2 bias;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"    float base = floor(vtex.x * pack.x) * 4.0;\n",
+	"    vec4 x = (vec4(base) + vec4(0.5, 1.5, 2.5, 3.5)) * pack.y;\n",
+	"    vec4 result;\n",
+	"\n",
+	"    result.r = dot(coeff0, texture2D(source, vec2(x.r, vtex.y)).rgb);\n",
+	"    result.g = dot(coeff0, texture2D(source, vec2(x.g, vtex.y)).rgb);\n",
+	"    result.b = dot(coeff0, texture2D(source, vec2(x.b, vtex.y)).rgb);\n",
+	"    result.a = dot(coeff0, texture2D(source, vec2(x.a, vtex.y)).rgb);\n",
+	"\n",
+	"    gl_FragColor = result + bias.x;\n",
+	"}"
+};
+
+/* two interleaved U/V pairs per texel for the NV12 chroma plane */
+static const GLchar *yuv_sink_pack2_fs[] = {
+	GLSL_PRECISION_HIGH,
+	"uniform sampler2D source;\n",
+	"uniform vec2 pack;\n",
+	"uniform vec3 coeff0;\n",
+	"uniform vec3 coeff1;\n",
+	"uniform vec2 bias;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"    float base = floor(vtex.x * pack.x) * 2.0;\n",
+	"    vec2 x = (vec2(base) + vec2(0.5, 1.5)) * pack.y;\n",
+	"    vec3 c0 = texture2D(source, vec2(x.x, vtex.y)).rgb;\n",
+	"    vec3 c1 = texture2D(source, vec2(x.y, vtex.y)).rgb;\n",
+	"\n",
+	"    gl_FragColor = vec4(dot(coeff0, c0), dot(coeff1, c0),\n",
+	"                        dot(coeff0, c1), dot(coeff1, c1)) + bias.xyxy;\n",
+	"}"
+};
+
+static inline struct yuv_sink *to_yuv_sink(struct pipeline_stage *stage)
+{
+	return (struct yuv_sink *)stage;
+}
+
+static void yuv_sink_plane_setup(struct yuv_sink_plane *plane,
+				 unsigned int samples,
+				 unsigned int subsampling)
+{
+	plane->samples = samples;
+	plane->subsampling = subsampling;
+}
+
+/*
+ * Compute the rows converting R'G'B' to normalized Y'CbCr for the given
+ * luma coefficients, the inverse of what the YUV source does. Limited
+ * range video has luma in [16, 235] and chroma in [16, 240].
+ */
+static void yuv_sink_set_matrix(struct yuv_sink *yuv, enum yuv_matrix matrix,
+				bool full_range)
+{
+	GLfloat kr, kb, kg, ys, cs, yo, co, cb, cr;
+	GLfloat y[3], u[3], v[3];
+	unsigned int i;
+
+	switch (matrix) {
+	case YUV_MATRIX_BT601:
+	default:
+		kr = 0.299f;
+		kb = 0.114f;
+		break;
+
+	case YUV_MATRIX_BT709:
+		kr = 0.2126f;
+		kb = 0.0722f;
+		break;
+
+	case YUV_MATRIX_BT2020:
+		kr = 0.2627f;
+		kb = 0.0593f;
+		break;
+	}
+
+	kg = 1.0f - kr - kb;
+
+	if (full_range) {
+		ys = 1.0f;
+		cs = 1.0f;
+		yo = 0.0f;
+	} else {
+		ys = 219.0f / 255.0f;
+		cs = 224.0f / 255.0f;
+		yo = 16.0f / 255.0f;
+	}
+
+	co = 128.0f / 255.0f;
+	cb = cs / (2.0f * (1.0f - kb));
+	cr = cs / (2.0f * (1.0f - kr));
+
+	y[0] = ys * kr;
+	y[1] = ys * kg;
+	y[2] = ys * kb;
+
+	u[0] = -kr * cb;
+	u[1] = -kg * cb;
+	u[2] = (1.0f - kb) * cb;
+
+	v[0] = (1.0f - kr) * cr;
+	v[1] = -kg * cr;
+	v[2] = -kb * cr;
+
+	for (i = 0; i < 3; i++) {
+		yuv->planes[0].vcoeff[0][i] = y[i];
+
+		if (yuv->format == YUV_FORMAT_NV12) {
+			yuv->planes[1].vcoeff[0][i] = u[i];
+			yuv->planes[1].vcoeff[1][i] = v[i];
+		} else {
+			yuv->planes[1].vcoeff[0][i] = u[i];
+			yuv->planes[2].vcoeff[0][i] = v[i];
+		}
+	}
+
+	for (i = 0; i < yuv->num_planes; i++) {
+		yuv->planes[i].vbias[0] = i == 0 ? yo : co;
+		yuv->planes[i].vbias[1] = co;
+	}
+}
+
+static int yuv_sink_plane_init(struct yuv_sink_plane *plane)
+{
+	const GLchar **fs = yuv_sink_pack4_fs;
+	GLint count = ARRAY_SIZE(yuv_sink_pack4_fs);
+
+	if (plane->samples == 2) {
+		fs = yuv_sink_pack2_fs;
+		count = ARRAY_SIZE(yuv_sink_pack2_fs);
+	}
+
+	plane->vertex = glsl_shader_new(GL_VERTEX_SHADER, yuv_sink_vs,
+					ARRAY_SIZE(yuv_sink_vs));
+	if (!plane->vertex) {
+		fprintf(stderr, "failed to create vertex shader\n");
+		return -1;
+	}
+
+	plane->fragment = glsl_shader_new(GL_FRAGMENT_SHADER, fs, count);
+	if (!plane->fragment) {
+		fprintf(stderr, "failed to create fragment shader\n");
+		return -1;
+	}
+
+	plane->program = glsl_program_new(plane->vertex, plane->fragment);
+	if (!plane->program) {
+		fprintf(stderr, "failed to create GLSL program\n");
+		return -1;
+	}
+
+	if (glsl_program_link(plane->program) < 0) {
+		fprintf(stderr, "failed to link GLSL program\n");
+		return -1;
+	}
+
+	plane->pos = glGetAttribLocation(plane->program->id, "position");
+	plane->tex = glGetAttribLocation(plane->program->id, "tex");
+	plane->source = glGetUniformLocation(plane->program->id, "source");
+	plane->pack = glGetUniformLocation(plane->program->id, "pack");
+	plane->coeff0 = glGetUniformLocation(plane->program->id, "coeff0");
+	plane->coeff1 = glGetUniformLocation(plane->program->id, "coeff1");
+	plane->bias = glGetUniformLocation(plane->program->id, "bias");
+
+	return 0;
+}
+
+/*
+ * The planes are sized after the first frame since the input size is not
+ * known before the pipeline has been prepared. Odd sizes are padded, the
+ * padding samples are clamped to the edge of the input.
+ */
+static int yuv_sink_allocate(struct yuv_sink *yuv, struct framebuffer *source)
+{
+	unsigned int i;
+
+	for (i = 0; i < yuv->num_planes; i++) {
+		struct yuv_sink_plane *plane = &yuv->planes[i];
+		unsigned int width, height = source->height, texels;
+
+		width = (source->width + plane->subsampling - 1) /
+			plane->subsampling;
+
+		if (plane->subsampling > 1)
+			height = (height + 1) / 2;
+
+		/* NV12 stores two bytes per chroma sample */
+		if (plane->samples == 2)
+			width *= 2;
+
+		texels = (width + 3) / 4;
+
+		plane->framebuffer = framebuffer_new_format(texels, height,
+							    GL_RGBA,
+							    GL_UNSIGNED_BYTE);
+		if (!plane->framebuffer)
+			return -1;
+
+		plane->width = texels * 4;
+		plane->height = height;
+
+		if (yuv->readback) {
+			plane->data = malloc(plane->width * plane->height);
+			if (!plane->data)
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void yuv_sink_release(struct pipeline_stage *stage)
+{
+	struct yuv_sink *yuv = to_yuv_sink(stage);
+	unsigned int i;
+
+	for (i = 0; i < yuv->num_planes; i++) {
+		struct yuv_sink_plane *plane = &yuv->planes[i];
+
+		if (plane->framebuffer)
+			framebuffer_free(plane->framebuffer);
+
+		glsl_program_free(plane->program);
+		free(plane->data);
+	}
+
+	geometry_free(yuv->plane);
+	free(yuv);
+}
+
+static void yuv_sink_render(struct pipeline_stage *stage)
+{
+	struct yuv_sink *yuv = to_yuv_sink(stage);
+	struct framebuffer *source = stage->sources[0];
+	struct pipeline *pipeline = stage->pipeline;
+	struct geometry *geometry = yuv->plane;
+	unsigned int i;
+
+	if (!yuv->planes[0].framebuffer) {
+		if (yuv_sink_allocate(yuv, source) < 0) {
+			fprintf(stderr, "failed to allocate YUV planes\n");
+			return;
+		}
+	}
+
+	for (i = 0; i < yuv->num_planes; i++) {
+		struct yuv_sink_plane *plane = &yuv->planes[i];
+
+		pipeline_bind_framebuffer(pipeline, plane->framebuffer);
+
+		glUseProgram(plane->program->id);
+
+		glVertexAttribPointer(plane->pos, 3, GL_FLOAT, GL_FALSE,
+				      3 * sizeof(GLfloat), geometry->vertices);
+		glEnableVertexAttribArray(plane->pos);
+
+		glVertexAttribPointer(plane->tex, 2, GL_FLOAT, GL_FALSE,
+				      2 * sizeof(GLfloat), geometry->uv);
+		glEnableVertexAttribArray(plane->tex);
+
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, source->texture->id);
+		glUniform1i(plane->source, 0);
+
+		glUniform2f(plane->pack, plane->framebuffer->width,
+			    (GLfloat)plane->subsampling / source->width);
+		glUniform3fv(plane->coeff0, 1, plane->vcoeff[0]);
+		glUniform3fv(plane->coeff1, 1, plane->vcoeff[1]);
+		glUniform2fv(plane->bias, 1, plane->vbias);
+
+		glDrawElements(GL_TRIANGLES, geometry->num_indices,
+			       GL_UNSIGNED_SHORT, geometry->indices);
+
+		if (yuv->readback)
+			pipeline_read_pixels(pipeline, plane->framebuffer,
+					     plane->framebuffer->width,
+					     plane->height, plane->data);
+	}
+}
+
+struct pipeline_stage *yuv_sink_new(struct gles *gles, enum yuv_format format,
+				    enum yuv_matrix matrix, bool full_range,
+				    bool readback)
+{
+	struct yuv_sink *stage;
+	unsigned int i;
+
+	stage = calloc(1, sizeof(*stage));
+	if (!stage)
+		return NULL;
+
+	stage->base.release = yuv_sink_release;
+	stage->base.render = yuv_sink_render;
+	stage->base.num_inputs = 1;
+	stage->base.stateful = true;
+	stage->base.terminal = true;
+
+	stage->format = format;
+	stage->readback = readback;
+
+	switch (format) {
+	case YUV_FORMAT_NV12:
+		stage->base.name = "NV12 output";
+		yuv_sink_plane_setup(&stage->planes[0], 4, 1);
+		yuv_sink_plane_setup(&stage->planes[1], 2, 2);
+		stage->num_planes = 2;
+		break;
+
+	case YUV_FORMAT_I420:
+		stage->base.name = "I420 output";
+		yuv_sink_plane_setup(&stage->planes[0], 4, 1);
+		yuv_sink_plane_setup(&stage->planes[1], 4, 2);
+		yuv_sink_plane_setup(&stage->planes[2], 4, 2);
+		stage->num_planes = 3;
+		break;
+
+	default:
+		fprintf(stderr, "unsupported YUV output format\n");
+		free(stage);
+		return NULL;
+	}
+
+	yuv_sink_set_matrix(stage, matrix, full_range);
+
+	stage->plane = grid_new(0);
+	if (!stage->plane)
+		return NULL;
+
+	for (i = 0; i < stage->num_planes; i++)
+		if (yuv_sink_plane_init(&stage->planes[i]) < 0)
+			return NULL;
+
+	return &stage->base;
+}
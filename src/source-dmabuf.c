@@ -0,0 +1,486 @@
+/*
+ * Copyright (C) 2013 Avionic Design GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#define _GNU_SOURCE
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+/* test buffers are created by udmabuf, from kernel 4.20 and glibc 2.27 */
+#if defined(HAVE_LINUX_DMA_BUF_H) && defined(HAVE_LINUX_UDMABUF_H) && \
+    defined(HAVE_MEMFD_CREATE)
+#  define HAVE_UDMABUF 1
+#  include <linux/dma-buf.h>
+#  include <linux/udmabuf.h>
+#endif
+
+#include "pipeline.h"
+#include "geometry.h"
+#include "gles.h"
+
+#define DMABUF_MAX_RING 8
+
+/* DRM_FORMAT_ABGR8888, R, G, B and A bytes in memory order */
+#define DMABUF_FOURCC_ABGR8888 0x34324241
+
+struct dmabuf_buffer {
+	int fd;
+	uint8_t *map;
+	EGLImageKHR image;
+	struct texture *texture;
+};
+
+/*
+ * Source frames in dma-bufs, which the GPU samples directly instead of
+ * having them copied into textures. Each buffer of the ring is imported
+ * as an EGLImage once, or for every frame if reimport is set, as happens
+ * when a decoder doesn't recycle its buffers. For testing, the dma-bufs
+ * are created from memfds by udmabuf and filled by the CPU.
+ */
+struct dmabuf {
+	struct pipeline_stage base;
+
+	struct gles *gles;
+	struct geometry *geometry;
+
+	struct glsl_shader *vertex, *fragment;
+	struct glsl_program *program;
+
+	/* attribute locations */
+	GLint pos, tex;
+
+	/* uniform locations */
+	GLint input;
+
+	struct dmabuf_buffer ring[DMABUF_MAX_RING];
+	unsigned int num_buffers;
+	unsigned int head;
+	size_t size;
+
+	unsigned int width;
+	unsigned int height;
+	bool reimport;
+
+	/* imports not yet accounted to the pipeline, times in us */
+	uint64_t import_total;
+	uint64_t import_max;
+	unsigned long import_count;
+};
+
+static const GLchar *dmabuf_vs[] = {
+	"attribute vec3 position;\n",
+	"attribute vec2 tex;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"   gl_Position = vec4(position, 1.0);\n",
+	"   vtex = tex;\n",
+	"}"
+};
+
+static const GLchar *dmabuf_fs[] = {
+	"precision mediump float;\n",
+	"uniform sampler2D source;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"    gl_FragColor = texture2D(source, vtex);\n",
+	"}"
+};
+
+static inline struct dmabuf *to_dmabuf(struct pipeline_stage *stage)
+{
+	return (struct dmabuf *)stage;
+}
+
+static uint64_t dmabuf_get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+#ifdef HAVE_UDMABUF
+/* diagonal color ramps, shifted from one buffer to the next */
+static void dmabuf_buffer_fill(struct dmabuf *dmabuf,
+			       struct dmabuf_buffer *buffer, unsigned int index)
+{
+	struct dma_buf_sync sync = { 0 };
+	uint8_t *pixel = buffer->map;
+	unsigned int x, y;
+
+	sync.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_WRITE;
+	ioctl(buffer->fd, DMA_BUF_IOCTL_SYNC, &sync);
+
+	for (y = 0; y < dmabuf->height; y++) {
+		for (x = 0; x < dmabuf->width; x++, pixel += 4) {
+			pixel[0] = x + y + index * 64;
+			pixel[1] = x - y + index * 64;
+			pixel[2] = x * 2 + index * 64;
+			pixel[3] = 255;
+		}
+	}
+
+	sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE;
+	ioctl(buffer->fd, DMA_BUF_IOCTL_SYNC, &sync);
+}
+
+/* udmabuf requires the memfd to be sealed against shrinking */
+static int dmabuf_buffer_alloc(struct dmabuf *dmabuf,
+			       struct dmabuf_buffer *buffer, int device)
+{
+	struct udmabuf_create create = { 0 };
+	int memfd;
+
+	memfd = memfd_create("gles-testbench", MFD_ALLOW_SEALING);
+	if (memfd < 0)
+		return -errno;
+
+	if (ftruncate(memfd, dmabuf->size) < 0 ||
+	    fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK) < 0) {
+		close(memfd);
+		return -errno;
+	}
+
+	create.memfd = memfd;
+	create.flags = UDMABUF_FLAGS_CLOEXEC;
+	create.size = dmabuf->size;
+
+	/* the dma-buf keeps a reference to the memory */
+	buffer->fd = ioctl(device, UDMABUF_CREATE, &create);
+	close(memfd);
+
+	if (buffer->fd < 0)
+		return -errno;
+
+	buffer->map = mmap(NULL, dmabuf->size, PROT_READ | PROT_WRITE,
+			   MAP_SHARED, buffer->fd, 0);
+	if (buffer->map == MAP_FAILED) {
+		buffer->map = NULL;
+		return -errno;
+	}
+
+	buffer->texture = texture_new(GL_LINEAR);
+	if (!buffer->texture)
+		return -ENOMEM;
+
+	return 0;
+}
+#endif
+
+static void dmabuf_buffer_free(struct dmabuf *dmabuf,
+			       struct dmabuf_buffer *buffer)
+{
+	struct gles *gles = dmabuf->gles;
+
+	if (buffer->image != EGL_NO_IMAGE_KHR)
+		gles->egl.destroy_image(gles->egl.display, buffer->image);
+
+	if (buffer->texture)
+		texture_free(buffer->texture);
+
+	if (buffer->map)
+		munmap(buffer->map, dmabuf->size);
+
+	if (buffer->fd >= 0)
+		close(buffer->fd);
+}
+
+/* wrap the dma-buf as an EGLImage and make it the texture's storage */
+static int dmabuf_import(struct dmabuf *dmabuf, struct dmabuf_buffer *buffer)
+{
+	struct gles *gles = dmabuf->gles;
+	const EGLint attribs[] = {
+		EGL_WIDTH, dmabuf->width,
+		EGL_HEIGHT, dmabuf->height,
+		EGL_LINUX_DRM_FOURCC_EXT, DMABUF_FOURCC_ABGR8888,
+		EGL_DMA_BUF_PLANE0_FD_EXT, buffer->fd,
+		EGL_DMA_BUF_PLANE0_OFFSET_EXT, 0,
+		EGL_DMA_BUF_PLANE0_PITCH_EXT, dmabuf->width * 4,
+		EGL_NONE
+	};
+	uint64_t start, time;
+
+	start = dmabuf_get_time();
+
+	buffer->image = gles->egl.create_image(gles->egl.display,
+					       EGL_NO_CONTEXT,
+					       EGL_LINUX_DMA_BUF_EXT, NULL,
+					       attribs);
+	if (buffer->image == EGL_NO_IMAGE_KHR)
+		return -1;
+
+	glBindTexture(GL_TEXTURE_2D, buffer->texture->id);
+	gles->egl.image_target_texture(GL_TEXTURE_2D, buffer->image);
+
+	time = dmabuf_get_time() - start;
+
+	if (time > dmabuf->import_max)
+		dmabuf->import_max = time;
+
+	dmabuf->import_total += time;
+	dmabuf->import_count++;
+
+	return 0;
+}
+
+/* the first imports happen while setting up, before there is a pipeline */
+static void dmabuf_account(struct dmabuf *dmabuf)
+{
+	struct pipeline *pipeline = dmabuf->base.pipeline;
+
+	if (dmabuf->import_max > pipeline->import_max)
+		pipeline->import_max = dmabuf->import_max;
+
+	pipeline->import_total += dmabuf->import_total;
+	pipeline->import_count += dmabuf->import_count;
+
+	dmabuf->import_total = 0;
+	dmabuf->import_max = 0;
+	dmabuf->import_count = 0;
+}
+
+#ifdef HAVE_UDMABUF
+static const char *dmabuf_ring_alloc(struct dmabuf *dmabuf, unsigned int ring)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	unsigned int i;
+	int device;
+
+	device = open("/dev/udmabuf", O_RDWR);
+	if (device < 0)
+		return "failed to open /dev/udmabuf";
+
+	dmabuf->size = (dmabuf->width * dmabuf->height * 4 + page - 1) &
+		       ~(page - 1);
+
+	for (i = 0; i < ring; i++) {
+		struct dmabuf_buffer *buffer = &dmabuf->ring[i];
+
+		buffer->fd = -1;
+		buffer->image = EGL_NO_IMAGE_KHR;
+		dmabuf->num_buffers++;
+
+		if (dmabuf_buffer_alloc(dmabuf, buffer, device) < 0) {
+			close(device);
+			return "failed to create dma-buf";
+		}
+
+		dmabuf_buffer_fill(dmabuf, buffer, i);
+
+		if (dmabuf_import(dmabuf, buffer) < 0) {
+			close(device);
+			return "failed to import dma-buf";
+		}
+	}
+
+	close(device);
+
+	return NULL;
+}
+#else
+static const char *dmabuf_ring_alloc(struct dmabuf *dmabuf, unsigned int ring)
+{
+	return "udmabuf not supported by this build";
+}
+#endif
+
+/*
+ * Set up the ring of dma-bufs, or return the reason why they can't be
+ * imported, in which case the frames have to be uploaded.
+ */
+static const char *dmabuf_setup(struct dmabuf *dmabuf, unsigned int ring)
+{
+	struct gles *gles = dmabuf->gles;
+
+	if (!gles_egl_has_extension(gles, "EGL_EXT_image_dma_buf_import"))
+		return "EGL_EXT_image_dma_buf_import not supported";
+
+	if (!gles->egl.create_image || !gles->egl.image_target_texture)
+		return "EGL images not supported";
+
+	return dmabuf_ring_alloc(dmabuf, ring);
+}
+
+static void dmabuf_free(struct dmabuf *dmabuf)
+{
+	unsigned int i;
+
+	for (i = 0; i < dmabuf->num_buffers; i++)
+		dmabuf_buffer_free(dmabuf, &dmabuf->ring[i]);
+
+	if (dmabuf->program)
+		glsl_program_free(dmabuf->program);
+
+	free(dmabuf);
+}
+
+static void dmabuf_release(struct pipeline_stage *stage)
+{
+	dmabuf_free(to_dmabuf(stage));
+}
+
+static void dmabuf_render(struct pipeline_stage *stage)
+{
+	struct dmabuf *dmabuf = to_dmabuf(stage);
+	struct dmabuf_buffer *buffer = &dmabuf->ring[dmabuf->head];
+	struct geometry *geometry = dmabuf->geometry;
+	struct pipeline *pipeline = stage->pipeline;
+	struct gles *gles = dmabuf->gles;
+
+	dmabuf->head = (dmabuf->head + 1) % dmabuf->num_buffers;
+
+	if (dmabuf->reimport) {
+		gles->egl.destroy_image(gles->egl.display, buffer->image);
+		buffer->image = EGL_NO_IMAGE_KHR;
+
+		if (dmabuf_import(dmabuf, buffer) < 0) {
+			fprintf(stderr, "failed to import dma-buf\n");
+			return;
+		}
+	}
+
+	dmabuf_account(dmabuf);
+	pipeline->import_bytes += dmabuf->width * dmabuf->height * 4;
+
+	glUseProgram(dmabuf->program->id);
+
+	glVertexAttribPointer(dmabuf->pos, 3, GL_FLOAT, GL_FALSE,
+			      3 * sizeof(GLfloat), geometry->vertices);
+	glEnableVertexAttribArray(dmabuf->pos);
+
+	glVertexAttribPointer(dmabuf->tex, 2, GL_FLOAT, GL_FALSE,
+			      2 * sizeof(GLfloat), geometry->uv);
+	glEnableVertexAttribArray(dmabuf->tex);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, buffer->texture->id);
+	glUniform1i(dmabuf->input, 0);
+
+	glDrawElements(GL_TRIANGLES, geometry->num_indices, GL_UNSIGNED_SHORT,
+		       geometry->indices);
+}
+
+/* frames are produced at their native size */
+static void dmabuf_output_size(struct pipeline_stage *stage,
+			       unsigned int *width, unsigned int *height)
+{
+	struct dmabuf *dmabuf = to_dmabuf(stage);
+
+	*width = dmabuf->width;
+	*height = dmabuf->height;
+}
+
+/*
+ * Without dma-buf import, the frames are uploaded from CPU memory
+ * instead, by an upload stage with as many textures.
+ */
+struct pipeline_stage *dmabuf_new(struct gles *gles,
+				  struct geometry *geometry, unsigned int ring,
+				  unsigned int width, unsigned int height,
+				  bool reimport)
+{
+	struct dmabuf *stage;
+	const char *reason;
+
+	if (ring < 1 || ring > DMABUF_MAX_RING) {
+		fprintf(stderr, "ring must be within [1, %u]\n",
+			DMABUF_MAX_RING);
+		return NULL;
+	}
+
+	if (width < 1 || height < 1) {
+		fprintf(stderr, "invalid frame size: %ux%u\n", width, height);
+		return NULL;
+	}
+
+	stage = calloc(1, sizeof(*stage));
+	if (!stage)
+		return NULL;
+
+	stage->base.name = reimport ? "dma-buf import (every frame)" :
+				      "dma-buf import";
+	stage->base.release = dmabuf_release;
+	stage->base.render = dmabuf_render;
+	stage->base.output_size = dmabuf_output_size;
+	stage->base.stateful = true;
+
+	stage->gles = gles;
+	stage->geometry = geometry;
+	stage->width = width;
+	stage->height = height;
+	stage->reimport = reimport;
+
+	reason = dmabuf_setup(stage, ring);
+	if (reason) {
+		printf("dma-buf: %s, uploading frames instead\n", reason);
+		dmabuf_free(stage);
+
+		return upload_new(gles, geometry, UPLOAD_SUB_IMAGE, ring,
+				  width, height, NULL);
+	}
+
+	stage->vertex = glsl_shader_new(GL_VERTEX_SHADER, dmabuf_vs,
+					ARRAY_SIZE(dmabuf_vs));
+	if (!stage->vertex) {
+		fprintf(stderr, "failed to create vertex shader\n");
+		return NULL;
+	}
+
+	stage->fragment = glsl_shader_new(GL_FRAGMENT_SHADER, dmabuf_fs,
+					  ARRAY_SIZE(dmabuf_fs));
+	if (!stage->fragment) {
+		fprintf(stderr, "failed to create fragment shader\n");
+		return NULL;
+	}
+
+	stage->program = glsl_program_new(stage->vertex, stage->fragment);
+	if (!stage->program) {
+		fprintf(stderr, "failed to create GLSL program\n");
+		return NULL;
+	}
+
+	if (glsl_program_link(stage->program) < 0) {
+		fprintf(stderr, "failed to link GLSL program\n");
+		return NULL;
+	}
+
+	stage->pos = glGetAttribLocation(stage->program->id, "position");
+	stage->tex = glGetAttribLocation(stage->program->id, "tex");
+	stage->input = glGetUniformLocation(stage->program->id, "source");
+
+	return &stage->base;
+}
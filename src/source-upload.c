@@ -0,0 +1,383 @@
+/*
+ * Copyright (C) 2013 Avionic Design GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pipeline.h"
+#include "geometry.h"
+#include "gles.h"
+#include "video-file.h"
+
+/* distinct CPU frames uploaded in turn */
+#define UPLOAD_FRAMES 2
+
+/* upper limit for the number of textures in the ring */
+#define UPLOAD_MAX_RING 8
+
+#define UPLOAD_MAX_PLANES 3
+
+struct upload_plane {
+	unsigned int width;
+	unsigned int height;
+	GLenum format;
+	size_t offset;
+};
+
+/*
+ * Uploads a CPU frame every time it is rendered, as a decoder feeding the
+ * pipeline would, and copies it to the output. The frame either replaces
+ * the storage of the texture (glTexImage2D) or its contents only
+ * (glTexSubImage2D). Updating a texture that the GPU may still be reading
+ * for the previous frame can stall until it is done, so the frames can be
+ * uploaded to a ring of textures in turn.
+ *
+ * Frames are either read from a video file, or generated up front. I420
+ * frames are uploaded as three luminance planes and converted to RGB
+ * while copying.
+ */
+struct upload {
+	struct pipeline_stage base;
+
+	struct geometry *geometry;
+
+	struct glsl_shader *vertex, *fragment;
+	struct glsl_program *program;
+
+	/* attribute locations */
+	GLint pos, tex;
+
+	/* uniform locations */
+	GLint matrix, offset;
+
+	struct upload_plane planes[UPLOAD_MAX_PLANES];
+	unsigned int num_planes;
+
+	struct texture *ring[UPLOAD_MAX_RING][UPLOAD_MAX_PLANES];
+	unsigned int num_textures;
+	unsigned int head;
+
+	struct video_file *file;
+	uint8_t *frames[UPLOAD_FRAMES];
+	unsigned long count;
+
+	/* YCbCr to RGB conversion, column-major */
+	GLfloat vmatrix[9];
+	GLfloat voffset[3];
+
+	enum upload_mode mode;
+	unsigned int width;
+	unsigned int height;
+};
+
+static const GLchar *upload_vs[] = {
+	"attribute vec3 position;\n",
+	"attribute vec2 tex;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"   gl_Position = vec4(position, 1.0);\n",
+	"   vtex = tex;\n",
+	"}"
+};
+
+static const GLchar *upload_fs[] = {
+	"precision mediump float;\n",
+	"uniform sampler2D plane0;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"    gl_FragColor = texture2D(plane0, vtex);\n",
+	"}"
+};
+
+static const GLchar *upload_i420_fs[] = {
+	"precision mediump float;\n",
+	"uniform sampler2D plane0;\n",
+	"uniform sampler2D plane1;\n",
+	"uniform sampler2D plane2;\n",
+	"uniform mat3 matrix;\n",
+	"uniform vec3 offset;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"    vec3 yuv;\n",
+	"\n",
+	"    yuv.x = texture2D(plane0, vtex).r;\n",
+	"    yuv.y = texture2D(plane1, vtex).r;\n",
+	"    yuv.z = texture2D(plane2, vtex).r;\n",
+	"\n",
+	"    gl_FragColor = vec4(matrix * yuv + offset, 1.0);\n",
+	"}"
+};
+
+static inline struct upload *to_upload(struct pipeline_stage *stage)
+{
+	return (struct upload *)stage;
+}
+
+/* diagonal color ramps, shifted from one frame to the next */
+static int upload_frames_fill(struct upload *upload)
+{
+	unsigned int x, y, i;
+
+	for (i = 0; i < UPLOAD_FRAMES; i++) {
+		uint8_t *pixel;
+
+		upload->frames[i] = malloc(upload->width * upload->height * 4);
+		if (!upload->frames[i])
+			return -1;
+
+		pixel = upload->frames[i];
+
+		for (y = 0; y < upload->height; y++) {
+			for (x = 0; x < upload->width; x++, pixel += 4) {
+				pixel[0] = x + y + i * 64;
+				pixel[1] = x - y + i * 64;
+				pixel[2] = x * 2 + i * 64;
+				pixel[3] = 255;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static void upload_plane_setup(struct upload_plane *plane,
+			       unsigned int width, unsigned int height,
+			       GLenum format, size_t offset)
+{
+	plane->width = width;
+	plane->height = height;
+	plane->format = format;
+	plane->offset = offset;
+}
+
+static void upload_release(struct pipeline_stage *stage)
+{
+	struct upload *upload = to_upload(stage);
+	unsigned int i, j;
+
+	for (i = 0; i < upload->num_textures; i++)
+		for (j = 0; j < upload->num_planes; j++)
+			texture_free(upload->ring[i][j]);
+
+	for (i = 0; i < UPLOAD_FRAMES; i++)
+		free(upload->frames[i]);
+
+	video_file_close(upload->file);
+
+	glsl_program_free(upload->program);
+	free(upload);
+}
+
+static void upload_render(struct pipeline_stage *stage)
+{
+	struct upload *upload = to_upload(stage);
+	struct geometry *geometry = upload->geometry;
+	struct texture **textures = upload->ring[upload->head];
+	const uint8_t *frame;
+	unsigned int i;
+
+	if (upload->file)
+		frame = video_file_read(upload->file);
+	else
+		frame = upload->frames[upload->count % UPLOAD_FRAMES];
+
+	upload->head = (upload->head + 1) % upload->num_textures;
+	upload->count++;
+
+	glUseProgram(upload->program->id);
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	for (i = 0; i < upload->num_planes; i++) {
+		struct upload_plane *plane = &upload->planes[i];
+
+		glActiveTexture(GL_TEXTURE0 + i);
+		glBindTexture(GL_TEXTURE_2D, textures[i]->id);
+		glUniform1i(textures[i]->loc, i);
+
+		pipeline_upload(stage->pipeline, upload->mode == UPLOAD_IMAGE,
+				plane->width, plane->height, plane->format,
+				frame + plane->offset);
+	}
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	glVertexAttribPointer(upload->pos, 3, GL_FLOAT, GL_FALSE,
+			      3 * sizeof(GLfloat), geometry->vertices);
+	glEnableVertexAttribArray(upload->pos);
+
+	glVertexAttribPointer(upload->tex, 2, GL_FLOAT, GL_FALSE,
+			      2 * sizeof(GLfloat), geometry->uv);
+	glEnableVertexAttribArray(upload->tex);
+
+	glUniformMatrix3fv(upload->matrix, 1, GL_FALSE, upload->vmatrix);
+	glUniform3fv(upload->offset, 1, upload->voffset);
+
+	glDrawElements(GL_TRIANGLES, geometry->num_indices, GL_UNSIGNED_SHORT,
+		       geometry->indices);
+
+	glActiveTexture(GL_TEXTURE0);
+}
+
+/* frames are produced at their native size */
+static void upload_output_size(struct pipeline_stage *stage,
+			       unsigned int *width, unsigned int *height)
+{
+	struct upload *upload = to_upload(stage);
+
+	*width = upload->width;
+	*height = upload->height;
+}
+
+struct pipeline_stage *upload_new(struct gles *gles,
+				  struct geometry *geometry,
+				  enum upload_mode mode, unsigned int ring,
+				  unsigned int width, unsigned int height,
+				  struct video_file *file)
+{
+	static const char *const names[UPLOAD_MAX_PLANES] = {
+		"plane0", "plane1", "plane2"
+	};
+	const GLchar **fs = upload_fs;
+	GLint count = ARRAY_SIZE(upload_fs);
+	struct upload *stage;
+	unsigned int i, j;
+
+	if (ring < 1 || ring > UPLOAD_MAX_RING) {
+		fprintf(stderr, "ring must be within [1, %u]\n",
+			UPLOAD_MAX_RING);
+		return NULL;
+	}
+
+	if (file) {
+		width = file->width;
+		height = file->height;
+	}
+
+	if (width < 1 || height < 1) {
+		fprintf(stderr, "invalid frame size: %ux%u\n", width, height);
+		return NULL;
+	}
+
+	stage = calloc(1, sizeof(*stage));
+	if (!stage)
+		return NULL;
+
+	stage->base.name = mode == UPLOAD_IMAGE ? "texture upload (image)" :
+						  "texture upload (subimage)";
+	stage->base.release = upload_release;
+	stage->base.render = upload_render;
+	stage->base.output_size = upload_output_size;
+	stage->base.stateful = true;
+
+	stage->geometry = geometry;
+	stage->mode = mode;
+	stage->width = width;
+	stage->height = height;
+	stage->file = file;
+
+	if (file && file->layout == VIDEO_LAYOUT_I420) {
+		unsigned int cw = (width + 1) / 2, ch = (height + 1) / 2;
+		size_t luma = (size_t)width * height;
+
+		upload_plane_setup(&stage->planes[0], width, height,
+				   GL_LUMINANCE, 0);
+		upload_plane_setup(&stage->planes[1], cw, ch, GL_LUMINANCE,
+				   luma);
+		upload_plane_setup(&stage->planes[2], cw, ch, GL_LUMINANCE,
+				   luma + (size_t)cw * ch);
+		stage->num_planes = 3;
+
+		yuv_matrix_setup(YUV_MATRIX_BT601, file->full_range,
+				 stage->vmatrix, stage->voffset);
+
+		fs = upload_i420_fs;
+		count = ARRAY_SIZE(upload_i420_fs);
+	} else {
+		upload_plane_setup(&stage->planes[0], width, height, GL_RGBA,
+				   0);
+		stage->num_planes = 1;
+	}
+
+	if (!file && upload_frames_fill(stage) < 0) {
+		fprintf(stderr, "failed to allocate frames\n");
+		return NULL;
+	}
+
+	/* the storage is allocated up front, also for reallocation */
+	for (i = 0; i < ring; i++) {
+		for (j = 0; j < stage->num_planes; j++) {
+			struct upload_plane *plane = &stage->planes[j];
+
+			stage->ring[i][j] = texture_new(GL_LINEAR);
+			if (!stage->ring[i][j])
+				return NULL;
+
+			glTexImage2D(GL_TEXTURE_2D, 0, plane->format,
+				     plane->width, plane->height, 0,
+				     plane->format, GL_UNSIGNED_BYTE, NULL);
+		}
+
+		stage->num_textures++;
+	}
+
+	stage->vertex = glsl_shader_new(GL_VERTEX_SHADER, upload_vs,
+					ARRAY_SIZE(upload_vs));
+	if (!stage->vertex) {
+		fprintf(stderr, "failed to create vertex shader\n");
+		return NULL;
+	}
+
+	stage->fragment = glsl_shader_new(GL_FRAGMENT_SHADER, fs, count);
+	if (!stage->fragment) {
+		fprintf(stderr, "failed to create fragment shader\n");
+		return NULL;
+	}
+
+	stage->program = glsl_program_new(stage->vertex, stage->fragment);
+	if (!stage->program) {
+		fprintf(stderr, "failed to create GLSL program\n");
+		return NULL;
+	}
+
+	if (glsl_program_link(stage->program) < 0) {
+		fprintf(stderr, "failed to link GLSL program\n");
+		return NULL;
+	}
+
+	stage->pos = glGetAttribLocation(stage->program->id, "position");
+	stage->tex = glGetAttribLocation(stage->program->id, "tex");
+	stage->matrix = glGetUniformLocation(stage->program->id, "matrix");
+	stage->offset = glGetUniformLocation(stage->program->id, "offset");
+
+	for (i = 0; i < ring; i++)
+		for (j = 0; j < stage->num_planes; j++)
+			stage->ring[i][j]->loc =
+				glGetUniformLocation(stage->program->id,
+						     names[j]);
+
+	return &stage->base;
+}
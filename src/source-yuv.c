@@ -0,0 +1,488 @@
+/*
+ * Copyright (C) 2013 Avionic Design GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pipeline.h"
+#include "geometry.h"
+#include "gles.h"
+
+#define YUV_MAX_PLANES 3
+
+struct yuv_plane {
+	struct texture *texture;
+	unsigned int width;
+	unsigned int height;
+	GLenum format;
+	unsigned int bpp;
+};
+
+struct yuv_source {
+	struct pipeline_stage base;
+
+	struct geometry *geometry;
+
+	struct glsl_shader *vertex, *fragment;
+	struct glsl_program *program;
+
+	struct yuv_plane planes[YUV_MAX_PLANES];
+	unsigned int num_planes;
+
+	enum yuv_format format;
+	unsigned int width;
+	unsigned int height;
+
+	/* attribute locations */
+	GLint pos, tex;
+
+	/* uniform locations */
+	GLint matrix, offset, size;
+
+	/* YCbCr to RGB conversion, column-major */
+	GLfloat vmatrix[9];
+	GLfloat voffset[3];
+};
+
+static const GLchar *yuv_source_vs[] = {
+	"attribute vec3 position;\n",
+	"attribute vec2 tex;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"   gl_Position = vec4(position, 1.0);\n",
+	"   vtex = tex;\n",
+	"}"
+};
+
+/* two planes: luminance and interleaved chroma as luminance-alpha */
+static const GLchar *yuv_source_nv12_fs[] = {
+	"precision mediump float;\n",
+	"uniform sampler2D plane0;\n",
+	"uniform sampler2D plane1;\n",
+	"uniform mat3 matrix;\n",
+	"uniform vec3 offset;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"    vec3 yuv;\n",
+	"\n",
+	"    yuv.x = texture2D(plane0, vtex).r;\n",
+	"    yuv.yz = texture2D(plane1, vtex).ra;\n",
+	"\n",
+	"    gl_FragColor = vec4(matrix * yuv + offset, 1.0);\n",
+	"}"
+};
+
+/* three planes, all luminance */
+static const GLchar *yuv_source_i420_fs[] = {
+	"precision mediump float;\n",
+	"uniform sampler2D plane0;\n",
+	"uniform sampler2D plane1;\n",
+	"uniform sampler2D plane2;\n",
+	"uniform mat3 matrix;\n",
+	"uniform vec3 offset;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"    vec3 yuv;\n",
+	"\n",
+	"    yuv.x = texture2D(plane0, vtex).r;\n",
+	"    yuv.y = texture2D(plane1, vtex).r;\n",
+	"    yuv.z = texture2D(plane2, vtex).r;\n",
+	"\n",
+	"    gl_FragColor = vec4(matrix * yuv + offset, 1.0);\n",
+	"}"
+};
+
+/*
+ * Packed Y0 U Y1 V, uploaded as a full width luminance-alpha texture so
+ * that luminance is in the L channel and chroma alternates between U and
+ * V in the A channel. Chroma is fetched from the even/odd texel pair.
+ */
+static const GLchar *yuv_source_yuyv_fs[] = {
+	GLSL_PRECISION_HIGH,
+	"uniform sampler2D plane0;\n",
+	"uniform mat3 matrix;\n",
+	"uniform vec3 offset;\n",
+	"uniform vec2 size;\n",
+	"varying vec2 vtex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"    float x = floor(vtex.x * size.x);\n",
+	"    float even = x - mod(x, 2.0);\n",
+	"    vec3 yuv;\n",
+	"\n",
+	"    yuv.x = texture2D(plane0, vtex).r;\n",
+	"    yuv.y = texture2D(plane0, vec2((even + 0.5) / size.x, vtex.y)).a;\n",
+	"    yuv.z = texture2D(plane0, vec2((even + 1.5) / size.x, vtex.y)).a;\n",
+	"\n",
+	"    gl_FragColor = vec4(matrix * yuv + offset, 1.0);\n",
+	"}"
+};
+
+static inline struct yuv_source *to_yuv_source(struct pipeline_stage *stage)
+{
+	return (struct yuv_source *)stage;
+}
+
+/*
+ * Compute the matrix and offset converting normalized Y'CbCr values to
+ * R'G'B' for the given luma coefficients. Limited range video has luma
+ * in [16, 235] and chroma in [16, 240] (out of 255).
+ */
+void yuv_matrix_setup(enum yuv_matrix matrix, bool full_range,
+		      GLfloat coeff[9], GLfloat offset[3])
+{
+	GLfloat kr, kb, kg, ys, cs, yo, co;
+	GLfloat rv, gu, gv, bu;
+
+	switch (matrix) {
+	case YUV_MATRIX_BT601:
+	default:
+		kr = 0.299f;
+		kb = 0.114f;
+		break;
+
+	case YUV_MATRIX_BT709:
+		kr = 0.2126f;
+		kb = 0.0722f;
+		break;
+
+	case YUV_MATRIX_BT2020:
+		kr = 0.2627f;
+		kb = 0.0593f;
+		break;
+	}
+
+	kg = 1.0f - kr - kb;
+
+	if (full_range) {
+		ys = 1.0f;
+		cs = 1.0f;
+		yo = 0.0f;
+	} else {
+		ys = 255.0f / 219.0f;
+		cs = 255.0f / 224.0f;
+		yo = 16.0f / 255.0f;
+	}
+
+	co = 128.0f / 255.0f;
+
+	rv = 2.0f * (1.0f - kr) * cs;
+	gu = -2.0f * kb * (1.0f - kb) / kg * cs;
+	gv = -2.0f * kr * (1.0f - kr) / kg * cs;
+	bu = 2.0f * (1.0f - kb) * cs;
+
+	/* column 0: Y, column 1: Cb, column 2: Cr */
+	coeff[0] = ys;
+	coeff[1] = ys;
+	coeff[2] = ys;
+	coeff[3] = 0.0f;
+	coeff[4] = gu;
+	coeff[5] = bu;
+	coeff[6] = rv;
+	coeff[7] = gv;
+	coeff[8] = 0.0f;
+
+	offset[0] = -ys * yo - rv * co;
+	offset[1] = -ys * yo - (gu + gv) * co;
+	offset[2] = -ys * yo - bu * co;
+}
+
+static void yuv_plane_setup(struct yuv_plane *plane, unsigned int width,
+			    unsigned int height, GLenum format,
+			    unsigned int bpp)
+{
+	plane->width = width;
+	plane->height = height;
+	plane->format = format;
+	plane->bpp = bpp;
+}
+
+/*
+ * Fill the planes with a test pattern: a luma ramp from left to right and
+ * chroma ramps in opposite directions, so that conversion errors show.
+ */
+static void yuv_source_fill(struct yuv_source *yuv, uint8_t *data[])
+{
+	unsigned int width = yuv->width, height = yuv->height, x, y;
+
+	switch (yuv->format) {
+	case YUV_FORMAT_NV12:
+	case YUV_FORMAT_I420:
+		for (y = 0; y < height; y++)
+			for (x = 0; x < width; x++)
+				data[0][y * width + x] = 16 + x * 219 / width;
+
+		for (y = 0; y < height / 2; y++) {
+			for (x = 0; x < width / 2; x++) {
+				uint8_t u = 16 + y * 448 / height;
+				uint8_t v = 240 - x * 448 / width;
+
+				if (yuv->format == YUV_FORMAT_NV12) {
+					data[1][(y * width / 2 + x) * 2 + 0] = u;
+					data[1][(y * width / 2 + x) * 2 + 1] = v;
+				} else {
+					data[1][y * width / 2 + x] = u;
+					data[2][y * width / 2 + x] = v;
+				}
+			}
+		}
+		break;
+
+	case YUV_FORMAT_YUYV:
+		for (y = 0; y < height; y++) {
+			uint8_t *line = data[0] + y * width * 2;
+
+			for (x = 0; x < width; x++) {
+				line[x * 2 + 0] = 16 + x * 219 / width;
+
+				if (x % 2 == 0)
+					line[x * 2 + 1] = 16 + y * 224 / height;
+				else
+					line[x * 2 + 1] = 240 - x * 224 / width;
+			}
+		}
+		break;
+	}
+}
+
+static int yuv_source_upload(struct yuv_source *yuv)
+{
+	uint8_t *data[YUV_MAX_PLANES];
+	unsigned int i;
+
+	for (i = 0; i < yuv->num_planes; i++) {
+		struct yuv_plane *plane = &yuv->planes[i];
+
+		data[i] = malloc(plane->width * plane->height * plane->bpp);
+		if (!data[i]) {
+			while (i--)
+				free(data[i]);
+
+			return -1;
+		}
+	}
+
+	yuv_source_fill(yuv, data);
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	for (i = 0; i < yuv->num_planes; i++) {
+		struct yuv_plane *plane = &yuv->planes[i];
+		GLuint filter = GL_LINEAR;
+
+		/* chroma pairs must not be interpolated across */
+		if (yuv->format == YUV_FORMAT_YUYV)
+			filter = GL_NEAREST;
+
+		plane->texture = texture_new(filter);
+		if (!plane->texture)
+			break;
+
+		glTexImage2D(GL_TEXTURE_2D, 0, plane->format, plane->width,
+			     plane->height, 0, plane->format,
+			     GL_UNSIGNED_BYTE, data[i]);
+	}
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	for (i = 0; i < yuv->num_planes; i++)
+		free(data[i]);
+
+	for (i = 0; i < yuv->num_planes; i++)
+		if (!yuv->planes[i].texture)
+			return -1;
+
+	return 0;
+}
+
+static void yuv_source_release(struct pipeline_stage *stage)
+{
+	struct yuv_source *yuv = to_yuv_source(stage);
+	unsigned int i;
+
+	for (i = 0; i < yuv->num_planes; i++)
+		if (yuv->planes[i].texture)
+			texture_free(yuv->planes[i].texture);
+
+	glsl_program_free(yuv->program);
+	free(yuv);
+}
+
+static void yuv_source_render(struct pipeline_stage *stage)
+{
+	struct yuv_source *yuv = to_yuv_source(stage);
+	struct geometry *geometry = yuv->geometry;
+	unsigned int i;
+
+	glUseProgram(yuv->program->id);
+
+	glVertexAttribPointer(yuv->pos, 3, GL_FLOAT, GL_FALSE,
+			      3 * sizeof(GLfloat), geometry->vertices);
+	glEnableVertexAttribArray(yuv->pos);
+
+	glVertexAttribPointer(yuv->tex, 2, GL_FLOAT, GL_FALSE,
+			      2 * sizeof(GLfloat), geometry->uv);
+	glEnableVertexAttribArray(yuv->tex);
+
+	for (i = 0; i < yuv->num_planes; i++) {
+		glActiveTexture(GL_TEXTURE0 + i);
+		glBindTexture(GL_TEXTURE_2D, yuv->planes[i].texture->id);
+		glUniform1i(yuv->planes[i].texture->loc, i);
+	}
+
+	glUniformMatrix3fv(yuv->matrix, 1, GL_FALSE, yuv->vmatrix);
+	glUniform3fv(yuv->offset, 1, yuv->voffset);
+	glUniform2f(yuv->size, yuv->width, yuv->height);
+
+	glDrawElements(GL_TRIANGLES, geometry->num_indices, GL_UNSIGNED_SHORT,
+		       geometry->indices);
+
+	glActiveTexture(GL_TEXTURE0);
+}
+
+/* frames are produced at their native size */
+static void yuv_source_output_size(struct pipeline_stage *stage,
+				   unsigned int *width, unsigned int *height)
+{
+	struct yuv_source *yuv = to_yuv_source(stage);
+
+	*width = yuv->width;
+	*height = yuv->height;
+}
+
+struct pipeline_stage *yuv_source_new(struct gles *gles,
+				      struct geometry *geometry,
+				      enum yuv_format format,
+				      enum yuv_matrix matrix,
+				      bool full_range, unsigned int width,
+				      unsigned int height)
+{
+	static const char *const names[YUV_MAX_PLANES] = {
+		"plane0", "plane1", "plane2"
+	};
+	const GLchar **fs = NULL;
+	struct yuv_source *stage;
+	unsigned int i;
+	GLint count = 0;
+
+	if (width < 2 || height < 2 || width % 2 || height % 2) {
+		fprintf(stderr, "invalid YUV frame size: %ux%u\n", width,
+			height);
+		return NULL;
+	}
+
+	stage = calloc(1, sizeof(*stage));
+	if (!stage)
+		return NULL;
+
+	stage->base.release = yuv_source_release;
+	stage->base.render = yuv_source_render;
+	stage->base.output_size = yuv_source_output_size;
+
+	stage->geometry = geometry;
+	stage->format = format;
+	stage->width = width;
+	stage->height = height;
+
+	switch (format) {
+	case YUV_FORMAT_NV12:
+		stage->base.name = "NV12 source";
+		yuv_plane_setup(&stage->planes[0], width, height,
+				GL_LUMINANCE, 1);
+		yuv_plane_setup(&stage->planes[1], width / 2, height / 2,
+				GL_LUMINANCE_ALPHA, 2);
+		stage->num_planes = 2;
+		fs = yuv_source_nv12_fs;
+		count = ARRAY_SIZE(yuv_source_nv12_fs);
+		break;
+
+	case YUV_FORMAT_I420:
+		stage->base.name = "I420 source";
+		yuv_plane_setup(&stage->planes[0], width, height,
+				GL_LUMINANCE, 1);
+		yuv_plane_setup(&stage->planes[1], width / 2, height / 2,
+				GL_LUMINANCE, 1);
+		yuv_plane_setup(&stage->planes[2], width / 2, height / 2,
+				GL_LUMINANCE, 1);
+		stage->num_planes = 3;
+		fs = yuv_source_i420_fs;
+		count = ARRAY_SIZE(yuv_source_i420_fs);
+		break;
+
+	case YUV_FORMAT_YUYV:
+		stage->base.name = "YUYV source";
+		yuv_plane_setup(&stage->planes[0], width, height,
+				GL_LUMINANCE_ALPHA, 2);
+		stage->num_planes = 1;
+		fs = yuv_source_yuyv_fs;
+		count = ARRAY_SIZE(yuv_source_yuyv_fs);
+		break;
+	}
+
+	yuv_matrix_setup(matrix, full_range, stage->vmatrix, stage->voffset);
+
+	if (yuv_source_upload(stage) < 0) {
+		fprintf(stderr, "failed to upload YUV planes\n");
+		return NULL;
+	}
+
+	stage->vertex = glsl_shader_new(GL_VERTEX_SHADER, yuv_source_vs,
+					ARRAY_SIZE(yuv_source_vs));
+	if (!stage->vertex) {
+		fprintf(stderr, "failed to create vertex shader\n");
+		return NULL;
+	}
+
+	stage->fragment = glsl_shader_new(GL_FRAGMENT_SHADER, fs, count);
+	if (!stage->fragment) {
+		fprintf(stderr, "failed to create fragment shader\n");
+		return NULL;
+	}
+
+	stage->program = glsl_program_new(stage->vertex, stage->fragment);
+	if (!stage->program) {
+		fprintf(stderr, "failed to create GLSL program\n");
+		return NULL;
+	}
+
+	if (glsl_program_link(stage->program) < 0) {
+		fprintf(stderr, "failed to link GLSL program\n");
+		return NULL;
+	}
+
+	stage->pos = glGetAttribLocation(stage->program->id, "position");
+	stage->tex = glGetAttribLocation(stage->program->id, "tex");
+	stage->matrix = glGetUniformLocation(stage->program->id, "matrix");
+	stage->offset = glGetUniformLocation(stage->program->id, "offset");
+	stage->size = glGetUniformLocation(stage->program->id, "size");
+
+	for (i = 0; i < stage->num_planes; i++)
+		stage->planes[i].texture->loc =
+			glGetUniformLocation(stage->program->id, names[i]);
+
+	return &stage->base;
+}
@@ -0,0 +1,367 @@
+/*
+ * Copyright (C) 2013 Avionic Design GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "video-file.h"
+
+#define Y4M_MAGIC "YUV4MPEG2 "
+#define Y4M_FRAME "FRAME"
+
+static size_t video_frame_size(enum video_layout layout, unsigned int width,
+			       unsigned int height)
+{
+	switch (layout) {
+	case VIDEO_LAYOUT_RGBA:
+		return (size_t)width * height * 4;
+
+	case VIDEO_LAYOUT_I420:
+		return (size_t)width * height +
+		       (size_t)((width + 1) / 2) * ((height + 1) / 2) * 2;
+	}
+
+	return 0;
+}
+
+static int video_file_add_frame(struct video_file *file,
+				const uint8_t *frame)
+{
+	unsigned int count = file->num_frames;
+
+	/* grow the index whenever its size reaches a power of two */
+	if ((count & (count - 1)) == 0) {
+		const uint8_t **frames;
+
+		frames = realloc(file->frames, (count ? count * 2 : 1) *
+				 sizeof(*frames));
+		if (!frames)
+			return -1;
+
+		file->frames = frames;
+	}
+
+	file->frames[file->num_frames++] = frame;
+	return 0;
+}
+
+/* 8-bit 4:2:0 formats, which only differ in the chroma siting */
+static bool y4m_chroma_supported(const char *chroma)
+{
+	static const char *const formats[] = {
+		"420", "420jpeg", "420paldv", "420mpeg2"
+	};
+	unsigned int i;
+
+	for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++)
+		if (strcmp(chroma, formats[i]) == 0)
+			return true;
+
+	return false;
+}
+
+/* parses the stream header and indexes the frames that follow it */
+static int video_file_parse_y4m(struct video_file *file)
+{
+	const uint8_t *end = file->data + file->size;
+	const uint8_t *pos, *eol;
+	char *header, *token;
+	char chroma[16] = "420jpeg";
+
+	eol = memchr(file->data, '\n', file->size);
+	if (!eol) {
+		fprintf(stderr, "truncated YUV4MPEG2 header\n");
+		return -1;
+	}
+
+	header = strndup((const char *)file->data, eol - file->data);
+	if (!header)
+		return -1;
+
+	token = strtok(header + strlen(Y4M_MAGIC), " ");
+
+	while (token) {
+		switch (token[0]) {
+		case 'W':
+			file->width = strtoul(token + 1, NULL, 10);
+			break;
+
+		case 'H':
+			file->height = strtoul(token + 1, NULL, 10);
+			break;
+
+		case 'C':
+			snprintf(chroma, sizeof(chroma), "%s", token + 1);
+			break;
+
+		case 'X':
+			if (strcmp(token, "XCOLORRANGE=FULL") == 0)
+				file->full_range = true;
+			break;
+		}
+
+		token = strtok(NULL, " ");
+	}
+
+	free(header);
+
+	if (!y4m_chroma_supported(chroma)) {
+		fprintf(stderr, "unsupported YUV4MPEG2 chroma format: %s\n",
+			chroma);
+		return -1;
+	}
+
+	file->layout = VIDEO_LAYOUT_I420;
+	file->frame_size = video_frame_size(file->layout, file->width,
+					    file->height);
+
+	for (pos = eol + 1; pos + strlen(Y4M_FRAME) <= end; ) {
+		if (memcmp(pos, Y4M_FRAME, strlen(Y4M_FRAME)) != 0) {
+			fprintf(stderr, "invalid YUV4MPEG2 frame header at "
+				"offset %zu\n", (size_t)(pos - file->data));
+			return -1;
+		}
+
+		/* frame parameters are ignored */
+		eol = memchr(pos, '\n', end - pos);
+		if (!eol || file->frame_size > (size_t)(end - eol - 1))
+			break;
+
+		if (video_file_add_frame(file, eol + 1) < 0)
+			return -1;
+
+		pos = eol + 1 + file->frame_size;
+	}
+
+	return 0;
+}
+
+static int video_file_parse_raw(struct video_file *file)
+{
+	size_t offset;
+
+	if (file->width < 1 || file->height < 1) {
+		fprintf(stderr, "raw video needs a width and height\n");
+		return -1;
+	}
+
+	file->frame_size = video_frame_size(file->layout, file->width,
+					    file->height);
+
+	/* a truncated last frame is ignored */
+	for (offset = 0; file->size - offset >= file->frame_size;
+	     offset += file->frame_size)
+		if (video_file_add_frame(file, file->data + offset) < 0)
+			return -1;
+
+	return 0;
+}
+
+/* faults in the pages of a frame */
+static void video_file_touch(struct video_file *file, const uint8_t *frame)
+{
+	uintptr_t page = sysconf(_SC_PAGESIZE);
+	uintptr_t start = (uintptr_t)frame & ~(page - 1);
+	uintptr_t end = (uintptr_t)frame + file->frame_size;
+	volatile const uint8_t *ptr;
+
+	madvise((void *)start, end - start, MADV_WILLNEED);
+
+	for (ptr = (const uint8_t *)start; (uintptr_t)ptr < end; ptr += page)
+		(void)*ptr;
+}
+
+static void *video_file_prefetch(void *data)
+{
+	struct video_file *file = data;
+	const uint8_t *frame;
+
+	pthread_mutex_lock(&file->lock);
+
+	while (!file->done) {
+		if (file->prefetched >= file->position + file->ahead) {
+			pthread_cond_wait(&file->cond, &file->lock);
+			continue;
+		}
+
+		/* frames that have already been read are skipped */
+		if (file->prefetched < file->position)
+			file->prefetched = file->position;
+
+		frame = file->frames[file->prefetched % file->num_frames];
+
+		pthread_mutex_unlock(&file->lock);
+		video_file_touch(file, frame);
+		pthread_mutex_lock(&file->lock);
+
+		file->prefetched++;
+	}
+
+	pthread_mutex_unlock(&file->lock);
+
+	return NULL;
+}
+
+/*
+ * Open a video file. YUV4MPEG2 files are recognized by their header, all
+ * other files are taken as raw frames of the given layout and size.
+ */
+struct video_file *video_file_open(const char *filename,
+				   enum video_layout layout,
+				   unsigned int width, unsigned int height,
+				   unsigned int ahead)
+{
+	struct video_file *file;
+	struct stat st;
+	int err;
+
+	file = calloc(1, sizeof(*file));
+	if (!file)
+		return NULL;
+
+	file->layout = layout;
+	file->width = width;
+	file->height = height;
+
+	pthread_mutex_init(&file->lock, NULL);
+	pthread_cond_init(&file->cond, NULL);
+
+	file->fd = open(filename, O_RDONLY);
+	if (file->fd < 0) {
+		fprintf(stderr, "failed to open %s: %s\n", filename,
+			strerror(errno));
+		goto error;
+	}
+
+	if (fstat(file->fd, &st) < 0 || st.st_size == 0) {
+		fprintf(stderr, "%s: empty or not a regular file\n", filename);
+		goto error;
+	}
+
+	file->size = st.st_size;
+
+	file->data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, file->fd,
+			  0);
+	if (file->data == MAP_FAILED) {
+		fprintf(stderr, "failed to map %s: %s\n", filename,
+			strerror(errno));
+		file->data = NULL;
+		goto error;
+	}
+
+	madvise(file->data, file->size, MADV_SEQUENTIAL);
+
+	if (file->size >= strlen(Y4M_MAGIC) &&
+	    memcmp(file->data, Y4M_MAGIC, strlen(Y4M_MAGIC)) == 0)
+		err = video_file_parse_y4m(file);
+	else
+		err = video_file_parse_raw(file);
+
+	if (err < 0)
+		goto error;
+
+	if (file->width < 1 || file->height < 1) {
+		fprintf(stderr, "%s: invalid frame size: %ux%u\n", filename,
+			file->width, file->height);
+		goto error;
+	}
+
+	if (!file->num_frames) {
+		fprintf(stderr, "%s: no complete frame\n", filename);
+		goto error;
+	}
+
+	if (ahead > file->num_frames)
+		ahead = file->num_frames;
+
+	file->ahead = ahead;
+
+	if (ahead > 0) {
+		err = pthread_create(&file->thread, NULL, video_file_prefetch,
+				     file);
+		if (err) {
+			fprintf(stderr, "failed to create thread: %s\n",
+				strerror(err));
+			goto error;
+		}
+
+		file->running = true;
+	}
+
+	return file;
+
+error:
+	video_file_close(file);
+	return NULL;
+}
+
+void video_file_close(struct video_file *file)
+{
+	if (!file)
+		return;
+
+	if (file->running) {
+		pthread_mutex_lock(&file->lock);
+		file->done = true;
+		pthread_cond_signal(&file->cond);
+		pthread_mutex_unlock(&file->lock);
+
+		pthread_join(file->thread, NULL);
+
+		printf("Video file: %lu frames read, %lu of them before they "
+		       "were prefetched\n", file->position, file->late);
+	}
+
+	if (file->data)
+		munmap(file->data, file->size);
+
+	if (file->fd >= 0)
+		close(file->fd);
+
+	pthread_cond_destroy(&file->cond);
+	pthread_mutex_destroy(&file->lock);
+	free(file->frames);
+	free(file);
+}
+
+/* returns the next frame, starting over after the last one */
+const uint8_t *video_file_read(struct video_file *file)
+{
+	const uint8_t *frame;
+
+	pthread_mutex_lock(&file->lock);
+
+	if (file->running && file->prefetched <= file->position)
+		file->late++;
+
+	frame = file->frames[file->position % file->num_frames];
+	file->position++;
+
+	pthread_cond_signal(&file->cond);
+	pthread_mutex_unlock(&file->lock);
+
+	return frame;
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2013 Avionic Design GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef GLES_TESTBENCH_VIDEO_FILE_H
+#define GLES_TESTBENCH_VIDEO_FILE_H 1
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum video_layout {
+	VIDEO_LAYOUT_RGBA,
+	VIDEO_LAYOUT_I420,
+};
+
+/*
+ * Raw or YUV4MPEG2 video, mapped into memory. The frames are indexed when
+ * the file is opened and are read in an endless loop. A thread faults in
+ * the pages of the frames ahead of the one being read, so that reading
+ * them doesn't have to wait for the disk.
+ */
+struct video_file {
+	int fd;
+	uint8_t *data;
+	size_t size;
+
+	enum video_layout layout;
+	unsigned int width;
+	unsigned int height;
+	bool full_range;
+
+	const uint8_t **frames;
+	size_t frame_size;
+	unsigned int num_frames;
+
+	/* frames read, and prefetched, since the file was opened */
+	unsigned long position;
+	unsigned long prefetched;
+	unsigned int ahead;
+	unsigned long late;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool running;
+	bool done;
+};
+
+struct video_file *video_file_open(const char *filename,
+				   enum video_layout layout,
+				   unsigned int width, unsigned int height,
+				   unsigned int ahead);
+void video_file_close(struct video_file *file);
+const uint8_t *video_file_read(struct video_file *file);
+
+#endif